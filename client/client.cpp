@@ -4,24 +4,487 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <regex>
 #include <fstream>
 #include <cstring>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <zlib.h>
+#include "../common/sparse.h"
+#include "../common/fdpass.h"
+#include "../common/filecopy.h"
+#include "../common/delta.h"
 
 #define CONTROL_PORT 2100
 #define DATA_BUFFER_SIZE 4096
 #define CONNECT_TIMEOUT 5
 #define RESPONSE_TIMEOUT 10
+#define BATCH_WORKERS 4     // mget/mput默认并发连接数
+#define MRETR_BATCH 64      // 每个SITE MRETR请求包含的文件数
+#define LOCAL_SOCKET_PATH "/home/lfd/FTP/server.sock" // 同机服务器的Unix域socket
+
+// 批量传输任务
+struct TransferJob {
+    bool upload = false;    // true为STOR，false为RETR
+    std::string remote;     // 服务器端路径
+    std::string local;      // 本地路径
+    uint64_t size = 0;      // 上传文件大小，作为ALLO提示
+};
+
+// 批量传输统计
+struct BatchStats {
+    std::atomic<uint64_t> files_ok{0};
+    std::atomic<uint64_t> files_failed{0};
+    std::atomic<uint64_t> bytes{0};
+};
+
+// MODE Z的zlib流封装：None时原样透传
+class ZStream {
+public:
+    enum Kind { None, Inflate, Deflate };
+
+private:
+    Kind kind;
+    z_stream zs{};
+
+public:
+    explicit ZStream(Kind k) : kind(k) {
+        if (kind == Inflate) inflateInit(&zs);
+        else if (kind == Deflate) deflateInit(&zs, Z_DEFAULT_COMPRESSION);
+    }
+
+    ~ZStream() {
+        if (kind == Inflate) inflateEnd(&zs);
+        else if (kind == Deflate) deflateEnd(&zs);
+    }
+
+    // 处理一段输入，输出交给sink；last表示输入结束（仅压缩时使用）
+    bool process(const char* data, size_t len, bool last,
+                 const std::function<bool(const char*, size_t)>& sink) {
+        if (kind == None) return len == 0 || sink(data, len);
+
+        char out[DATA_BUFFER_SIZE];
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zs.avail_in = len;
+        while (true) {
+            zs.next_out = reinterpret_cast<Bytef*>(out);
+            zs.avail_out = sizeof(out);
+            int ret = kind == Inflate ? inflate(&zs, Z_NO_FLUSH)
+                                      : deflate(&zs, last ? Z_FINISH : Z_NO_FLUSH);
+            if (ret == Z_STREAM_ERROR || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR) return false;
+            size_t n = sizeof(out) - zs.avail_out;
+            if (n && !sink(out, n)) return false;
+            if (ret == Z_STREAM_END) return true;
+            // 输出缓冲未写满说明输入已处理完
+            if (zs.avail_out != 0 && zs.avail_in == 0) return true;
+        }
+    }
+};
+
+// 批量传输使用的控制连接：在多个文件之间复用，
+// PASV与RETR/STOR合并成一次发送，并提前发出下一个文件的命令（流水线）
+class BatchSession {
+private:
+    int ctrl_sock = -1;
+    std::string ctrl_buf;   // 控制连接接收缓冲
+
+    bool send_line(const std::string& cmd) {
+        std::string msg = cmd + "\r\n";
+        if (send(ctrl_sock, msg.c_str(), msg.size(), MSG_NOSIGNAL) < 0) {
+            last_error = "发送失败: " + std::string(strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    bool read_line(std::string& line) {
+        size_t pos;
+        while ((pos = ctrl_buf.find("\r\n")) == std::string::npos) {
+            char buffer[DATA_BUFFER_SIZE];
+            ssize_t bytes = recv(ctrl_sock, buffer, sizeof(buffer), 0);
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes <= 0) {
+                last_error = bytes == 0 ? "连接已关闭" : "接收失败: " + std::string(strerror(errno));
+                close(ctrl_sock);
+                ctrl_sock = -1;
+                return false;
+            }
+            ctrl_buf.append(buffer, bytes);
+        }
+        line = ctrl_buf.substr(0, pos);
+        ctrl_buf.erase(0, pos + 2);
+        return true;
+    }
+
+    // 读取一条完整回复（支持"xyz-"开头的多行回复）
+    bool read_reply(std::string& reply) {
+        if (!read_line(reply)) return false;
+        if (reply.size() > 3 && reply[3] == '-') {
+            std::string code = reply.substr(0, 3);
+            std::string line;
+            do {
+                if (!read_line(line)) return false;
+                reply += "\n" + line;
+            } while (line.compare(0, 3, code) != 0 || line.size() < 4 || line[3] != ' ');
+        }
+        return true;
+    }
+
+    // 根据227回复建立数据连接
+    int connect_pasv(const std::string& reply) {
+        std::regex pattern(R"((\d+),(\d+),(\d+),(\d+),(\d+),(\d+))");
+        std::smatch m;
+        if (reply.compare(0, 3, "227") != 0 || !std::regex_search(reply, m, pattern)) {
+            last_error = "PASV失败: " + reply;
+            return -1;
+        }
+        std::string ip = m[1].str() + "." + m[2].str() + "." + m[3].str() + "." + m[4].str();
+        int port = (std::stoi(m[5]) << 8) + std::stoi(m[6]);
+
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+        if (sock < 0 || ::connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            last_error = "数据连接失败: " + std::string(strerror(errno));
+            if (sock >= 0) close(sock);
+            return -1;
+        }
+        return sock;
+    }
+
+    // 一次发送PASV和传输命令；上传时先用ALLO告知大小，让服务器预分配空间
+    bool issue(const TransferJob& job) {
+        std::string allo = job.upload && job.size ? "ALLO " + std::to_string(job.size) + "\r\n" : "";
+        return send_line(allo + "PASV\r\n" + std::string(job.upload ? "STOR " : "RETR ") + job.remote);
+    }
+
+    // 在数据连接上收发一个文件，返回传输的字节数，失败返回-1
+    int64_t move_data(const TransferJob& job, int sock) {
+        char buffer[DATA_BUFFER_SIZE];
+        int64_t total = 0;
+        if (job.upload) {
+            std::ifstream file(job.local, std::ios::binary);
+            if (!file) return -1;
+            while (file) {
+                file.read(buffer, sizeof(buffer));
+                std::streamsize n = file.gcount();
+                for (std::streamsize off = 0; off < n; ) {
+                    ssize_t sent = send(sock, buffer + off, n - off, MSG_NOSIGNAL);
+                    if (sent <= 0) return -1;
+                    off += sent;
+                }
+                total += n;
+            }
+        } else {
+            // 本地文件无法创建时仍需读完数据，保持控制连接同步
+            std::ofstream file(job.local, std::ios::binary);
+            bool ok = static_cast<bool>(file);
+            while (true) {
+                ssize_t bytes = recv(sock, buffer, sizeof(buffer), 0);
+                if (bytes < 0 && errno == EINTR) continue;
+                if (bytes < 0) return -1;
+                if (bytes == 0) break;
+                if (ok) file.write(buffer, bytes);
+                total += bytes;
+            }
+            if (!ok || !file) return -1;
+        }
+        return total;
+    }
+
+    // 从数据连接读取，优先使用缓冲中的剩余数据
+    static ssize_t stream_read(int sock, std::string& buf, char* out, size_t len) {
+        if (!buf.empty()) {
+            size_t n = std::min(len, buf.size());
+            memcpy(out, buf.data(), n);
+            buf.erase(0, n);
+            return n;
+        }
+        ssize_t n;
+        while ((n = recv(sock, out, len, 0)) < 0 && errno == EINTR) {}
+        return n;
+    }
+
+    static bool stream_line(int sock, std::string& buf, std::string& line) {
+        size_t pos;
+        char chunk[DATA_BUFFER_SIZE];
+        while ((pos = buf.find('\n')) == std::string::npos) {
+            ssize_t n = recv(sock, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            buf.append(chunk, n);
+        }
+        line = buf.substr(0, pos);
+        buf.erase(0, pos + 1);
+        return true;
+    }
+
+    // 解包SITE MRETR数据流，按顺序写入各个本地文件并校验CRC32
+    bool unpack_stream(int sock, const std::vector<TransferJob>& batch, BatchStats& stats) {
+        std::string buf, line;
+        char chunk[DATA_BUFFER_SIZE];
+        size_t index = 0;
+        while (stream_line(sock, buf, line)) {
+            std::istringstream hdr(line);
+            std::string tag, name;
+            hdr >> tag;
+            if (tag == "END") return true;
+            if (tag == "ERR") {
+                hdr >> name;
+                std::cerr << "传输失败 " << line.substr(4) << std::endl;
+                stats.files_failed++;
+                index++;
+                continue;
+            }
+
+            uint64_t size = 0;
+            if (tag != "FILE" || !(hdr >> size >> name)) {
+                last_error = "无效的数据流头部: " + line;
+                return false;
+            }
+            // 服务器按请求顺序返回，找到对应的本地路径
+            while (index < batch.size() && batch[index].remote != name) index++;
+            std::string local = index < batch.size() ? batch[index++].local : name;
+
+            std::ofstream file(local, std::ios::binary);
+            uLong crc = crc32(0L, Z_NULL, 0);
+            for (uint64_t left = size; left > 0; ) {
+                ssize_t n = stream_read(sock, buf, chunk, std::min<uint64_t>(left, sizeof(chunk)));
+                if (n <= 0) {
+                    last_error = "数据流提前结束";
+                    return false;
+                }
+                crc = crc32(crc, reinterpret_cast<Bytef*>(chunk), n);
+                file.write(chunk, n);
+                left -= n;
+            }
+            // 数据之后是服务器边发送边计算的校验和 "CRC <crc32>"
+            if (!stream_line(sock, buf, line) || line.compare(0, 4, "CRC ") != 0) {
+                last_error = "无效的数据流尾部: " + line;
+                return false;
+            }
+            std::string crc_hex = line.substr(4);
+            if (file && crc == std::stoul(crc_hex, nullptr, 16)) {
+                stats.files_ok++;
+                stats.bytes += size;
+            } else {
+                std::cerr << "传输失败 " << name << ": " << (file ? "校验和不匹配" : "写入失败") << std::endl;
+                stats.files_failed++;
+            }
+        }
+        last_error = "数据流提前结束";
+        return false;
+    }
+
+public:
+    std::string last_error;
+
+    ~BatchSession() {
+        if (ctrl_sock != -1) {
+            send_line("QUIT");
+            close(ctrl_sock);
+        }
+    }
+
+    bool open(const std::string& server_ip) {
+        ctrl_sock = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(CONTROL_PORT);
+        inet_pton(AF_INET, server_ip.c_str(), &addr.sin_addr);
+        if (ctrl_sock < 0 || ::connect(ctrl_sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            last_error = "连接失败: " + std::string(strerror(errno));
+            return false;
+        }
+        int opt = 1;
+        setsockopt(ctrl_sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        std::string reply;
+        return read_reply(reply) && reply.compare(0, 3, "220") == 0;
+    }
+
+    bool alive() const { return ctrl_sock != -1; }
+
+    // 执行一条简单命令，返回回复
+    bool command(const std::string& cmd, std::string& reply) {
+        return send_line(cmd) && read_reply(reply);
+    }
+
+    // 列出远程目录：名称 + 是否为目录
+    bool mlsd(const std::string& path, std::vector<std::pair<std::string, bool>>& entries) {
+        std::string reply;
+        if (!send_line("PASV\r\nMLSD " + path) || !read_reply(reply)) return false;
+        int sock = connect_pasv(reply);
+        if (!read_reply(reply)) return false;
+        if (reply.compare(0, 3, "150") != 0) {
+            if (sock >= 0) close(sock);
+            last_error = reply;
+            return false;
+        }
+
+        std::string data;
+        char buffer[DATA_BUFFER_SIZE];
+        ssize_t bytes;
+        while ((bytes = recv(sock, buffer, sizeof(buffer), 0)) > 0) data.append(buffer, bytes);
+        close(sock);
+        if (!read_reply(reply)) return false;
+
+        std::istringstream iss(data);
+        std::string line;
+        while (std::getline(iss, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            size_t sp = line.find("; ");
+            if (sp == std::string::npos) continue;
+            entries.emplace_back(line.substr(sp + 2),
+                                 line.find("type=dir;") != std::string::npos);
+        }
+        return true;
+    }
+
+    // 取服务器文件清单（SITE MANIFEST），data为数据连接上收到的全部内容
+    bool manifest(uint64_t since, const std::string& dir, std::string& data) {
+        std::string reply;
+        if (!send_line("PASV\r\nSITE MANIFEST SINCE " + std::to_string(since) + " " + dir) ||
+            !read_reply(reply))
+            return false;
+        int sock = connect_pasv(reply);
+        if (!read_reply(reply)) return false;
+        if (reply.compare(0, 3, "150") != 0) {
+            if (sock >= 0) close(sock);
+            last_error = reply;
+            return false;
+        }
+        char buffer[DATA_BUFFER_SIZE];
+        ssize_t bytes;
+        while ((bytes = recv(sock, buffer, sizeof(buffer), 0)) > 0) data.append(buffer, bytes);
+        close(sock);
+        if (!read_reply(reply)) return false;
+        if (reply.compare(0, 3, "226") != 0) {
+            last_error = reply;
+            return false;
+        }
+        return true;
+    }
+
+    // 以SITE MRETR方式处理任务：每批文件共用一个数据连接
+    void run_stream(const std::function<bool(TransferJob&)>& next_job, BatchStats& stats) {
+        while (true) {
+            std::vector<TransferJob> batch;
+            TransferJob job;
+            while (batch.size() < MRETR_BATCH && next_job(job)) batch.push_back(job);
+            if (batch.empty()) return;
+
+            std::string cmd = "PASV\r\nSITE MRETR", reply;
+            for (auto& j : batch) cmd += " " + j.remote;
+            if (!send_line(cmd) || !read_reply(reply)) {
+                stats.files_failed += batch.size();
+                return;
+            }
+            int sock = connect_pasv(reply);
+            if (!read_reply(reply) || sock < 0 || reply.compare(0, 3, "150") != 0) {
+                if (sock >= 0) close(sock);
+                std::cerr << "传输失败 " << reply << std::endl;
+                stats.files_failed += batch.size();
+                if (!alive()) return;
+                continue;
+            }
+
+            uint64_t done = stats.files_ok + stats.files_failed;
+            bool ok = unpack_stream(sock, batch, stats);
+            close(sock);
+            if (!read_reply(reply) || !ok) {
+                // 流中断：本批未完成的文件计为失败
+                uint64_t handled = stats.files_ok + stats.files_failed - done;
+                stats.files_failed += batch.size() - std::min<uint64_t>(handled, batch.size());
+                std::cerr << "传输失败 " << last_error << std::endl;
+                if (!alive()) return;
+            }
+        }
+    }
+
+    // 处理任务队列直到取空，流水线深度为1
+    void run(const std::function<bool(TransferJob&)>& next_job, BatchStats& stats) {
+        TransferJob cur, nxt;
+        bool has_cur = next_job(cur);
+        if (has_cur && !issue(cur)) has_cur = false;
+
+        while (has_cur) {
+            std::string reply;
+            if (cur.upload && cur.size) {
+                if (!read_reply(reply)) break;
+                if (reply.compare(0, 3, "452") == 0) std::cerr << cur.remote << ": " << reply << std::endl;
+            }
+            if (!read_reply(reply)) break;
+            int sock = connect_pasv(reply);
+            if (!read_reply(reply)) {
+                if (sock >= 0) close(sock);
+                break;
+            }
+
+            // 收到150后立即发出下一个文件的命令，与本次数据传输重叠
+            bool has_nxt = next_job(nxt);
+            if (has_nxt && !issue(nxt)) {
+                stats.files_failed++;
+                has_nxt = false;
+            }
+
+            bool ok = false;
+            if (sock >= 0 && reply.compare(0, 3, "150") == 0) {
+                int64_t n = move_data(cur, sock);
+                close(sock);
+                sock = -1;
+                if (read_reply(reply) && reply.compare(0, 3, "226") == 0 && n >= 0) {
+                    stats.bytes += n;
+                    ok = true;
+                } else {
+                    last_error = cur.remote + ": " + reply;
+                }
+            } else {
+                last_error = cur.remote + ": " + reply;
+            }
+            if (sock >= 0) close(sock);
+
+            if (ok) stats.files_ok++;
+            else {
+                stats.files_failed++;
+                std::cerr << "传输失败 " << last_error << std::endl;
+            }
+            cur = nxt;
+            has_cur = has_nxt;
+        }
+        // 连接中断时余下的已发出任务计为失败
+        if (has_cur) stats.files_failed++;
+    }
+};
 
 class FTPClient {
 private:
     int ctrl_sock = -1;
     int data_sock = -1;
     bool pasv_mode = false;
+    bool mode_z = false;    // MODE Z：数据连接上传输zlib压缩流
+    bool sparse = false;    // OPTS SPARSE：只传输数据区段，保留空洞
+    bool local = false;     // 经Unix域socket连接同机服务器，RETR/STOR直接传递文件描述符
     std::string last_error;
+    std::string server_ip;  // 服务器地址（批量传输时建立额外连接）
+    std::vector<std::unique_ptr<BatchSession>> batch_pool; // 可复用的批量传输连接
+    std::string server_features; // FEAT回复，首次批量传输时获取
 
     // 设置socket非阻塞模式
     bool set_nonblock(int sock, bool nonblock) {
@@ -124,6 +587,652 @@ private:
         return true;
     }
 
+    // 取得第i个批量传输连接，不存在或已断开时重新建立
+    BatchSession* batch_session(size_t i) {
+        if (batch_pool.size() <= i) batch_pool.resize(i + 1);
+        if (!batch_pool[i] || !batch_pool[i]->alive()) {
+            batch_pool[i].reset(new BatchSession());
+            if (!batch_pool[i]->open(server_ip)) {
+                last_error = batch_pool[i]->last_error;
+                batch_pool[i].reset();
+                return nullptr;
+            }
+        }
+        return batch_pool[i].get();
+    }
+
+    // 递归创建本地目录
+    static void make_local_dirs(const std::string& path) {
+        for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1))
+            mkdir(path.substr(0, pos).c_str(), 0777);
+        mkdir(path.c_str(), 0777);
+    }
+
+    static std::string join_path(const std::string& dir, const std::string& name) {
+        if (dir.empty() || dir == ".") return name;
+        return dir + "/" + name;
+    }
+
+    // 递归收集远程目录下的文件
+    bool collect_remote(BatchSession* meta, const std::string& remote, const std::string& local,
+                        std::vector<TransferJob>& jobs) {
+        std::vector<std::pair<std::string, bool>> entries;
+        if (!meta->mlsd(remote, entries)) {
+            last_error = meta->last_error;
+            return false;
+        }
+        make_local_dirs(local);
+        for (auto& e : entries) {
+            std::string r = join_path(remote, e.first), l = local + "/" + e.first;
+            if (e.second) {
+                if (!collect_remote(meta, r, l, jobs)) return false;
+            } else {
+                jobs.push_back({false, r, l});
+            }
+        }
+        return true;
+    }
+
+    // 递归收集本地目录下的文件，并在服务器上创建对应目录
+    bool collect_local(BatchSession* meta, const std::string& local, const std::string& remote,
+                       std::vector<TransferJob>& jobs) {
+        std::string reply;
+        if (!meta->command("MKD " + remote, reply)) {
+            last_error = meta->last_error;
+            return false;
+        }
+        DIR* dir = opendir(local.c_str());
+        if (!dir) return true;
+        dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            std::string l = local + "/" + entry->d_name, r = remote + "/" + entry->d_name;
+            struct stat st;
+            if (stat(l.c_str(), &st) < 0) continue;
+            if (S_ISDIR(st.st_mode)) {
+                if (!collect_local(meta, l, r, jobs)) {
+                    closedir(dir);
+                    return false;
+                }
+            } else if (S_ISREG(st.st_mode)) {
+                jobs.push_back({true, r, l, static_cast<uint64_t>(st.st_size)});
+            }
+        }
+        closedir(dir);
+        return true;
+    }
+
+    // 服务器是否支持某个扩展（FEAT）
+    bool has_feature(BatchSession* meta, const std::string& feature) {
+        if (server_features.empty() && !meta->command("FEAT", server_features))
+            return false;
+        std::istringstream iss(server_features);
+        std::string line;
+        while (std::getline(iss, line)) {
+            if (line.size() > 1 && line[0] == ' ' && line.compare(1, feature.size(), feature) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    // 用workers个连接并行执行任务列表，并输出总吞吐量
+    // streamed为真时下载任务按批使用SITE MRETR共用数据连接
+    bool run_batch(std::vector<TransferJob>& jobs, size_t workers, bool streamed = false) {
+        if (jobs.empty()) {
+            std::cout << "没有匹配的文件" << std::endl;
+            return true;
+        }
+        workers = std::max<size_t>(1, std::min(workers, jobs.size()));
+
+        std::vector<BatchSession*> sessions;
+        for (size_t i = 0; i < workers; i++) {
+            BatchSession* session = batch_session(i);
+            if (!session) break;
+            sessions.push_back(session);
+        }
+        if (sessions.empty()) return false;
+
+        BatchStats stats;
+        std::mutex queue_mutex;
+        size_t next = 0;
+        auto next_job = [&](TransferJob& job) {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (next >= jobs.size()) return false;
+            job = jobs[next++];
+            return true;
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (BatchSession* session : sessions)
+            threads.emplace_back([&, session] {
+                if (streamed) session->run_stream(next_job, stats);
+                else session->run(next_job, stats);
+            });
+        for (auto& t : threads) t.join();
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // 断开的连接在下次使用时重建
+        for (auto& session : batch_pool)
+            if (session && !session->alive()) session.reset();
+
+        std::cout << "传输完成: " << stats.files_ok << " 个文件成功, "
+                  << stats.files_failed << " 个失败, " << stats.bytes << " bytes, "
+                  << sessions.size() << " 个连接, 用时 " << secs << " s, "
+                  << (secs > 0 ? stats.bytes / secs / (1024 * 1024) : 0) << " MB/s, "
+                  << (secs > 0 ? stats.files_ok / secs : 0) << " files/s" << std::endl;
+        return stats.files_failed == 0;
+    }
+
+    // 解析mget/mput参数：[-r] [-j N] <pattern>...
+    static bool parse_batch_args(std::istringstream& iss, bool& recursive, size_t& workers,
+                                 std::vector<std::string>& patterns) {
+        std::string arg;
+        while (iss >> arg) {
+            if (arg == "-r") recursive = true;
+            else if (arg == "-j") {
+                if (!(iss >> workers) || workers == 0) return false;
+            }
+            else patterns.push_back(arg);
+        }
+        return !patterns.empty();
+    }
+
+    // mget [-r] [-j N] <远程文件或通配符>...
+    bool mget(std::istringstream& iss) {
+        bool recursive = false;
+        size_t workers = BATCH_WORKERS;
+        std::vector<std::string> patterns;
+        if (!parse_batch_args(iss, recursive, workers, patterns))
+            throw std::runtime_error("用法: mget [-r] [-j N] <远程文件或通配符>...");
+
+        BatchSession* meta = batch_session(0);
+        if (!meta) return false;
+
+        std::vector<TransferJob> jobs;
+        for (auto& pattern : patterns) {
+            size_t slash = pattern.rfind('/');
+            std::string dir = slash == std::string::npos ? "." : pattern.substr(0, slash);
+            std::string base = slash == std::string::npos ? pattern : pattern.substr(slash + 1);
+
+            std::vector<std::pair<std::string, bool>> entries;
+            if (!meta->mlsd(dir, entries)) {
+                last_error = meta->last_error;
+                return false;
+            }
+            for (auto& e : entries) {
+                if (fnmatch(base.c_str(), e.first.c_str(), 0) != 0) continue;
+                if (!e.second) jobs.push_back({false, join_path(dir, e.first), e.first});
+                else if (recursive && !collect_remote(meta, join_path(dir, e.first), e.first, jobs))
+                    return false;
+            }
+        }
+        return run_batch(jobs, workers, has_feature(meta, "MRETR"));
+    }
+
+    // mput [-r] [-j N] <本地文件或通配符>...
+    bool mput(std::istringstream& iss) {
+        bool recursive = false;
+        size_t workers = BATCH_WORKERS;
+        std::vector<std::string> patterns;
+        if (!parse_batch_args(iss, recursive, workers, patterns))
+            throw std::runtime_error("用法: mput [-r] [-j N] <本地文件或通配符>...");
+
+        BatchSession* meta = batch_session(0);
+        if (!meta) return false;
+
+        std::vector<TransferJob> jobs;
+        for (auto& pattern : patterns) {
+            glob_t g{};
+            if (glob(pattern.c_str(), 0, nullptr, &g) != 0) {
+                globfree(&g);
+                continue;
+            }
+            for (size_t i = 0; i < g.gl_pathc; i++) {
+                std::string path = g.gl_pathv[i];
+                std::string name = path.substr(path.rfind('/') == std::string::npos ? 0 : path.rfind('/') + 1);
+                struct stat st;
+                if (stat(path.c_str(), &st) < 0) continue;
+                if (S_ISREG(st.st_mode)) jobs.push_back({true, name, path, static_cast<uint64_t>(st.st_size)});
+                else if (S_ISDIR(st.st_mode) && recursive && !collect_local(meta, path, name, jobs)) {
+                    globfree(&g);
+                    return false;
+                }
+            }
+            globfree(&g);
+        }
+        return run_batch(jobs, workers);
+    }
+
+    // 递归列出本地目录下的普通文件（相对root的路径）
+    static void list_local(const std::string& root, const std::string& rel, std::vector<std::string>& out) {
+        std::string path = rel.empty() ? root : root + "/" + rel;
+        DIR* dir = opendir(path.c_str());
+        if (!dir) return;
+        dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            std::string r = rel.empty() ? entry->d_name : rel + "/" + entry->d_name;
+            struct stat st;
+            if (lstat((root + "/" + r).c_str(), &st) < 0) continue;
+            if (S_ISDIR(st.st_mode)) list_local(root, r, out);
+            else if (S_ISREG(st.st_mode)) out.push_back(r);
+        }
+        closedir(dir);
+    }
+
+    // 不以/开头、不含..分量的相对路径
+    static bool safe_relative(const std::string& path) {
+        if (path.empty() || path[0] == '/') return false;
+        std::istringstream iss(path);
+        std::string part;
+        while (std::getline(iss, part, '/'))
+            if (part == "..") return false;
+        return true;
+    }
+
+    static void set_mtime(const std::string& path, int64_t mtime) {
+        struct timespec times[2] = {{0, UTIME_OMIT}, {static_cast<time_t>(mtime), 0}};
+        utimensat(AT_FDCWD, path.c_str(), times, 0);
+    }
+
+    // mirror [-j N] <远程目录> <本地目录>：按服务器的文件清单把远程目录同步到本地。
+    // 上次同步到的清单代号记在本地目录的.ftp-mirror中，之后只取变化的部分；
+    // 大小和修改时间都相同的文件跳过，只有时间不同时比较SHA256，下载按批并行进行。
+    // 远程已删除的文件在本地也删除（全量清单时删除本地多出的所有文件）
+    bool mirror(std::istringstream& iss) {
+        size_t workers = BATCH_WORKERS;
+        std::vector<std::string> args;
+        std::string arg;
+        while (iss >> arg) {
+            if (arg != "-j") args.push_back(arg);
+            else if (!(iss >> workers) || workers == 0) args.clear();
+        }
+        if (args.size() != 2) throw std::runtime_error("用法: mirror [-j N] <远程目录> <本地目录>");
+        std::string remote = args[0], local = args[1];
+        while (local.size() > 1 && local.back() == '/') local.pop_back();
+
+        BatchSession* meta = batch_session(0);
+        if (!meta) return false;
+        if (!has_feature(meta, "SITE MANIFEST")) throw std::runtime_error("服务器不支持SITE MANIFEST");
+
+        // 状态文件："<代号> <远程目录>"，远程目录不同时重新全量同步
+        std::string state_path = local + "/.ftp-mirror";
+        uint64_t since = 0;
+        {
+            std::ifstream in(state_path);
+            std::string dir;
+            if (in >> since) {
+                in >> std::ws;
+                std::getline(in, dir);
+                if (dir != remote) since = 0;
+            }
+        }
+
+        std::string data;
+        if (!meta->manifest(since, remote, data)) {
+            last_error = meta->last_error;
+            return false;
+        }
+        std::istringstream lines(data);
+        std::string line, kind;
+        unsigned long long generation = 0;
+        if (!std::getline(lines, line) || sscanf(line.c_str(), "MANIFEST %llu", &generation) != 1)
+            throw std::runtime_error("无效的清单");
+        bool full = line.find(" FULL") != std::string::npos;
+
+        make_local_dirs(local);
+        std::vector<TransferJob> jobs;
+        std::vector<int64_t> mtimes;         // 与jobs对应的远程修改时间
+        std::map<std::string, bool> listed;  // 全量清单中出现的文件
+        uint64_t skipped = 0, deleted = 0;
+        bool complete = false;
+        while (std::getline(lines, line)) {
+            std::istringstream ls(line);
+            ls >> kind;
+            if (kind == "END") {
+                complete = true;
+                break;
+            }
+            uint64_t gen, size = 0;
+            long long mtime = 0;
+            std::string hash, name;
+            if (kind == "F") ls >> gen >> size >> mtime >> hash;
+            else if (kind == "D") ls >> gen;
+            else continue;
+            ls >> std::ws;
+            std::getline(ls, name);
+            if (!safe_relative(name)) continue; // 清单中的路径来自服务器，不允许越出本地目录
+            std::string path = local + "/" + name;
+            struct stat st;
+            bool exists = lstat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+            if (kind == "D") {
+                if (exists && unlink(path.c_str()) == 0) deleted++;
+                continue;
+            }
+            listed[name] = true;
+            if (exists && static_cast<uint64_t>(st.st_size) == size) {
+                if (st.st_mtime == mtime) {
+                    skipped++;
+                    continue;
+                }
+                if (hash != "-") {
+                    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                    std::string local_hash = fd >= 0 ? hash_fd(fd, HashAlgo::SHA256, 0, size, 1) : "";
+                    if (fd >= 0) close(fd);
+                    if (local_hash == hash) {
+                        set_mtime(path, mtime);
+                        skipped++;
+                        continue;
+                    }
+                }
+            }
+            size_t slash = path.rfind('/');
+            make_local_dirs(path.substr(0, slash));
+            jobs.push_back({false, join_path(remote, name), path, size});
+            mtimes.push_back(mtime);
+        }
+        if (!complete) throw std::runtime_error("清单不完整");
+
+        if (full) {
+            std::vector<std::string> existing;
+            list_local(local, "", existing);
+            for (auto& name : existing)
+                if (name != ".ftp-mirror" && !listed.count(name) && unlink((local + "/" + name).c_str()) == 0)
+                    deleted++;
+        }
+
+        std::cout << "清单" << (full ? "(全量)" : "(增量)") << ": " << jobs.size() << " 个文件需要下载, "
+                  << skipped << " 个未变, " << deleted << " 个已删除" << std::endl;
+        bool ok = jobs.empty() || run_batch(jobs, workers, has_feature(meta, "MRETR"));
+        // 下载完整的文件改成服务器上的修改时间，下次据此跳过
+        for (size_t i = 0; i < jobs.size(); i++) {
+            struct stat st;
+            if (stat(jobs[i].local.c_str(), &st) == 0 && static_cast<uint64_t>(st.st_size) == jobs[i].size)
+                set_mtime(jobs[i].local, mtimes[i]);
+            else
+                ok = false;
+        }
+        // 有文件失败时不推进代号，下次重新比较这些变化
+        if (ok) {
+            std::ofstream out(state_path, std::ios::trunc);
+            out << generation << " " << remote << "\n";
+        }
+        return ok;
+    }
+
+    // 读取控制连接上的回复，跳过1xx，返回最终回复那一行
+    bool wait_final_reply(std::string& response) {
+        std::string buf;
+        while (true) {
+            size_t pos = 0, nl;
+            while ((nl = buf.find("\r\n", pos)) != std::string::npos) {
+                if (nl > pos && buf[pos] >= '2' && buf[pos] <= '5') {
+                    response = buf.substr(pos, nl - pos);
+                    return true;
+                }
+                pos = nl + 2;
+            }
+            char buffer[DATA_BUFFER_SIZE];
+            ssize_t bytes = recv(ctrl_sock, buffer, sizeof(buffer), 0);
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes <= 0) {
+                last_error = "接收失败: " + std::string(strerror(errno));
+                return false;
+            }
+            buf.append(buffer, bytes);
+        }
+    }
+
+    // 读取一条回复；用于需要先确认服务器接受了命令（150）再使用数据连接的场合
+    bool recv_reply_line(std::string& reply) {
+        reply.clear();
+        while (reply.size() < 2 || reply.compare(reply.size() - 2, 2, "\r\n") != 0) {
+            char c;
+            ssize_t n = recv(ctrl_sock, &c, 1, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            reply += c;
+        }
+        reply.resize(reply.size() - 2);
+        return true;
+    }
+
+    // 稀疏下载：按段头把数据写到本地文件的对应偏移，空洞不写入
+    bool retr_sparse(const std::string& filename) {
+        int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw std::runtime_error("无法创建文件: " + std::string(strerror(errno)));
+        std::string full_cmd = "RETR " + filename + "\r\n";
+        send(ctrl_sock, full_cmd.c_str(), full_cmd.size(), 0);
+
+        SparseReceiver rx;
+        uint64_t stored = 0;
+        auto write_at = [&](uint64_t offset, const char* data, size_t len) {
+            for (size_t done = 0; done < len; ) {
+                ssize_t n = pwrite(fd, data + done, len - done, offset + done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                done += n;
+            }
+            stored += len;
+            return true;
+        };
+        char buffer[DATA_BUFFER_SIZE];
+        bool ok = true;
+        while (ok) {
+            ssize_t bytes = recv(data_sock, buffer, sizeof(buffer), 0);
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes <= 0) break;
+            ok = rx.feed(buffer, bytes, write_at);
+        }
+        if (ok && rx.done() && ftruncate(fd, rx.size()) < 0) ok = false;
+        close(fd);
+
+        std::string confirm;
+        wait_final_reply(confirm);
+        close_data_conn();
+        if (!ok || !rx.done()) throw std::runtime_error("稀疏数据流不完整: " + confirm);
+        std::cout << "下载完成: " << confirm << " (" << rx.size() << " bytes, "
+                  << stored << " bytes data)" << std::endl;
+        return true;
+    }
+
+    // 稀疏上传：用SEEK_DATA/SEEK_HOLE只发送本地文件的数据区段
+    bool stor_sparse(const std::string& filename) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            if (fd >= 0) close(fd);
+            throw std::runtime_error("文件不存在");
+        }
+        std::string full_cmd = "STOR " + filename + "\r\n";
+        send(ctrl_sock, full_cmd.c_str(), full_cmd.size(), 0);
+
+        auto send_data = [&](const char* data, size_t len) {
+            for (size_t off = 0; off < len; ) {
+                ssize_t sent = send(data_sock, data + off, len - off, MSG_NOSIGNAL);
+                if (sent <= 0) return false;
+                off += sent;
+            }
+            return true;
+        };
+        uint64_t stored = 0;
+        char buffer[64 * 1024];
+        bool ok = sparse_segments(fd, st.st_size, [&](uint64_t offset, uint64_t len) {
+            std::string header = sparse_data_header(offset, len);
+            if (!send_data(header.data(), header.size())) return false;
+            for (uint64_t end = offset + len; offset < end; ) {
+                ssize_t n = pread(fd, buffer, std::min<uint64_t>(sizeof(buffer), end - offset), offset);
+                if (n <= 0 || !send_data(buffer, n)) return false;
+                offset += n;
+                stored += n;
+            }
+            return true;
+        });
+        std::string end = sparse_end(st.st_size);
+        ok = ok && send_data(end.data(), end.size());
+        close(fd);
+        shutdown(data_sock, SHUT_WR);
+
+        std::string confirm;
+        wait_final_reply(confirm);
+        close_data_conn();
+        if (!ok) throw std::runtime_error("发送失败");
+        std::cout << "上传完成: " << confirm << " (" << st.st_size << " bytes, "
+                  << stored << " bytes data)" << std::endl;
+        return true;
+    }
+
+    // 增量上传：收下服务器现有版本的块签名，只发送本地文件中变化的部分
+    bool stor_delta(const std::string& filename) {
+        int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            if (fd >= 0) close(fd);
+            throw std::runtime_error("文件不存在");
+        }
+        std::string full_cmd = "SITE DSTOR " + filename + "\r\n";
+        send(ctrl_sock, full_cmd.c_str(), full_cmd.size(), 0);
+        std::string reply;
+        if (!recv_reply_line(reply) || reply[0] != '1') {
+            close(fd);
+            close_data_conn();
+            throw std::runtime_error("增量上传失败: " + reply);
+        }
+
+        DeltaSignature sig;
+        char buffer[DATA_BUFFER_SIZE];
+        bool ok = true;
+        while (ok && !sig.complete()) {
+            ssize_t bytes = recv(data_sock, buffer, sizeof(buffer), 0);
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes <= 0) break;
+            ok = sig.feed(buffer, bytes);
+        }
+        DeltaEncoder encoder(sig);
+        ok = ok && sig.complete() && encoder.encode(fd, st.st_size, [&](const char* data, size_t len) {
+            for (size_t off = 0; off < len; ) {
+                ssize_t sent = send(data_sock, data + off, len - off, MSG_NOSIGNAL);
+                if (sent <= 0) return false;
+                off += sent;
+            }
+            return true;
+        });
+        close(fd);
+        shutdown(data_sock, SHUT_WR);
+
+        std::string confirm;
+        wait_final_reply(confirm);
+        close_data_conn();
+        if (!ok) throw std::runtime_error("增量上传失败: " + confirm);
+        std::cout << "上传完成: " << confirm << " (" << encoder.stats().literal << " of "
+                  << st.st_size << " bytes sent)" << std::endl;
+        return true;
+    }
+
+    // 增量下载：发送本地旧版本的块签名，按服务器回送的增量流在临时文件中重建后替换本地文件
+    bool retr_delta(const std::string& filename) {
+        int old_fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        if (old_fd >= 0 && fstat(old_fd, &st) < 0) st.st_size = 0;
+        uint64_t old_size = old_fd >= 0 ? st.st_size : 0;
+        std::string tmp = filename + ".delta";
+        int out = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) {
+            if (old_fd >= 0) close(old_fd);
+            throw std::runtime_error("无法创建文件: " + std::string(strerror(errno)));
+        }
+        std::string full_cmd = "SITE DRETR " + filename + "\r\n";
+        send(ctrl_sock, full_cmd.c_str(), full_cmd.size(), 0);
+        std::string reply;
+        if (!recv_reply_line(reply) || reply[0] != '1') {
+            close(out);
+            unlink(tmp.c_str());
+            if (old_fd >= 0) close(old_fd);
+            close_data_conn();
+            throw std::runtime_error("增量下载失败: " + reply);
+        }
+
+        uint32_t block = delta_block_size(old_size);
+        bool ok = DeltaSignature::build(old_fd, old_size, block, [&](const char* data, size_t len) {
+            for (size_t off = 0; off < len; ) {
+                ssize_t sent = send(data_sock, data + off, len - off, MSG_NOSIGNAL);
+                if (sent <= 0) return false;
+                off += sent;
+            }
+            return true;
+        });
+        shutdown(data_sock, SHUT_WR);
+        DeltaApplier applier(old_fd, old_size, block, out);
+        char buffer[DATA_BUFFER_SIZE];
+        while (ok && !applier.done()) {
+            ssize_t bytes = recv(data_sock, buffer, sizeof(buffer), 0);
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes <= 0) break;
+            ok = applier.feed(buffer, bytes);
+        }
+        ok = ok && applier.done();
+        if (close(out) < 0) ok = false;
+        if (old_fd >= 0) close(old_fd);
+        if (ok && rename(tmp.c_str(), filename.c_str()) < 0) ok = false;
+        if (!ok) unlink(tmp.c_str());
+
+        std::string confirm;
+        wait_final_reply(confirm);
+        close_data_conn();
+        if (!ok) throw std::runtime_error("增量下载失败: " + confirm);
+        std::cout << "下载完成: " << confirm << " (" << applier.stats().received << " of "
+                  << applier.size() << " bytes received)" << std::endl;
+        return true;
+    }
+
+    // 同机下载：服务器随150回复传来文件描述符，由内核直接复制到本地文件
+    bool retr_local(const std::string& filename) {
+        std::string full_cmd = "RETR " + filename + "\r\n";
+        if (send(ctrl_sock, full_cmd.c_str(), full_cmd.size(), MSG_NOSIGNAL) < 0)
+            throw std::runtime_error("发送命令失败");
+        int src = -1;
+        char buffer[DATA_BUFFER_SIZE];
+        ssize_t bytes;
+        while ((bytes = recv_with_fd(ctrl_sock, buffer, sizeof(buffer), src)) < 0 && errno == EINTR) {}
+        std::string reply = bytes > 0 ? std::string(buffer, bytes) : "";
+        if (src < 0) throw std::runtime_error("下载失败: " + reply.substr(0, reply.find("\r\n")));
+
+        struct stat st{};
+        int dst = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        const char* method = nullptr;
+        if (dst >= 0 && fstat(src, &st) == 0) method = copy_file_data(src, dst, st.st_size);
+        std::string error = strerror(errno);
+        close(src);
+        if (dst >= 0 && close(dst) < 0) method = nullptr;
+
+        // 226可能和150一起收到
+        std::string confirm;
+        size_t pos = reply.find("\r\n");
+        if (pos != std::string::npos && pos + 2 < reply.size())
+            confirm = reply.substr(pos + 2, reply.find("\r\n", pos + 2) - pos - 2);
+        if (confirm.empty()) wait_final_reply(confirm);
+        if (!method) throw std::runtime_error("本地文件写入错误: " + error);
+        std::cout << "下载完成: " << confirm << " (" << st.st_size << " bytes, " << method << ")" << std::endl;
+        return true;
+    }
+
+    // 同机上传：源文件描述符随STOR命令发给服务器，由服务器直接复制
+    bool stor_local(const std::string& filename) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("文件不存在");
+        std::string full_cmd = "STOR " + filename + "\r\n";
+        bool sent = send_with_fd(ctrl_sock, full_cmd.data(), full_cmd.size(), fd);
+        close(fd);
+        if (!sent) throw std::runtime_error("发送命令失败");
+
+        std::string confirm;
+        if (!wait_final_reply(confirm)) return false;
+        if (confirm[0] != '2') throw std::runtime_error("上传失败: " + confirm);
+        std::cout << "上传完成: " << confirm << std::endl;
+        return true;
+    }
+
     void close_data_conn() {
         if (data_sock != -1) {
             close(data_sock);
@@ -136,6 +1245,7 @@ public:
     const std::string& get_last_error() const { return last_error; }
     bool connect(const std::string& server_ip = "127.0.0.1")
     {
+        this->server_ip = server_ip;
         ctrl_sock = socket(AF_INET, SOCK_STREAM, 0);
         if(ctrl_sock==-1)
         {
@@ -162,6 +1272,23 @@ public:
         printf("recv buf:%s\n",buf);
         return true;
     }
+
+    // 通过Unix域socket连接同机服务器
+    bool connect_local(const std::string& path = LOCAL_SOCKET_PATH) {
+        ctrl_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        if (ctrl_sock < 0 || ::connect(ctrl_sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            last_error = path + ": " + strerror(errno);
+            return false;
+        }
+        local = true;
+        std::string welcome;
+        if (!wait_final_reply(welcome)) return false;
+        std::cout << "服务器响应: " << welcome << std::endl;
+        return true;
+    }
     bool execute_command(const std::string& raw_cmd) {
         last_error.clear();
         std::istringstream iss(raw_cmd);
@@ -170,6 +1297,18 @@ public:
         std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
 
         try {
+            if (cmd == "MGET") return mget(iss);
+            if (cmd == "MPUT") return mput(iss);
+            if (cmd == "MIRROR") return mirror(iss);
+
+            if (cmd == "DSTOR" || cmd == "DRETR") {
+                std::string filename;
+                iss >> filename;
+                if (filename.empty()) throw std::runtime_error("需要文件名参数");
+                if (!pasv_mode) throw std::runtime_error("请先使用PASV模式");
+                return cmd == "DSTOR" ? stor_delta(filename) : retr_delta(filename);
+            }
+
             if (cmd == "PASV") {
                 std::string response;
                 // if (send_command("PASV", response) &&parse_pasv(response)) {
@@ -227,15 +1366,17 @@ public:
             }
 
             if (cmd == "RETR") {
-                if (!pasv_mode) throw std::runtime_error("请先使用PASV模式");
-                
                 std::string filename;
                 iss >> filename;
                 if (filename.empty()) throw std::runtime_error("需要文件名参数");
+                if (local && !pasv_mode) return retr_local(filename);
+                if (!pasv_mode) throw std::runtime_error("请先使用PASV模式");
 
                 std::string response;
                 //if (!send_command("RETR " + filename, response)) return false;
 
+                if (sparse) return retr_sparse(filename);
+
                 std::ofstream file(filename, std::ios::binary);
                 //if (!file) throw std::runtime_error("无法创建文件");
                 std::string full_cmd = cmd + " "+filename+"\r\n";
@@ -243,12 +1384,17 @@ public:
 
                 char buffer[DATA_BUFFER_SIZE];
                 ssize_t total = 0;
+                ZStream zs(mode_z ? ZStream::Inflate : ZStream::None);
                 while (true) {
                     ssize_t bytes = recv(data_sock, buffer, sizeof(buffer), 0);
                     if (bytes < 0) throw std::runtime_error("接收失败");
                     if (bytes == 0) break;
                     
-                    file.write(buffer, bytes);
+                    if (!zs.process(buffer, bytes, false, [&](const char* data, size_t len) {
+                            file.write(data, len);
+                            return true;
+                        }))
+                        throw std::runtime_error("解压失败");
                     total += bytes;
                 }
         //         char buffer[DATA_BUFFER_SIZE];
@@ -280,19 +1426,39 @@ public:
                 return true;
             }
 
-            if (cmd == "STOR") {
-                if (!pasv_mode) throw std::runtime_error("请先使用PASV模式");
-                
+            if (cmd == "STOR" || cmd == "RESUME") {
                 std::string filename;
                 iss >> filename;
                 if (filename.empty()) throw std::runtime_error("需要文件名参数");
+                bool resume = cmd == "RESUME";
+                if (resume && sparse) throw std::runtime_error("稀疏模式不支持续传");
+                if (local && !pasv_mode && !resume) return stor_local(filename);
+                if (!pasv_mode) throw std::runtime_error("请先使用PASV模式");
 
-                std::ifstream file(filename, std::ios::binary);
+                std::ifstream file(filename, std::ios::binary | std::ios::ate);
                 if (!file) throw std::runtime_error("文件不存在");
 
+                // 先用ALLO告知文件大小，服务器空间不足时直接放弃
                 std::string response;
+                uint64_t file_size = file.tellg();
+                file.seekg(0);
+                if (file_size > 0 && send_command("ALLO " + std::to_string(file_size), response) &&
+                    response.compare(0, 3, "452") == 0)
+                    throw std::runtime_error("服务器空间不足: " + response);
+                // RESUME：查询服务器上次中断的上传已保存到哪里，用REST从该偏移接着发送
+                if (resume) {
+                    if (!send_command("SITE RESUME " + filename, response) || response.compare(0, 3, "213") != 0)
+                        throw std::runtime_error("无法续传: " + response);
+                    uint64_t offset = strtoull(response.c_str() + 4, nullptr, 10);
+                    if (offset > file_size) throw std::runtime_error("本地文件比服务器上已传的部分还短");
+                    if (!send_command("REST " + std::to_string(offset), response) || response.compare(0, 3, "350") != 0)
+                        throw std::runtime_error("无法续传: " + response);
+                    file.seekg(offset);
+                    std::cout << "从 " << offset << " 字节处续传" << std::endl;
+                }
+                if (sparse) return stor_sparse(filename);
                 //if (!send_command("STOR " + filename, response)) return false;
-                std::string full_cmd = cmd + " "+filename+"\r\n";
+                std::string full_cmd = "STOR "+filename+"\r\n";
                 ssize_t sent = send(ctrl_sock, full_cmd.c_str(), full_cmd.size(), 0);
 
         //         char buffer[DATA_BUFFER_SIZE];
@@ -336,26 +1502,32 @@ public:
     // }
     char buffer[DATA_BUFFER_SIZE];
     ssize_t total = 0;
+    ZStream zs(mode_z ? ZStream::Deflate : ZStream::None);
+    auto send_data = [&](const char* data, size_t len) {
+        size_t total_sent = 0;
+        while (total_sent < len) {
+            ssize_t sent = send(data_sock, 
+                              data + total_sent, 
+                              len - total_sent, 
+                              MSG_NOSIGNAL);
+            if (sent <= 0) {
+                throw std::runtime_error("发送失败");
+            }
+            total_sent += sent;
+        }
+        total += total_sent;
+        return true;
+    };
     
     while (file) {
         file.read(buffer, sizeof(buffer));
         std::streamsize bytes_read = file.gcount();
         
-        if (bytes_read > 0) {
-            ssize_t total_sent = 0;
-            while (total_sent < bytes_read) {
-                ssize_t sent = send(data_sock, 
-                                  buffer + total_sent, 
-                                  bytes_read - total_sent, 
-                                  MSG_NOSIGNAL);
-                if (sent <= 0) {
-                    throw std::runtime_error("发送失败");
-                }
-                total_sent += sent;
-            }
-            total += total_sent;
+        if (bytes_read > 0 || !file) {
+            zs.process(buffer, bytes_read, !file, send_data);
         }
     }
+    shutdown(data_sock, SHUT_WR);
                     // ssize_t sent = send(data_sock, buffer, file.gcount(), 0);
                     // if (sent < 0) throw std::runtime_error("发送失败");
                     // total += sent;
@@ -372,6 +1544,18 @@ public:
            std::string response;
             if (!send_command(raw_cmd, response)) return false;
             std::cout << "服务器响应: " << response << std::endl;
+            if (cmd == "MODE" && response.compare(0, 3, "200") == 0) {
+                std::string mode;
+                iss >> mode;
+                mode_z = mode == "Z" || mode == "z";
+            }
+            if (cmd == "OPTS" && response.compare(0, 3, "200") == 0) {
+                std::string opt, value;
+                iss >> opt >> value;
+                std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+                std::transform(value.begin(), value.end(), value.begin(), ::toupper);
+                if (opt == "SPARSE") sparse = value == "ON";
+            }
             return true;
 
         } catch (const std::exception& e) {
@@ -392,15 +1576,25 @@ public:
     // }
 };
 
-int main() {
+int main(int argc, char* argv[]) {
     FTPClient client;
-    if (!client.connect()) {
+    // ftp -l [socket]：经Unix域socket连接同机服务器，RETR/STOR不需要PASV
+    bool ok = argc > 1 && strcmp(argv[1], "-l") == 0
+        ? client.connect_local(argc > 2 ? argv[2] : LOCAL_SOCKET_PATH)
+        : client.connect(argc > 1 ? argv[1] : "127.0.0.1");
+    if (!ok) {
         std::cerr << "连接失败: " << client.get_last_error() << std::endl;
         return 1;
     }
 
     std::cout << "已连接到FTP服务器，输入命令开始操作" << std::endl;
     std::cout << "支持命令: PASV, LIST, RETR <file>, STOR <file>, QUIT" << std::endl;
+    std::cout << "批量传输: mget [-r] [-j N] <pattern>..., mput [-r] [-j N] <pattern>..." << std::endl;
+    std::cout << "传输选项: MODE S|Z, OPTS SPARSE ON|OFF（稀疏文件只传数据区段）" << std::endl;
+    std::cout << "断点续传: RESUME <file>（接着服务器上次中断的上传继续发送）" << std::endl;
+    std::cout << "增量传输: DSTOR <file>, DRETR <file>（只传输与对方旧版本不同的部分）" << std::endl;
+    std::cout << "增量同步: mirror [-j N] <远程目录> <本地目录>（按服务器文件清单只下载变化的文件）" << std::endl;
+    std::cout << "同机连接: ftp -l [socket]，RETR/STOR直接传递文件描述符，无需PASV" << std::endl;
 
     std::string command;
     while (true) {
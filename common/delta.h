@@ -0,0 +1,468 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <cerrno>
+#include <unistd.h>
+#include "digest.h"
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+#define DELTA_BLOCK_MIN 2048            // 块大小下限
+#define DELTA_BLOCK_MAX (1024 * 1024)   // 块大小上限
+#define DELTA_MAX_BLOCKS (1 << 20)      // 签名的块数上限（每块20字节，最多20MB）
+#define DELTA_STRONG_LEN 16             // 强校验取SHA-256的前16字节
+#define DELTA_LITERAL_MAX (1024 * 1024) // 连续的未匹配数据攒到这么多就先发出
+#define DELTA_HEADER_MAX 64             // 指令行的最大长度
+
+// rsync式增量传输（SITE DSTOR / SITE DRETR）：
+// 持有旧版本的一方把文件按块计算签名发给对方：
+//   "SIGS <block_size> <count>\n" 后跟count条记录，每条为4字节弱校验（大端）+ 16字节强校验，
+//   只对完整的块签名，末尾不足一块的部分不参与匹配
+// 持有新版本的一方用滚动弱校验在新文件的每个偏移查找相同的块，回送增量流：
+//   "COPY <block> <count>\n"  从旧文件第block块起复制count个块
+//   "DATA <length>\n"         后跟length字节新数据
+//   "END <size>\n"            结束，给出新文件长度
+// 接收方按顺序写新文件，COPY用copy_file_range从旧文件复制，数据不经过用户态
+
+// 根据文件大小选块：约为sqrt(size)，按1KB取整；块数超过上限时加大块
+inline uint32_t delta_block_size(uint64_t size) {
+    uint64_t block = static_cast<uint64_t>(std::sqrt(static_cast<double>(size)));
+    block = (block + 1023) & ~uint64_t(1023);
+    block = std::max<uint64_t>(block, (size + DELTA_MAX_BLOCKS - 1) / DELTA_MAX_BLOCKS);
+    return static_cast<uint32_t>(std::min<uint64_t>(std::max<uint64_t>(block, DELTA_BLOCK_MIN), DELTA_BLOCK_MAX));
+}
+
+// 弱校验（rsync的滚动校验和）：a = Σx[i]，b = Σ(len - i)·x[i]，各取低16位，weak = a | b << 16
+// 窗口右移一个字节只需O(1)更新
+class RollingChecksum {
+private:
+    uint32_t a = 0, b = 0, len = 0;
+
+public:
+    // 整块计算。b = len·Σx[i] - Σi·x[i]；x86-64上每16字节一组用SSE2计算：
+    // psadbw求组内和，pmaddwd乘组内位置权重，组偏移的贡献由各组和的前缀和得到
+    void init(const uint8_t* p, size_t n) {
+        uint64_t s1 = 0, s2 = 0; // Σx[i]，Σi·x[i]
+        size_t i = 0;
+#if defined(__x86_64__)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i w_lo = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+        const __m128i w_hi = _mm_setr_epi16(8, 9, 10, 11, 12, 13, 14, 15);
+        __m128i v_sum = zero;    // 各组字节和（64位两路）
+        __m128i v_prefix = zero; // 每组开始前已有的字节和之累计（64位两路）
+        __m128i v_weight = zero; // 组内Σk·x（32位四路）
+        size_t groups = 0;
+        for (; i + 16 <= n; i += 16, groups++) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            v_prefix = _mm_add_epi64(v_prefix, v_sum);
+            v_sum = _mm_add_epi64(v_sum, _mm_sad_epu8(v, zero));
+            __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+            v_weight = _mm_add_epi32(v_weight, _mm_add_epi32(_mm_madd_epi16(lo, w_lo), _mm_madd_epi16(hi, w_hi)));
+        }
+        if (groups) {
+            uint64_t sum[2], prefix[2];
+            uint32_t weight[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(sum), v_sum);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(prefix), v_prefix);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(weight), v_weight);
+            s1 = sum[0] + sum[1];
+            // Σg·sum[g] = (groups - 1)·Σsum[g] - Σ(groups - 1 - g)·sum[g]，后者即v_prefix
+            s2 = 16 * ((groups - 1) * s1 - (prefix[0] + prefix[1])) +
+                 weight[0] + weight[1] + weight[2] + weight[3];
+        }
+#endif
+        for (; i < n; i++) {
+            s1 += p[i];
+            s2 += static_cast<uint64_t>(i) * p[i];
+        }
+        len = static_cast<uint32_t>(n);
+        a = static_cast<uint32_t>(s1);
+        b = static_cast<uint32_t>(n * s1 - s2);
+    }
+
+    // 窗口右移：移出out，移入in
+    void roll(uint8_t out, uint8_t in) {
+        a += in - out;
+        b += a - len * out;
+    }
+
+    uint32_t value() const { return (a & 0xffff) | (b << 16); }
+};
+
+inline void delta_strong(const uint8_t* p, size_t n, uint8_t out[DELTA_STRONG_LEN]) {
+    digest_detail::Sha256 sha;
+    sha.update(p, n);
+    uint8_t digest[32];
+    sha.final(digest);
+    memcpy(out, digest, DELTA_STRONG_LEN);
+}
+
+// 一个文件的块签名：计算（旧版本一方）或从签名流解析（新版本一方）
+class DeltaSignature {
+public:
+    using Emit = std::function<bool(const char*, size_t)>;
+
+    struct Block {
+        uint32_t weak;
+        uint8_t strong[DELTA_STRONG_LEN];
+    };
+
+private:
+    uint32_t block_ = 0;
+    uint64_t count_ = 0;
+    std::vector<Block> blocks;
+    std::string header;
+    std::string record; // 跨recv边界的半条记录
+    bool have_header = false;
+    bool bad = false;
+
+public:
+    // 读取fd的[0, size)，按block大小输出签名流；读取失败返回false
+    static bool build(int fd, uint64_t size, uint32_t block, const Emit& emit) {
+        uint64_t count = size / block;
+        std::string out = "SIGS " + std::to_string(block) + " " + std::to_string(count) + "\n";
+        size_t per_read = std::max<size_t>(1, (1024 * 1024) / block);
+        std::vector<uint8_t> buf(per_read * block);
+        for (uint64_t i = 0; i < count; ) {
+            size_t want = static_cast<size_t>(std::min<uint64_t>(per_read, count - i)) * block;
+            for (size_t got = 0; got < want; ) {
+                ssize_t n = pread(fd, buf.data() + got, want - got, i * block + got);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false; // 文件在计算签名时被截断
+                got += n;
+            }
+            for (size_t k = 0; k < want; k += block, i++) {
+                RollingChecksum rc;
+                rc.init(buf.data() + k, block);
+                uint32_t weak = rc.value();
+                char rec[4 + DELTA_STRONG_LEN];
+                for (int j = 0; j < 4; j++) rec[j] = static_cast<char>(weak >> (24 - 8 * j));
+                delta_strong(buf.data() + k, block, reinterpret_cast<uint8_t*>(rec + 4));
+                out.append(rec, sizeof(rec));
+            }
+            if (out.size() >= 64 * 1024) {
+                if (!emit(out.data(), out.size())) return false;
+                out.clear();
+            }
+        }
+        return out.empty() || emit(out.data(), out.size());
+    }
+
+    // 输入一段签名流；格式错误时返回false
+    bool feed(const char* data, size_t len) {
+        size_t pos = 0;
+        while (!have_header && pos < len) {
+            const char* nl = static_cast<const char*>(memchr(data + pos, '\n', len - pos));
+            size_t k = nl ? nl - (data + pos) : len - pos;
+            header.append(data + pos, k);
+            pos += k;
+            if (header.size() > DELTA_HEADER_MAX) return !(bad = true);
+            if (!nl) return true;
+            pos++;
+            unsigned block = 0;
+            unsigned long long count = 0;
+            if (sscanf(header.c_str(), "SIGS %u %llu", &block, &count) != 2 ||
+                block < DELTA_BLOCK_MIN || block > DELTA_BLOCK_MAX || count > DELTA_MAX_BLOCKS)
+                return !(bad = true);
+            block_ = block;
+            count_ = count;
+            have_header = true;
+        }
+        const size_t rec_len = 4 + DELTA_STRONG_LEN;
+        while (pos < len) {
+            if (blocks.size() >= count_) return !(bad = true); // 多余的数据
+            size_t k = std::min(rec_len - record.size(), len - pos);
+            record.append(data + pos, k);
+            pos += k;
+            if (record.size() < rec_len) break;
+            Block b;
+            const uint8_t* r = reinterpret_cast<const uint8_t*>(record.data());
+            b.weak = (uint32_t(r[0]) << 24) | (uint32_t(r[1]) << 16) | (uint32_t(r[2]) << 8) | r[3];
+            memcpy(b.strong, r + 4, DELTA_STRONG_LEN);
+            blocks.push_back(b);
+            record.clear();
+        }
+        return true;
+    }
+
+    bool complete() const { return have_header && blocks.size() == count_; }
+    bool corrupt() const { return bad; }
+    uint32_t block_size() const { return block_; }
+    const std::vector<Block>& entries() const { return blocks; }
+};
+
+// 新版本一方：对照签名把新文件编码成增量流
+class DeltaEncoder {
+public:
+    using Emit = std::function<bool(const char*, size_t)>;
+
+    struct Stats {
+        uint64_t matched = 0; // 以COPY表示的字节
+        uint64_t literal = 0; // 以DATA发送的字节
+    };
+
+private:
+    const DeltaSignature& sig;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> index; // 弱校验 -> 块号
+    std::vector<uint8_t> tags; // 弱校验的16位摘要是否出现过，滚动时先查这张表
+    Stats stats_;
+
+    static uint16_t tag(uint32_t weak) { return static_cast<uint16_t>(weak ^ (weak >> 16)); }
+
+    // 在[p, p + block)处查找相同的块，优先上一个匹配块的下一块；找不到返回-1
+    int64_t find(const uint8_t* p, uint32_t weak, int64_t hint) {
+        if (!tags[tag(weak)]) return -1;
+        auto it = index.find(weak);
+        if (it == index.end()) return -1;
+        uint8_t strong[DELTA_STRONG_LEN];
+        delta_strong(p, sig.block_size(), strong);
+        const auto& blocks = sig.entries();
+        if (hint >= 0 && hint < static_cast<int64_t>(blocks.size()) && blocks[hint].weak == weak &&
+            memcmp(blocks[hint].strong, strong, DELTA_STRONG_LEN) == 0)
+            return hint;
+        for (uint32_t i : it->second)
+            if (memcmp(blocks[i].strong, strong, DELTA_STRONG_LEN) == 0) return i;
+        return -1;
+    }
+
+public:
+    explicit DeltaEncoder(const DeltaSignature& s) : sig(s), tags(1 << 16) {
+        const auto& blocks = sig.entries();
+        for (uint32_t i = 0; i < blocks.size(); i++) {
+            index[blocks[i].weak].push_back(i);
+            tags[tag(blocks[i].weak)] = 1;
+        }
+    }
+
+    // 读取fd的[0, size)编码成增量流。文件经滑动窗口pread读入（不用mmap：文件在传输中
+    // 被截断时mmap会触发SIGBUS），窗口只保留尚未发出的新数据和当前块
+    bool encode(int fd, uint64_t size, const Emit& emit) {
+        const uint32_t block = std::max<uint32_t>(sig.block_size(), 1);
+        std::vector<uint8_t> buf(2 * DELTA_LITERAL_MAX + 2 * static_cast<size_t>(block));
+        uint64_t base = 0;  // buf[0]对应的文件偏移
+        size_t filled = 0;  // buf中有效的字节数
+        uint64_t lit_start = 0;            // 尚未发出的新数据起点
+        int64_t copy_start = -1;           // 待发出的COPY：起始块与块数（相邻的匹配合并）
+        uint64_t copy_count = 0;
+        auto at = [&](uint64_t off) { return buf.data() + (off - base); };
+        // 保证[lit_start, end)在窗口内：先丢掉已发出的部分，再尽量多读
+        auto ensure = [&](uint64_t end) {
+            if (end <= base + filled) return true;
+            size_t drop = static_cast<size_t>(lit_start - base);
+            memmove(buf.data(), buf.data() + drop, filled - drop);
+            base = lit_start;
+            filled -= drop;
+            while (base + filled < end) {
+                size_t want = static_cast<size_t>(std::min<uint64_t>(buf.size() - filled, size - base - filled));
+                ssize_t n = pread(fd, buf.data() + filled, want, base + filled);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false; // 文件在传输中被截断
+                filled += n;
+            }
+            return true;
+        };
+        auto flush_copy = [&]() {
+            if (copy_start < 0) return true;
+            std::string h = "COPY " + std::to_string(copy_start) + " " + std::to_string(copy_count) + "\n";
+            copy_start = -1;
+            return emit(h.data(), h.size());
+        };
+        auto flush_literal = [&](uint64_t end) {
+            if (end == lit_start) return true;
+            if (!flush_copy()) return false;
+            std::string h = "DATA " + std::to_string(end - lit_start) + "\n";
+            bool ok = emit(h.data(), h.size()) &&
+                      emit(reinterpret_cast<const char*>(at(lit_start)), end - lit_start);
+            stats_.literal += end - lit_start;
+            lit_start = end;
+            return ok;
+        };
+
+        uint64_t pos = 0;
+        if (!sig.entries().empty()) {
+            RollingChecksum rc;
+            bool fresh = true; // 需要对当前窗口整块重新计算
+            int64_t hint = -1;
+            while (pos + block <= size) {
+                // 滚动时还要读到窗口后的一个字节
+                if (!ensure(std::min<uint64_t>(size, pos + block + 1))) return false;
+                if (fresh) {
+                    rc.init(at(pos), block);
+                    fresh = false;
+                }
+                int64_t hit = find(at(pos), rc.value(), hint);
+                if (hit >= 0) {
+                    if (!flush_literal(pos)) return false;
+                    if (copy_start >= 0 && copy_start + static_cast<int64_t>(copy_count) == hit) {
+                        copy_count++;
+                    } else {
+                        if (!flush_copy()) return false;
+                        copy_start = hit;
+                        copy_count = 1;
+                    }
+                    stats_.matched += block;
+                    pos += block;
+                    lit_start = pos;
+                    hint = hit + 1;
+                    fresh = true;
+                    continue;
+                }
+                if (pos + block < size) rc.roll(*at(pos), *at(pos + block));
+                pos++;
+                if (pos - lit_start >= DELTA_LITERAL_MAX && !flush_literal(pos)) return false;
+            }
+        }
+        // 末尾不足一块的部分（或没有签名时的整个文件）按DELTA_LITERAL_MAX分段发出
+        while (lit_start < size) {
+            uint64_t end = std::min<uint64_t>(size, lit_start + DELTA_LITERAL_MAX);
+            if (!ensure(end) || !flush_literal(end)) return false;
+        }
+        if (!flush_copy()) return false;
+        std::string end = "END " + std::to_string(size) + "\n";
+        return emit(end.data(), end.size());
+    }
+
+    const Stats& stats() const { return stats_; }
+};
+
+// 旧版本一方：按增量流从旧文件old（可为-1，表示没有旧版本）和新数据重建新文件到out
+class DeltaApplier {
+public:
+    struct Stats {
+        uint64_t copied = 0;   // 从旧文件复制的字节
+        uint64_t received = 0; // 收到的新数据字节
+    };
+
+private:
+    int old_fd, out_fd;
+    uint32_t block;
+    uint64_t old_blocks;
+    uint64_t out_off = 0;
+    uint64_t data_left = 0; // 当前DATA还未收到的字节
+    std::string header;
+    uint64_t size_ = 0;
+    bool done_ = false;
+    bool bad = false;
+    bool write_failed = false;
+    int error_ = 0;
+    Stats stats_;
+
+    bool fail_write() {
+        error_ = errno ? errno : EIO;
+        write_failed = true;
+        return false;
+    }
+
+    bool write_data(const char* data, size_t len) {
+        for (size_t done = 0; done < len; ) {
+            ssize_t n = pwrite(out_fd, data + done, len - done, out_off + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return fail_write();
+            done += n;
+        }
+        out_off += len;
+        stats_.received += len;
+        return true;
+    }
+
+    // 复制旧文件的[from, from + len)；文件系统不支持copy_file_range时退回pread/pwrite
+    bool copy_old(uint64_t from, uint64_t len) {
+        loff_t in = from, out = out_off;
+        uint64_t left = len;
+        while (left > 0) {
+            ssize_t n = copy_file_range(old_fd, &in, out_fd, &out, left, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            left -= n;
+        }
+        char buf[64 * 1024];
+        while (left > 0) {
+            ssize_t n = pread(old_fd, buf, std::min<uint64_t>(sizeof(buf), left), in);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                if (n == 0) errno = EIO; // 旧文件在传输期间被截断
+                return fail_write();
+            }
+            for (ssize_t done = 0; done < n; ) {
+                ssize_t m = pwrite(out_fd, buf + done, n - done, out + done);
+                if (m < 0 && errno == EINTR) continue;
+                if (m <= 0) return fail_write();
+                done += m;
+            }
+            in += n;
+            out += n;
+            left -= n;
+        }
+        out_off += len;
+        stats_.copied += len;
+        return true;
+    }
+
+    bool parse(const std::string& line) {
+        char tag[8];
+        unsigned long long a = 0, b = 0;
+        int n = sscanf(line.c_str(), "%7s %llu %llu", tag, &a, &b);
+        if (n == 3 && strcmp(tag, "COPY") == 0) {
+            if (old_fd < 0 || b == 0 || a >= old_blocks || b > old_blocks - a) return false;
+            return copy_old(a * block, b * block);
+        }
+        if (n == 2 && strcmp(tag, "DATA") == 0) {
+            data_left = a;
+            return true;
+        }
+        if (n == 2 && strcmp(tag, "END") == 0) {
+            if (a != out_off) return false;
+            size_ = a;
+            done_ = true;
+            return true;
+        }
+        return false;
+    }
+
+public:
+    // old_size为旧文件长度，block为签名所用的块大小
+    DeltaApplier(int old_fd, uint64_t old_size, uint32_t block, int out_fd)
+        : old_fd(old_fd), out_fd(out_fd), block(block), old_blocks(block ? old_size / block : 0) {}
+
+    // 输入一段增量流；格式错误或写入失败返回false（用corrupt()/error()区分）
+    bool feed(const char* data, size_t len) {
+        size_t pos = 0;
+        while (pos < len && !done_) {
+            if (data_left > 0) {
+                size_t k = static_cast<size_t>(std::min<uint64_t>(data_left, len - pos));
+                if (!write_data(data + pos, k)) return false;
+                data_left -= k;
+                pos += k;
+                continue;
+            }
+            const char* nl = static_cast<const char*>(memchr(data + pos, '\n', len - pos));
+            size_t k = nl ? nl - (data + pos) : len - pos;
+            header.append(data + pos, k);
+            pos += k;
+            if (header.size() > DELTA_HEADER_MAX) return !(bad = true);
+            if (!nl) break;
+            pos++;
+            if (!parse(header)) {
+                if (!write_failed) bad = true;
+                return false;
+            }
+            header.clear();
+        }
+        return true;
+    }
+
+    bool corrupt() const { return bad; }
+    bool done() const { return done_; }
+    int error() const { return error_; } // 写入失败时的errno
+    uint64_t size() const { return size_; }
+    const Stats& stats() const { return stats_; }
+};
@@ -0,0 +1,458 @@
+#pragma once
+
+// 摘要算法：CRC32、CRC32C、MD5、SHA-256
+// CRC32C使用SSE4.2 crc32指令，SHA-256使用SHA-NI指令，运行时检测CPU支持，否则回退到软件实现
+
+#include <string>
+#include <vector>
+#include <future>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <strings.h>
+#include <unistd.h>
+#include <zlib.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+enum class HashAlgo { CRC32, CRC32C, MD5, SHA256 };
+
+inline const char* hash_algo_name(HashAlgo algo) {
+    switch (algo) {
+        case HashAlgo::CRC32: return "CRC32";
+        case HashAlgo::CRC32C: return "CRC32C";
+        case HashAlgo::MD5: return "MD5";
+        default: return "SHA-256";
+    }
+}
+
+inline bool parse_hash_algo(const std::string& name, HashAlgo& algo) {
+    static const HashAlgo all[] = {HashAlgo::CRC32, HashAlgo::CRC32C, HashAlgo::MD5, HashAlgo::SHA256};
+    for (HashAlgo a : all) {
+        if (strcasecmp(name.c_str(), hash_algo_name(a)) == 0) {
+            algo = a;
+            return true;
+        }
+    }
+    if (strcasecmp(name.c_str(), "SHA256") == 0) {
+        algo = HashAlgo::SHA256;
+        return true;
+    }
+    return false;
+}
+
+// CRC类摘要可以分块并行计算后合并
+inline bool hash_algo_combinable(HashAlgo algo) {
+    return algo == HashAlgo::CRC32 || algo == HashAlgo::CRC32C;
+}
+
+namespace digest_detail {
+
+// ---------------- CRC32C ----------------
+
+constexpr uint32_t CRC32C_POLY = 0x82F63B78; // 反射多项式
+
+struct Crc32cTable {
+    uint32_t t[256];
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c >> 1) ^ (c & 1 ? CRC32C_POLY : 0);
+            t[i] = c;
+        }
+    }
+};
+
+inline uint32_t crc32c_sw(uint32_t crc, const uint8_t* p, size_t n) {
+    static const Crc32cTable table;
+    crc = ~crc;
+    while (n--) crc = table.t[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+inline uint32_t crc32c_hw(uint32_t crc, const uint8_t* p, size_t n) {
+    uint64_t c = ~crc & 0xffffffffu;
+    while (n && (reinterpret_cast<uintptr_t>(p) & 7)) {
+        c = _mm_crc32_u8(static_cast<uint32_t>(c), *p++);
+        n--;
+    }
+    while (n >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        n -= 8;
+    }
+    while (n--) c = _mm_crc32_u8(static_cast<uint32_t>(c), *p++);
+    return ~static_cast<uint32_t>(c);
+}
+#endif
+
+inline uint32_t crc32c_update(uint32_t crc, const void* data, size_t n) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+#if defined(__x86_64__)
+    static const bool hw = __builtin_cpu_supports("sse4.2");
+    if (hw) return crc32c_hw(crc, p, n);
+#endif
+    return crc32c_sw(crc, p, n);
+}
+
+// GF(2)矩阵法合并两段CRC（与zlib crc32_combine相同的算法，多项式可换）
+inline uint32_t gf2_times(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    for (; vec; vec >>= 1, mat++)
+        if (vec & 1) sum ^= *mat;
+    return sum;
+}
+
+inline void gf2_square(uint32_t* square, const uint32_t* mat) {
+    for (int n = 0; n < 32; n++) square[n] = gf2_times(mat, mat[n]);
+}
+
+inline uint32_t crc_combine(uint32_t poly, uint32_t crc1, uint32_t crc2, uint64_t len2) {
+    if (len2 == 0) return crc1;
+    uint32_t even[32], odd[32];
+    odd[0] = poly;
+    for (int n = 1, row = 1; n < 32; n++, row <<= 1) odd[n] = row;
+    gf2_square(even, odd);
+    gf2_square(odd, even);
+    do {
+        gf2_square(even, odd);
+        if (len2 & 1) crc1 = gf2_times(even, crc1);
+        len2 >>= 1;
+        if (!len2) break;
+        gf2_square(odd, even);
+        if (len2 & 1) crc1 = gf2_times(odd, crc1);
+        len2 >>= 1;
+    } while (len2);
+    return crc1 ^ crc2;
+}
+
+// ---------------- MD5 ----------------
+
+class Md5 {
+private:
+    uint32_t h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    uint8_t buf[64];
+    size_t buf_len = 0;
+    uint64_t total = 0;
+
+    static uint32_t rol(uint32_t x, int c) { return (x << c) | (x >> (32 - c)); }
+
+    void block(const uint8_t* p) {
+        static const uint32_t K[64] = {
+            0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+            0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+            0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+            0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+            0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+            0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+            0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+            0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+        };
+        static const int R[64] = {
+            7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+            5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+            4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+            6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+        };
+        uint32_t w[16];
+        for (int i = 0; i < 16; i++)
+            w[i] = p[i * 4] | (p[i * 4 + 1] << 8) | (p[i * 4 + 2] << 16) | (static_cast<uint32_t>(p[i * 4 + 3]) << 24);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        for (int i = 0; i < 64; i++) {
+            uint32_t f;
+            int g;
+            if (i < 16) { f = (b & c) | (~b & d); g = i; }
+            else if (i < 32) { f = (d & b) | (~d & c); g = (5 * i + 1) & 15; }
+            else if (i < 48) { f = b ^ c ^ d; g = (3 * i + 5) & 15; }
+            else { f = c ^ (b | ~d); g = (7 * i) & 15; }
+            uint32_t tmp = d;
+            d = c;
+            c = b;
+            b = b + rol(a + f + K[i] + w[g], R[i]);
+            a = tmp;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    }
+
+public:
+    void update(const void* data, size_t n) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        total += n;
+        if (buf_len) {
+            size_t k = std::min(n, 64 - buf_len);
+            memcpy(buf + buf_len, p, k);
+            buf_len += k; p += k; n -= k;
+            if (buf_len < 64) return;
+            block(buf);
+            buf_len = 0;
+        }
+        for (; n >= 64; p += 64, n -= 64) block(p);
+        memcpy(buf, p, n);
+        buf_len = n;
+    }
+
+    void final(uint8_t out[16]) {
+        uint64_t bits = total * 8;
+        uint8_t pad = 0x80, zero = 0;
+        update(&pad, 1);
+        while (buf_len != 56) update(&zero, 1);
+        uint8_t len[8];
+        for (int i = 0; i < 8; i++) len[i] = static_cast<uint8_t>(bits >> (8 * i));
+        update(len, 8);
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++) out[i * 4 + j] = static_cast<uint8_t>(h[i] >> (8 * j));
+    }
+};
+
+// ---------------- SHA-256 ----------------
+
+alignas(16) static const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+inline void sha256_blocks_sw(uint32_t s[8], const uint8_t* p, size_t blocks) {
+    auto ror = [](uint32_t x, int c) { return (x >> c) | (x << (32 - c)); };
+    for (; blocks--; p += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++)
+            w[i] = (static_cast<uint32_t>(p[i * 4]) << 24) | (p[i * 4 + 1] << 16) | (p[i * 4 + 2] << 8) | p[i * 4 + 3];
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+            uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+        s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+    }
+}
+
+#if defined(__x86_64__)
+// SHA-NI：每条sha256rnds2指令完成两轮，消息扩展由sha256msg1/msg2完成
+__attribute__((target("sha,sse4.1")))
+inline void sha256_blocks_ni(uint32_t s[8], const uint8_t* p, size_t blocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&s[0]));
+    __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&s[4]));
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);                 // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);           // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);   // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);        // CDGH
+
+    for (; blocks--; p += 64) {
+        __m128i abef = state0, cdgh = state1;
+        __m128i w[16];
+        for (int i = 0; i < 16; i++) {
+            if (i < 4) {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 16)), MASK);
+            } else {
+                __m128i t = _mm_add_epi32(_mm_sha256msg1_epu32(w[i - 4], w[i - 3]),
+                                          _mm_alignr_epi8(w[i - 1], w[i - 2], 4));
+                w[i] = _mm_sha256msg2_epu32(t, w[i - 1]);
+            }
+            __m128i msg = _mm_add_epi32(w[i], _mm_load_si128(reinterpret_cast<const __m128i*>(&SHA256_K[i * 4])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);              // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);           // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);        // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);           // HGFE
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&s[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&s[4]), state1);
+}
+#endif
+
+class Sha256 {
+private:
+    uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    uint8_t buf[64];
+    size_t buf_len = 0;
+    uint64_t total = 0;
+
+    void blocks(const uint8_t* p, size_t n) {
+#if defined(__x86_64__)
+        static const bool ni = __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+        if (ni) {
+            sha256_blocks_ni(h, p, n);
+            return;
+        }
+#endif
+        sha256_blocks_sw(h, p, n);
+    }
+
+public:
+    void update(const void* data, size_t n) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        total += n;
+        if (buf_len) {
+            size_t k = std::min(n, 64 - buf_len);
+            memcpy(buf + buf_len, p, k);
+            buf_len += k; p += k; n -= k;
+            if (buf_len < 64) return;
+            blocks(buf, 1);
+            buf_len = 0;
+        }
+        if (n >= 64) {
+            blocks(p, n / 64);
+            p += n & ~size_t(63);
+            n &= 63;
+        }
+        memcpy(buf, p, n);
+        buf_len = n;
+    }
+
+    void final(uint8_t out[32]) {
+        uint64_t bits = total * 8;
+        uint8_t pad = 0x80, zero = 0;
+        update(&pad, 1);
+        while (buf_len != 56) update(&zero, 1);
+        uint8_t len[8];
+        for (int i = 0; i < 8; i++) len[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+        update(len, 8);
+        for (int i = 0; i < 8; i++)
+            for (int j = 0; j < 4; j++) out[i * 4 + j] = static_cast<uint8_t>(h[i] >> (24 - 8 * j));
+    }
+};
+
+inline std::string to_hex(const uint8_t* p, size_t n) {
+    static const char digits[] = "0123456789abcdef";
+    std::string s(n * 2, '0');
+    for (size_t i = 0; i < n; i++) {
+        s[i * 2] = digits[p[i] >> 4];
+        s[i * 2 + 1] = digits[p[i] & 15];
+    }
+    return s;
+}
+
+inline std::string crc_hex(uint32_t crc) {
+    uint8_t b[4] = {static_cast<uint8_t>(crc >> 24), static_cast<uint8_t>(crc >> 16),
+                    static_cast<uint8_t>(crc >> 8), static_cast<uint8_t>(crc)};
+    return to_hex(b, 4);
+}
+
+} // namespace digest_detail
+
+// 流式摘要计算
+class Hasher {
+private:
+    HashAlgo algo_;
+    uint32_t crc = 0;
+    digest_detail::Md5 md5;
+    digest_detail::Sha256 sha256;
+
+public:
+    explicit Hasher(HashAlgo algo) : algo_(algo) {}
+
+    HashAlgo algo() const { return algo_; }
+
+    void update(const void* data, size_t n) {
+        switch (algo_) {
+            case HashAlgo::CRC32:
+                crc = ::crc32(crc, static_cast<const Bytef*>(data), n);
+                break;
+            case HashAlgo::CRC32C:
+                crc = digest_detail::crc32c_update(crc, data, n);
+                break;
+            case HashAlgo::MD5:
+                md5.update(data, n);
+                break;
+            case HashAlgo::SHA256:
+                sha256.update(data, n);
+                break;
+        }
+    }
+
+    // CRC类算法的中间值，供分块合并使用
+    uint32_t crc_value() const { return crc; }
+
+    std::string hex_digest() {
+        uint8_t out[32];
+        switch (algo_) {
+            case HashAlgo::MD5:
+                md5.final(out);
+                return digest_detail::to_hex(out, 16);
+            case HashAlgo::SHA256:
+                sha256.final(out);
+                return digest_detail::to_hex(out, 32);
+            default:
+                return digest_detail::crc_hex(crc);
+        }
+    }
+};
+
+// 合并两段相邻数据的CRC
+inline uint32_t crc_combine(HashAlgo algo, uint32_t crc1, uint32_t crc2, uint64_t len2) {
+    if (algo == HashAlgo::CRC32) return ::crc32_combine(crc1, crc2, len2);
+    return digest_detail::crc_combine(digest_detail::CRC32C_POLY, crc1, crc2, len2);
+}
+
+// 计算fd中[start, end)的摘要，失败返回空串
+// CRC类算法在数据较大时按threads分块并行计算再合并，MD5/SHA-256只能顺序计算
+inline std::string hash_fd(int fd, HashAlgo algo, uint64_t start, uint64_t end, size_t threads) {
+    const size_t BUF = 1024 * 1024;
+    auto hash_range = [fd, algo, BUF](uint64_t from, uint64_t to, Hasher& h) {
+        std::vector<char> buf(BUF);
+        while (from < to) {
+            ssize_t n = pread(fd, buf.data(), std::min<uint64_t>(BUF, to - from), from);
+            if (n <= 0) return false;
+            h.update(buf.data(), n);
+            from += n;
+        }
+        return true;
+    };
+
+    uint64_t len = end > start ? end - start : 0;
+    if (!hash_algo_combinable(algo) || threads <= 1 || len < 8 * BUF) {
+        Hasher h(algo);
+        return hash_range(start, end, h) ? h.hex_digest() : std::string();
+    }
+
+    uint64_t part = (len + threads - 1) / threads;
+    std::vector<std::future<std::pair<bool, uint32_t>>> parts;
+    for (uint64_t from = start; from < end; from += part) {
+        uint64_t to = std::min(end, from + part);
+        parts.push_back(std::async(std::launch::async, [=] {
+            Hasher h(algo);
+            bool ok = hash_range(from, to, h);
+            return std::make_pair(ok, h.crc_value());
+        }));
+    }
+
+    uint32_t crc = 0;
+    bool ok = true;
+    uint64_t from = start;
+    for (auto& f : parts) {
+        auto r = f.get();
+        uint64_t n = std::min(part, end - from);
+        ok = ok && r.first;
+        crc = from == start ? r.second : crc_combine(algo, crc, r.second, n);
+        from += n;
+    }
+    return ok ? digest_detail::crc_hex(crc) : std::string();
+}
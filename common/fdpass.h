@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// 同机客户端经Unix域socket连接时，用SCM_RIGHTS直接传递文件描述符：
+// RETR时服务器把打开的文件fd随150回复发给客户端，STOR时客户端把源文件fd随命令发给服务器，
+// 文件数据不经过socket复制
+
+// 发送len字节数据，fd >= 0时附带该描述符（只随第一段数据发送）
+inline bool send_with_fd(int sock, const char* data, size_t len, int fd) {
+    while (len > 0) {
+        iovec iov = {const_cast<char*>(data), len};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        if (fd >= 0) {
+            memset(control, 0, sizeof(control));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        }
+        ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+        fd = -1;
+    }
+    return true;
+}
+
+// 接收数据，附带的描述符存入fd（以O_CLOEXEC接收，fd中原有的描述符被关闭）；没有附带时fd不变
+// 一次只接收一个描述符，多出的由内核丢弃
+inline ssize_t recv_with_fd(int sock, char* buf, size_t len, int& fd) {
+    iovec iov = {buf, len};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0) return n;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len >= CMSG_LEN(sizeof(int))) {
+            int received;
+            memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+            if (fd >= 0) close(fd); // 只保留最新的一个
+            fd = received;
+        }
+    }
+    return n;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+
+#define COPY_CHUNK (64LL * 1024 * 1024) // 每次copy_file_range/sendfile的字节数上限
+
+// 服务器端文件复制，数据不经过用户态：
+// 1. FICLONE：btrfs/xfs等支持reflink的文件系统上只复制元数据，瞬间完成
+// 2. copy_file_range：由内核（或NFS/SMB服务器端）完成复制
+// 3. sendfile：前两者都不支持时的兜底（例如跨文件系统的老内核）
+// 成功时返回所用方法的名称，失败返回nullptr并保留errno；
+// 源文件在复制过程中被截断、复制不足size字节时也算失败，errno为EIO
+inline const char* copy_file_data(int src, int dst, uint64_t size) {
+    if (ioctl(dst, FICLONE, src) == 0) return "reflink";
+
+    uint64_t done = 0;
+    bool use_cfr = true;
+    while (done < size) {
+        size_t len = static_cast<size_t>(std::min<uint64_t>(COPY_CHUNK, size - done));
+        ssize_t n;
+        if (use_cfr) {
+            loff_t in_off = done, out_off = done;
+            n = copy_file_range(src, &in_off, dst, &out_off, len, 0);
+            if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL)) {
+                use_cfr = false;
+                continue;
+            }
+        } else {
+            off_t in_off = done;
+            if (lseek(dst, done, SEEK_SET) < 0) return nullptr; // sendfile写在dst的当前偏移
+            n = sendfile(dst, src, &in_off, len);
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return nullptr;
+        if (n == 0) { // 源文件在复制过程中被截断
+            errno = EIO;
+            return nullptr;
+        }
+        done += n;
+    }
+    return use_cfr ? "copy_file_range" : "sendfile";
+}
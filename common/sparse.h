@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+
+#define SPARSE_HEADER_MAX 64 // 段头一行的最大长度
+
+// 稀疏传输格式（OPTS SPARSE ON后用于RETR/STOR）：
+//   "DATA <offset> <length>\n" 后跟length字节数据，只发送有数据的区段
+//   "END <size>\n"             结束并给出文件总长度（保留末尾的空洞）
+// 空洞不出现在流中，接收方不写入即得到同样的空洞
+
+inline std::string sparse_data_header(uint64_t offset, uint64_t length) {
+    return "DATA " + std::to_string(offset) + " " + std::to_string(length) + "\n";
+}
+
+inline std::string sparse_end(uint64_t size) {
+    return "END " + std::to_string(size) + "\n";
+}
+
+// 用SEEK_DATA/SEEK_HOLE遍历fd中[0, size)的数据区段，逐段交给cb(offset, length)
+// 文件系统不支持时lseek退化为整个文件一个区段；cb返回false时中止
+inline bool sparse_segments(int fd, uint64_t size,
+                            const std::function<bool(uint64_t, uint64_t)>& cb) {
+    uint64_t off = 0;
+    while (off < size) {
+        off_t data = lseek(fd, off, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) break; // 之后全是空洞
+            data = off;                // 不支持SEEK_DATA：余下部分全部当作数据
+        }
+        if (static_cast<uint64_t>(data) >= size) break;
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        uint64_t end = hole < 0 ? size : std::min<uint64_t>(hole, size);
+        if (end <= static_cast<uint64_t>(data)) end = size;
+        if (!cb(data, end - data)) return false;
+        off = end;
+    }
+    return true;
+}
+
+// 解析稀疏数据流，数据段交给write(offset, data, len)写到对应偏移
+class SparseReceiver {
+private:
+    std::string header;
+    uint64_t seg_off = 0;
+    uint64_t seg_left = 0;
+    uint64_t size_ = 0;
+    bool done_ = false;
+    bool bad = false;
+
+    bool parse(const std::string& line) {
+        char tag[8];
+        unsigned long long a = 0, b = 0;
+        int n = sscanf(line.c_str(), "%7s %llu %llu", tag, &a, &b);
+        if (n == 3 && strcmp(tag, "DATA") == 0) {
+            seg_off = a;
+            seg_left = b;
+            return true;
+        }
+        if (n == 2 && strcmp(tag, "END") == 0) {
+            size_ = a;
+            done_ = true;
+            return true;
+        }
+        return false;
+    }
+
+public:
+    using Writer = std::function<bool(uint64_t, const char*, size_t)>;
+
+    // 输入一段流数据；格式错误或write失败返回false（可用corrupt()区分）
+    bool feed(const char* data, size_t len, const Writer& write) {
+        size_t pos = 0;
+        while (pos < len && !done_) {
+            if (seg_left > 0) {
+                size_t k = std::min<uint64_t>(seg_left, len - pos);
+                if (!write(seg_off, data + pos, k)) return false;
+                seg_off += k;
+                seg_left -= k;
+                pos += k;
+                continue;
+            }
+            const char* nl = static_cast<const char*>(memchr(data + pos, '\n', len - pos));
+            size_t k = nl ? nl - (data + pos) : len - pos;
+            header.append(data + pos, k);
+            pos += k;
+            if (header.size() > SPARSE_HEADER_MAX) return !(bad = true);
+            if (!nl) break;
+            pos++; // 跳过'\n'
+            if (!parse(header)) return !(bad = true);
+            header.clear();
+        }
+        return true;
+    }
+
+    bool corrupt() const { return bad; }
+    bool done() const { return done_; }
+    uint64_t size() const { return size_; } // END给出的文件总长度
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define CACHE_DROP_THRESHOLD (64ULL * 1024 * 1024) // 超过此大小的文件传输后不留在页缓存
+#define CACHE_READAHEAD (4ULL * 1024 * 1024)       // 发送位置之前的预读窗口
+#define CACHE_DROP_CHUNK (8ULL * 1024 * 1024)      // 每次丢弃/回写的粒度
+
+// 页缓存策略：
+// KEEP   只做预读，不主动丢弃（小的热点文件所在目录）
+// STREAM 始终边传边丢弃已经传过的页
+// AUTO   文件超过阈值时才丢弃
+enum class CacheMode { Keep, Stream, Auto };
+
+struct CachePolicy {
+    CacheMode mode = CacheMode::Auto;
+    uint64_t threshold = CACHE_DROP_THRESHOLD;
+    uint64_t readahead = CACHE_READAHEAD;
+};
+
+inline const char* cache_mode_name(CacheMode m) {
+    switch (m) {
+        case CacheMode::Keep: return "KEEP";
+        case CacheMode::Stream: return "STREAM";
+        default: return "AUTO";
+    }
+}
+
+inline bool parse_cache_mode(std::string name, CacheMode& m) {
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    if (name == "KEEP") m = CacheMode::Keep;
+    else if (name == "STREAM") m = CacheMode::Stream;
+    else if (name == "AUTO") m = CacheMode::Auto;
+    else return false;
+    return true;
+}
+
+// 按路径前缀配置的策略表，取最长匹配的前缀（按路径分量匹配，""匹配所有路径）
+class CachePolicyTable {
+private:
+    std::mutex mtx;
+    std::vector<std::pair<std::string, CachePolicy>> rules{{"", CachePolicy()}};
+
+    static bool matches(const std::string& prefix, const std::string& path) {
+        if (prefix.empty()) return true;
+        return path.compare(0, prefix.size(), prefix) == 0 &&
+               (path.size() == prefix.size() || path[prefix.size()] == '/');
+    }
+
+public:
+    CachePolicy lookup(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mtx);
+        const std::pair<std::string, CachePolicy>* best = nullptr;
+        for (auto& r : rules)
+            if (matches(r.first, path) && (!best || r.first.size() > best->first.size())) best = &r;
+        return best ? best->second : CachePolicy();
+    }
+
+    void set(const std::string& prefix, const CachePolicy& p) {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& r : rules) {
+            if (r.first == prefix) {
+                r.second = p;
+                return;
+            }
+        }
+        rules.emplace_back(prefix, p);
+    }
+
+    // 删除规则（默认规则""只能修改不能删除）
+    bool remove(const std::string& prefix) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (prefix.empty()) return false;
+        auto it = std::find_if(rules.begin(), rules.end(),
+                               [&](const std::pair<std::string, CachePolicy>& r) { return r.first == prefix; });
+        if (it == rules.end()) return false;
+        rules.erase(it);
+        return true;
+    }
+
+    std::vector<std::pair<std::string, CachePolicy>> list() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return rules;
+    }
+};
+
+// 单次传输的页缓存游标：随传输位置推进预读窗口，并丢弃游标之后不再需要的页
+// 读（RETR）：fadvise(SEQUENTIAL) + readahead预读 + fadvise(DONTNEED)丢弃已发送部分
+// 写（STOR）：sync_file_range发起回写，等上一块写完后再DONTNEED，避免脏页堆积
+class CacheCursor {
+private:
+    int fd;
+    bool writing;
+    bool drop;
+    bool keep;              // KEEP策略：从不丢弃
+    uint64_t threshold;     // AUTO策略的丢弃阈值
+    uint64_t size;          // 读时为文件大小，写时不使用
+    uint64_t window;
+    uint64_t ahead = 0;     // 已发起预读的位置
+    uint64_t dropped = 0;   // 已丢弃（写时为已回写）的位置
+    uint64_t flushing = 0;  // 写时已发起回写的位置
+
+public:
+    // 读：size为文件大小；写：size为预计大小（未知为0，按策略阈值在写到该大小时开始丢弃）
+    CacheCursor(int f, const CachePolicy& p, uint64_t sz, bool write)
+        : fd(f), writing(write), size(sz), window(p.readahead) {
+        drop = p.mode == CacheMode::Stream || (p.mode == CacheMode::Auto && sz >= p.threshold);
+        threshold = p.mode == CacheMode::Auto ? p.threshold : 0;
+        keep = p.mode == CacheMode::Keep;
+        if (!writing) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    CacheCursor(const CacheCursor&) = delete;
+    CacheCursor& operator=(const CacheCursor&) = delete;
+
+    // 传输推进到pos
+    void advance(uint64_t pos) {
+        if (writing) {
+            // 大小未知的上传写过阈值后才开始丢弃
+            if (!drop && !keep && pos >= threshold) drop = true;
+            if (!drop || pos < flushing + CACHE_DROP_CHUNK) return;
+            // 等上一块回写完成后丢弃，再发起这一块的回写
+            if (flushing > dropped) {
+                sync_file_range(fd, dropped, flushing - dropped,
+                                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                                SYNC_FILE_RANGE_WAIT_AFTER);
+                posix_fadvise(fd, dropped, flushing - dropped, POSIX_FADV_DONTNEED);
+                dropped = flushing;
+            }
+            sync_file_range(fd, flushing, pos - flushing, SYNC_FILE_RANGE_WRITE);
+            flushing = pos;
+            return;
+        }
+
+        if (window && pos + window / 2 >= ahead && ahead < size) {
+            uint64_t from = std::max(ahead, pos);
+            uint64_t len = std::min<uint64_t>(window, size - from);
+            readahead(fd, from, len);
+            ahead = from + len;
+        }
+        // 只丢弃落后游标一块以上的页：刚发出的页仍被socket缓冲引用，此时丢弃无效
+        uint64_t behind = pos > CACHE_DROP_CHUNK ? pos - CACHE_DROP_CHUNK : 0;
+        if (drop && behind >= dropped + CACHE_DROP_CHUNK) {
+            posix_fadvise(fd, dropped, behind - dropped, POSIX_FADV_DONTNEED);
+            dropped = behind;
+        }
+    }
+
+    // 传输结束：丢弃剩余部分（写时先回写，脏页无法直接丢弃）
+    void finish(uint64_t end) {
+        if (!drop || end <= dropped) return;
+        if (writing) sync_file_range(fd, dropped, end - dropped,
+                                     SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                                     SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, dropped, end - dropped, POSIX_FADV_DONTNEED);
+        dropped = end;
+    }
+};
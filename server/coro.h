@@ -0,0 +1,343 @@
+#pragma once
+
+// 协程I/O层（需要C++20，-std=c++20）：命令处理函数按顺序写成阻塞风格，
+// 等待I/O时挂起协程、把线程还给reactor，就绪后在同一个reactor线程上恢复。
+// 每个会话一个协程帧，不占线程
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <string>
+#include <utility>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include "eventsource.h"
+
+#define CORO_RECV_CHUNK 4096 // recv_line每次读取的字节数
+#define CORO_LINE_MAX 8192   // 控制命令行的最大长度
+
+// 可等待的异步函数：惰性启动，被co_await时运行，结束后恢复等待它的协程
+template <typename T = void>
+class Async;
+
+namespace coro_detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            auto next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+    Async<T> get_return_object();
+    void return_value(T v) { value = std::move(v); }
+    T result() {
+        if (error) std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Async<void> get_return_object();
+    void return_void() {}
+    void result() {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+} // namespace coro_detail
+
+template <typename T>
+class Async {
+public:
+    using promise_type = coro_detail::Promise<T>;
+
+    explicit Async(std::coroutine_handle<promise_type> h) : handle(h) {}
+    Async(Async&& o) noexcept : handle(std::exchange(o.handle, nullptr)) {}
+    Async(const Async&) = delete;
+    ~Async() {
+        if (handle) handle.destroy();
+    }
+
+    auto operator co_await() && noexcept {
+        struct Awaiter {
+            std::coroutine_handle<promise_type> h;
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+                h.promise().continuation = caller;
+                return h; // 对称转移，嵌套调用不增加栈深度
+            }
+            T await_resume() { return h.promise().result(); }
+        };
+        return Awaiter{handle};
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+namespace coro_detail {
+
+template <typename T>
+Async<T> Promise<T>::get_return_object() {
+    return Async<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Async<void> Promise<void>::get_return_object() {
+    return Async<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+} // namespace coro_detail
+
+// 顶层协程（每个会话、每个accept循环一个）：立即开始运行，结束时自行释放协程帧
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// 登记在reactor上的非阻塞fd，记录等待读、写的协程。边沿触发，只登记一次
+class AsyncFd : public EventSource {
+public:
+    enum { READ, WRITE };
+    std::coroutine_handle<> waiter[2];
+
+    AsyncFd(Kind k, int f) : EventSource(k, f) {}
+
+    void handle(uint32_t events) override {
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) wake(READ);
+        // 读方恢复后可能已关闭这个fd
+        if (!removed() && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) wake(WRITE);
+    }
+
+    void wake(int dir) {
+        if (auto h = std::exchange(waiter[dir], nullptr)) h.resume();
+    }
+};
+
+// 协程持有的socket（或其他fd），析构时从reactor移除并关闭
+class Socket {
+public:
+    Socket() = default;
+    Socket(Socket&& o) noexcept : rbuf(std::move(o.rbuf)), src(std::exchange(o.src, nullptr)) {}
+    Socket& operator=(Socket&& o) noexcept {
+        if (this != &o) {
+            reset();
+            src = std::exchange(o.src, nullptr);
+            rbuf = std::move(o.rbuf);
+        }
+        return *this;
+    }
+    ~Socket() { reset(); }
+
+    // 把fd设为非阻塞并登记到reactor；失败时关闭fd，返回空Socket
+    static Socket adopt(Reactor& r, int fd, EventSource::Kind kind) {
+        Socket s;
+        if (fd < 0) return s;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        AsyncFd* a = new AsyncFd(kind, fd);
+        if (!r.add(a, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)) {
+            delete a;
+            return s;
+        }
+        s.src = a;
+        return s;
+    }
+
+    void reset() {
+        if (src) src->reactor()->remove(src);
+        src = nullptr;
+        rbuf.clear();
+    }
+
+    explicit operator bool() const { return src != nullptr; }
+    int fd() const { return src->fd; }
+    Reactor& reactor() const { return *src->reactor(); }
+    AsyncFd& source() const { return *src; }
+
+    std::string rbuf; // recv_line读多的部分
+
+private:
+    AsyncFd* src = nullptr;
+};
+
+// 等fd可读（dir为READ）或可写，timeout_ms>0时超时返回false
+class IoWait {
+public:
+    IoWait(Socket& s, int d, int timeout) : sock(s), dir(d), timeout_ms(timeout) {}
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        sock.source().waiter[dir] = h;
+        if (timeout_ms <= 0) return;
+        timer = new TimerSource([this, h]() {
+            timed_out = true;
+            sock.source().waiter[dir] = nullptr;
+            h.resume();
+        });
+        if (sock.reactor().add(timer, EPOLLIN)) {
+            timer->arm(timeout_ms);
+        } else {
+            delete timer;
+            timer = nullptr;
+        }
+    }
+    bool await_resume() {
+        if (timer) sock.reactor().remove(timer); // 本批事件处理完才释放，可能正在它的回调里
+        return !timed_out;
+    }
+
+private:
+    Socket& sock;
+    int dir;
+    int timeout_ms;
+    TimerSource* timer = nullptr;
+    bool timed_out = false;
+};
+
+// 挂起ms毫秒
+class Sleep {
+public:
+    Sleep(Reactor& r, int ms) : reactor(r), ms(ms) {}
+
+    bool await_ready() { return ms <= 0; }
+    bool await_suspend(std::coroutine_handle<> h) {
+        timer = new TimerSource([h]() { h.resume(); });
+        if (!reactor.add(timer, EPOLLIN)) {
+            delete timer;
+            timer = nullptr;
+            return false; // 不挂起，直接继续
+        }
+        timer->arm(ms);
+        return true;
+    }
+    void await_resume() {
+        if (timer) reactor.remove(timer);
+    }
+
+private:
+    Reactor& reactor;
+    int ms;
+    TimerSource* timer = nullptr;
+};
+
+inline Sleep sleep_for(Reactor& r, int ms) { return Sleep(r, ms); }
+
+// 接受一个连接，返回新fd（阻塞模式，由调用方adopt）；超时返回-1，errno为ETIMEDOUT
+inline Async<int> accept(Socket& listener, int timeout_ms) {
+    while (true) {
+        int fd = ::accept4(listener.fd(), nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd >= 0) co_return fd;
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) co_return -1;
+        if (!co_await IoWait(listener, AsyncFd::READ, timeout_ms)) {
+            errno = ETIMEDOUT;
+            co_return -1;
+        }
+    }
+}
+
+// 读最多len字节；返回读到的字节数，0为对端关闭，-1为出错
+inline Async<ssize_t> recv_some(Socket& s, char* buf, size_t len) {
+    if (!s.rbuf.empty()) {
+        size_t n = std::min(len, s.rbuf.size());
+        s.rbuf.copy(buf, n);
+        s.rbuf.erase(0, n);
+        co_return static_cast<ssize_t>(n);
+    }
+    while (true) {
+        ssize_t n = ::recv(s.fd(), buf, len, 0);
+        if (n >= 0) co_return n;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) co_return -1;
+        co_await IoWait(s, AsyncFd::READ, 0);
+    }
+}
+
+// 读一行（去掉行尾的\r\n）；连接关闭、出错或行过长时返回false
+inline Async<bool> recv_line(Socket& s, std::string& line) {
+    char buf[CORO_RECV_CHUNK];
+    while (true) {
+        size_t pos = s.rbuf.find('\n');
+        if (pos != std::string::npos) {
+            line.assign(s.rbuf, 0, pos);
+            s.rbuf.erase(0, pos + 1);
+            line.erase(line.find_last_not_of("\r\n") + 1);
+            co_return true;
+        }
+        if (s.rbuf.size() > CORO_LINE_MAX) co_return false;
+        ssize_t n = ::recv(s.fd(), buf, sizeof(buf), 0);
+        if (n > 0) {
+            s.rbuf.append(buf, n);
+            continue;
+        }
+        if (n == 0) co_return false;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) co_return false;
+        co_await IoWait(s, AsyncFd::READ, 0);
+    }
+}
+
+// 发送全部数据，对端关闭或出错时返回false
+inline Async<bool> send_all(Socket& s, const char* data, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = ::send(s.fd(), data + sent, len - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            co_await IoWait(s, AsyncFd::WRITE, 0);
+            continue;
+        }
+        co_return false;
+    }
+    co_return true;
+}
+
+inline Async<bool> send_all(Socket& s, const std::string& data) {
+    co_return co_await send_all(s, data.data(), data.size());
+}
+
+// 用sendfile把文件file_fd从offset起的count字节发到s
+inline Async<bool> sendfile(Socket& s, int file_fd, off_t offset, size_t count) {
+    while (count > 0) {
+        ssize_t n = ::sendfile(s.fd(), file_fd, &offset, count);
+        if (n > 0) {
+            count -= n;
+            continue;
+        }
+        if (n == 0) co_return false; // 文件比预期短
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            co_await IoWait(s, AsyncFd::WRITE, 0);
+            continue;
+        }
+        co_return false;
+    }
+    co_return true;
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define DIRECT_IO_ALIGN 4096                    // O_DIRECT要求的缓冲/偏移/长度对齐
+#define DIRECT_IO_BUF (1024 * 1024)             // 每次直接I/O的大小
+#define DIRECT_IO_DEPTH 3                       // 同时在途的缓冲数（三重缓冲）
+#define DIRECT_IO_POOL_MAX 32                   // 缓冲池保留的空闲缓冲上限
+#define DIRECT_IO_THRESHOLD (1ULL << 30)        // 默认超过1GB的文件走直接I/O
+
+// 对齐缓冲池：posix_memalign分配的缓冲用完后归还复用
+class AlignedBufferPool {
+private:
+    std::mutex mtx;
+    std::vector<char*> free_list;
+    size_t size;
+
+public:
+    explicit AlignedBufferPool(size_t sz) : size(sz) {}
+    ~AlignedBufferPool() {
+        for (char* p : free_list) free(p);
+    }
+
+    static AlignedBufferPool& instance() {
+        static AlignedBufferPool pool(DIRECT_IO_BUF);
+        return pool;
+    }
+
+    char* get() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!free_list.empty()) {
+                char* p = free_list.back();
+                free_list.pop_back();
+                return p;
+            }
+        }
+        void* p = nullptr;
+        return posix_memalign(&p, DIRECT_IO_ALIGN, size) == 0 ? static_cast<char*>(p) : nullptr;
+    }
+
+    void put(char* p) {
+        if (!p) return;
+        std::lock_guard<std::mutex> lock(mtx);
+        if (free_list.size() < DIRECT_IO_POOL_MAX) free_list.push_back(p);
+        else free(p);
+    }
+};
+
+// 磁盘线程与会话线程之间的有界缓冲队列
+class DirectQueue {
+public:
+    struct Block {
+        char* data = nullptr;
+        size_t len = 0;
+        uint64_t offset = 0;
+    };
+
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<Block> blocks;
+    bool closed = false;
+
+public:
+    // 队列满时阻塞，队列已关闭时返回false
+    bool push(const Block& b) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&] { return closed || blocks.size() < DIRECT_IO_DEPTH; });
+        if (closed) return false;
+        blocks.push_back(b);
+        cv.notify_all();
+        return true;
+    }
+
+    // 队列关闭且取空后返回false
+    bool pop(Block& b) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&] { return closed || !blocks.empty(); });
+        if (blocks.empty()) return false;
+        b = blocks.front();
+        blocks.pop_front();
+        cv.notify_all();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+        cv.notify_all();
+    }
+
+    // 归还未取走的缓冲
+    void drain() {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& b : blocks) AlignedBufferPool::instance().put(b.data);
+        blocks.clear();
+    }
+};
+
+// 直接I/O读：后台线程以对齐的块读取，最多DIRECT_IO_DEPTH块在途，与发送重叠
+// 文件末尾不足一块时O_DIRECT读返回实际长度，无需特殊处理
+class DirectReader {
+private:
+    int fd;
+    uint64_t size;
+    DirectQueue queue;
+    int error = 0;
+    std::thread worker;     // 最后构造：线程启动时其余成员已初始化
+
+    void run() {
+        auto& pool = AlignedBufferPool::instance();
+        for (uint64_t off = 0; off < size; off += DIRECT_IO_BUF) {
+            char* buf = pool.get();
+            if (!buf) {
+                error = ENOMEM;
+                break;
+            }
+            ssize_t n;
+            while ((n = pread(fd, buf, DIRECT_IO_BUF, off)) < 0 && errno == EINTR) {}
+            if (n <= 0) {
+                error = n < 0 ? errno : EIO; // 读到0说明文件在传输中被截断
+                pool.put(buf);
+                break;
+            }
+            size_t len = std::min<uint64_t>(n, size - off);
+            if (!queue.push({buf, len, off})) {
+                pool.put(buf);
+                break;
+            }
+            if (static_cast<size_t>(n) < DIRECT_IO_BUF && off + n < size) {
+                error = EIO;
+                break;
+            }
+        }
+        queue.close();
+    }
+
+public:
+    DirectReader(int f, uint64_t sz) : fd(f), size(sz), worker(&DirectReader::run, this) {}
+
+    ~DirectReader() {
+        queue.close();
+        if (worker.joinable()) worker.join();
+        queue.drain();
+    }
+
+    // 取下一块，用完后调用release；读完或出错返回false
+    bool next(DirectQueue::Block& b) { return queue.pop(b); }
+    void release(DirectQueue::Block& b) {
+        AlignedBufferPool::instance().put(b.data);
+        b.data = nullptr;
+    }
+
+    // 读线程结束后的错误码（0为成功）
+    int status() {
+        if (worker.joinable()) worker.join();
+        return error;
+    }
+};
+
+// 直接I/O写：把接收的数据拼成对齐的整块交给后台线程写盘
+// 最后不足对齐长度的尾部清掉O_DIRECT后按普通写入
+class DirectWriter {
+private:
+    int fd;
+    DirectQueue queue;
+    char* cur = nullptr;    // 正在填充的缓冲
+    size_t fill = 0;
+    uint64_t offset = 0;    // cur对应的文件偏移
+    std::atomic<int> error{0};
+    std::thread worker;     // 最后构造：线程启动时其余成员已初始化
+
+    void run() {
+        DirectQueue::Block b;
+        while (queue.pop(b)) {
+            for (size_t done = 0; done < b.len && !error; ) {
+                ssize_t n = pwrite(fd, b.data + done, b.len - done, b.offset + done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) error = n < 0 ? errno : EIO;
+                else done += n;
+            }
+            AlignedBufferPool::instance().put(b.data);
+        }
+    }
+
+    bool submit(size_t len) {
+        if (!queue.push({cur, len, offset})) return false;
+        offset += len;
+        cur = nullptr;
+        fill = 0;
+        return true;
+    }
+
+public:
+    explicit DirectWriter(int f) : fd(f), worker(&DirectWriter::run, this) {}
+
+    ~DirectWriter() {
+        queue.close();
+        if (worker.joinable()) worker.join();
+        queue.drain();
+        AlignedBufferPool::instance().put(cur);
+    }
+
+    bool write(const char* data, size_t len) {
+        while (len > 0) {
+            if (error) {
+                errno = error;
+                return false;
+            }
+            if (!cur && !(cur = AlignedBufferPool::instance().get())) {
+                errno = ENOMEM;
+                return false;
+            }
+            size_t k = std::min(len, DIRECT_IO_BUF - fill);
+            memcpy(cur + fill, data, k);
+            fill += k;
+            data += k;
+            len -= k;
+            if (fill == DIRECT_IO_BUF && !submit(fill)) return false;
+        }
+        return true;
+    }
+
+    // 写出剩余数据并等待完成；失败时设置errno
+    bool finish() {
+        size_t aligned = fill / DIRECT_IO_ALIGN * DIRECT_IO_ALIGN;
+        size_t tail = fill - aligned;
+        char* tail_buf = nullptr;
+        if (cur && aligned > 0) {
+            tail_buf = tail ? AlignedBufferPool::instance().get() : nullptr;
+            if (tail_buf) memcpy(tail_buf, cur + aligned, tail);
+            submit(aligned);
+        } else if (cur) {
+            tail_buf = cur;
+            cur = nullptr;
+        }
+        queue.close();
+        worker.join();
+
+        if (!error && tail) {
+            // 尾部无法满足对齐要求，改回普通写入
+            int flags = fcntl(fd, F_GETFL);
+            if (!tail_buf) error = ENOMEM;
+            else if (fcntl(fd, F_SETFL, flags & ~O_DIRECT) < 0) error = errno;
+            for (size_t done = 0; !error && done < tail; ) {
+                ssize_t n = pwrite(fd, tail_buf + done, tail - done, offset + done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) error = n < 0 ? errno : EIO;
+                else done += n;
+            }
+        }
+        AlignedBufferPool::instance().put(tail_buf);
+        if (error) errno = error;
+        return !error;
+    }
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define DURABLE_WINDOW_US 1000   // 组提交的收集窗口：最早的请求到达后最多再等这么久
+#define DURABLE_BATCH_MAX 256    // 每批最多的文件数，攒满立即提交
+#define DURABLE_SYNCFS_MIN 32    // 同一文件系统上一批超过这么多文件时改用一次syncfs
+
+// 上传完成后的持久化方式：
+// OFF   不主动同步，由内核回写（最快，掉电可能丢失刚上传的文件）
+// SYNC  每个文件单独fdatasync（延迟最低，并发小文件多时吞吐差）
+// GROUP 组提交：收集各会话完成的上传，按固定节奏批量同步后一起返回
+enum class DurableMode { Off, Sync, Group };
+
+inline const char* durable_mode_name(DurableMode m) {
+    switch (m) {
+        case DurableMode::Off: return "OFF";
+        case DurableMode::Sync: return "SYNC";
+        default: return "GROUP";
+    }
+}
+
+class DurabilityManager {
+public:
+    struct Stats {
+        uint64_t commits = 0;       // 同步过的文件数
+        uint64_t batches = 0;       // 组提交的批次数
+        uint64_t syncfs_calls = 0;  // 以syncfs代替逐个fdatasync的次数
+        uint64_t total_wait_us = 0; // 会话等待持久化的累计时间
+        uint64_t max_wait_us = 0;
+    };
+
+private:
+    struct Entry {
+        int fd;
+        int dirfd;
+        int error = 0;
+        bool done = false;
+    };
+
+    std::mutex mtx;
+    std::condition_variable cv;       // 唤醒同步线程
+    std::condition_variable done_cv;  // 通知等待中的会话
+    std::vector<Entry*> pending;
+    std::chrono::steady_clock::time_point first_arrival; // pending中最早请求的到达时间
+    bool started = false;
+    std::atomic<DurableMode> mode_{DurableMode::Group};
+    std::atomic<uint64_t> window_us{DURABLE_WINDOW_US};
+    std::atomic<uint64_t> batch_max{DURABLE_BATCH_MAX};
+    Stats stats_;
+
+    // 目录fd可能是O_PATH打开的（SessionFs的目录缓存），不能直接fsync，重新打开一次
+    static int sync_dir(int dirfd) {
+        int fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) return errno;
+        int err = fsync(fd) < 0 ? errno : 0;
+        close(fd);
+        return err;
+    }
+
+    // 同一批内：按文件系统分组，文件多的组用一次syncfs；否则先对所有文件发起回写，
+    // 再逐个fdatasync，第一个fdatasync提交的日志事务通常已包含其余文件的元数据，之后的都很快；
+    // 新建文件的目录项也要落盘，同一目录只fsync一次
+    void sync_batch(std::vector<Entry*>& batch) {
+        std::map<dev_t, std::vector<Entry*>> by_dev;
+        for (Entry* e : batch) {
+            struct stat st;
+            if (fstat(e->fd, &st) < 0) e->error = errno;
+            else by_dev[st.st_dev].push_back(e);
+        }
+        uint64_t syncfs_calls = 0;
+        for (auto& group : by_dev) {
+            if (group.second.size() >= DURABLE_SYNCFS_MIN) {
+                int err = syncfs(group.second.front()->fd) < 0 ? errno : 0;
+                for (Entry* e : group.second) e->error = err;
+                syncfs_calls++;
+                continue; // syncfs已包含目录
+            }
+            for (Entry* e : group.second) sync_file_range(e->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+            std::map<std::pair<dev_t, ino_t>, int> dirs; // 目录 -> fsync结果
+            for (Entry* e : group.second) {
+                if (fdatasync(e->fd) < 0) {
+                    e->error = errno;
+                    continue;
+                }
+                struct stat ds;
+                if (e->dirfd < 0 || fstat(e->dirfd, &ds) < 0) continue;
+                auto key = std::make_pair(ds.st_dev, ds.st_ino);
+                auto it = dirs.find(key);
+                if (it == dirs.end()) it = dirs.emplace(key, sync_dir(e->dirfd)).first;
+                e->error = it->second;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        stats_.batches++;
+        stats_.commits += batch.size();
+        stats_.syncfs_calls += syncfs_calls;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true) {
+            cv.wait(lock, [&] { return !pending.empty(); });
+            // 从最早的请求到达起，收集窗口内到达的请求一起提交，批满时提前结束；
+            // 上一批同步期间排队的请求已经等过，不再额外等待
+            auto deadline = first_arrival + std::chrono::microseconds(window_us.load());
+            cv.wait_until(lock, deadline, [&] { return pending.size() >= batch_max; });
+            std::vector<Entry*> batch;
+            batch.swap(pending);
+            lock.unlock();
+            sync_batch(batch);
+            lock.lock();
+            for (Entry* e : batch) e->done = true;
+            done_cv.notify_all();
+        }
+    }
+
+public:
+    // 让fd（及其所在目录dirfd，可为-1）的数据持久化后返回；返回0或errno
+    // 调用期间fd和dirfd须保持打开
+    int commit(int fd, int dirfd) {
+        DurableMode m = mode_;
+        if (m == DurableMode::Off) return 0;
+        auto start = std::chrono::steady_clock::now();
+        int err = 0;
+        if (m == DurableMode::Sync) {
+            if (fdatasync(fd) < 0) err = errno;
+            else if (dirfd >= 0) err = sync_dir(dirfd);
+            std::lock_guard<std::mutex> lock(mtx);
+            stats_.commits++;
+        } else {
+            Entry e{fd, dirfd};
+            std::unique_lock<std::mutex> lock(mtx);
+            if (!started) {
+                std::thread(&DurabilityManager::run, this).detach(); // 随进程存在
+                started = true;
+            }
+            if (pending.empty()) first_arrival = start;
+            pending.push_back(&e);
+            cv.notify_one();
+            done_cv.wait(lock, [&] { return e.done; });
+            err = e.error;
+        }
+        uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(mtx);
+        stats_.total_wait_us += us;
+        stats_.max_wait_us = std::max(stats_.max_wait_us, us);
+        return err;
+    }
+
+    void set_mode(DurableMode m) { mode_ = m; }
+    void set_window(uint64_t us) { window_us = us; }
+    void set_batch_max(uint64_t n) { batch_max = std::max<uint64_t>(n, 1); }
+    DurableMode mode() const { return mode_; }
+    uint64_t window() const { return window_us; }
+    uint64_t batch_limit() const { return batch_max; }
+
+    Stats stats() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return stats_;
+    }
+};
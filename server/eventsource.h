@@ -0,0 +1,159 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cerrno>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#define REACTOR_BATCH 1024  // 每次epoll_wait取回的事件数
+#define REACTOR_POLL_MS 100 // epoll_wait超时，用于检查停止标志
+
+class Reactor;
+
+// 登记在epoll上的事件源：epoll_event.data.ptr直接指向它，事件到达时按虚函数分派，
+// 不再用fd查全局表。每个事件源属于一个reactor，只在该reactor的线程上处理和移除
+class EventSource {
+public:
+    enum Kind { LISTENER, CONTROL, DATA_LISTENER, DATA, TIMER };
+
+    const Kind kind;
+    const int fd;
+
+    EventSource(Kind k, int f) : kind(k), fd(f) {}
+    virtual ~EventSource() {
+        if (fd >= 0) close(fd);
+    }
+    EventSource(const EventSource&) = delete;
+    EventSource& operator=(const EventSource&) = delete;
+
+    virtual void handle(uint32_t events) = 0;
+
+    Reactor* reactor() const { return owner; }
+    bool removed() const { return dead; }
+
+private:
+    friend class Reactor;
+    Reactor* owner = nullptr;
+    bool dead = false; // 已从epoll移除，本轮剩余的事件跳过
+};
+
+// 单线程reactor：一个epoll实例，事件源的创建、处理和移除都在这个线程上，无需加锁。
+// 移除的事件源要等当前这批事件处理完才释放（按批次的epoch回收）：EPOLL_CTL_DEL之后
+// 内核不会再返回它，只有同一批中排在后面的事件可能还指着它，此时按dead标志跳过
+class Reactor {
+private:
+    int epoll_fd = -1;
+    std::vector<EventSource*> retired;
+
+    bool ctl(int op, EventSource* src, uint32_t events) {
+        struct epoll_event ev{};
+        ev.events = events;
+        ev.data.ptr = src;
+        return epoll_ctl(epoll_fd, op, src->fd, &ev) == 0;
+    }
+
+public:
+    Reactor() : epoll_fd(epoll_create1(EPOLL_CLOEXEC)) {}
+    ~Reactor() {
+        for (EventSource* s : retired) delete s;
+        if (epoll_fd >= 0) close(epoll_fd);
+    }
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    bool valid() const { return epoll_fd >= 0; }
+
+    // 登记事件源，reactor取得所有权；失败时由调用方释放。
+    // 可以从其他线程调用（把新会话交给某个reactor），此后该事件源只由本reactor的线程访问
+    bool add(EventSource* src, uint32_t events) {
+        src->owner = this;
+        return ctl(EPOLL_CTL_ADD, src, events);
+    }
+
+    bool modify(EventSource* src, uint32_t events) {
+        return ctl(EPOLL_CTL_MOD, src, events);
+    }
+
+    // 移除并在本批事件处理完后释放；只能在本reactor的线程上调用，重复调用无害
+    void remove(EventSource* src) {
+        if (src->dead) return;
+        src->dead = true;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, src->fd, nullptr);
+        retired.push_back(src);
+    }
+
+    void run(const std::atomic<bool>& running) {
+        struct epoll_event events[REACTOR_BATCH];
+        while (running) {
+            int n = epoll_wait(epoll_fd, events, REACTOR_BATCH, REACTOR_POLL_MS);
+            if (n < 0 && errno != EINTR) return;
+            for (int i = 0; i < n; i++) {
+                EventSource* src = static_cast<EventSource*>(events[i].data.ptr);
+                if (!src->dead) src->handle(events[i].events);
+            }
+            for (EventSource* s : retired) delete s;
+            retired.clear();
+        }
+    }
+};
+
+// 基于timerfd的定时器，到期时在所属reactor的线程上调用回调
+class TimerSource : public EventSource {
+private:
+    std::function<void()> fn;
+
+public:
+    explicit TimerSource(std::function<void()> f)
+        : EventSource(TIMER, timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)), fn(std::move(f)) {}
+
+    // 单次定时，ms毫秒后到期；0取消
+    bool arm(int ms) {
+        struct itimerspec spec{};
+        spec.it_value.tv_sec = ms / 1000;
+        spec.it_value.tv_nsec = (ms % 1000) * 1000000L;
+        return timerfd_settime(fd, 0, &spec, nullptr) == 0;
+    }
+
+    void handle(uint32_t /*events*/) override {
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) fn();
+    }
+};
+
+// 一组reactor，每个线程一个。会话按轮转分到某个reactor上，之后它的控制连接、
+// 数据连接和定时器都登记在同一个reactor里，各线程之间不共享可变状态
+class ReactorGroup {
+private:
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    std::atomic<size_t> next{0};
+
+public:
+    bool init(size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            reactors.emplace_back(new Reactor());
+            if (!reactors.back()->valid()) return false;
+        }
+        return !reactors.empty();
+    }
+
+    Reactor& at(size_t i) { return *reactors[i]; }
+
+    Reactor& pick() {
+        return *reactors[next.fetch_add(1, std::memory_order_relaxed) % reactors.size()];
+    }
+
+    // 在调用线程上运行第一个reactor，其余各开一个线程；running变为false后全部返回
+    void run(const std::atomic<bool>& running) {
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < reactors.size(); i++)
+            threads.emplace_back(&Reactor::run, reactors[i].get(), std::cref(running));
+        reactors[0]->run(running);
+        for (auto& t : threads) t.join();
+    }
+};
@@ -0,0 +1,323 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "sessionfs.h"
+#include "fswatch.h"
+
+#define FD_CACHE_SHARDS 16     // 分片数，降低并发下载的锁竞争
+#define FD_CACHE_MAX_FDS 1024  // 默认缓存的打开文件数上限
+#define FD_CACHE_TTL 30        // 路径->inode映射的有效期（秒），inotify不可用时兜底
+
+// 进程内共享的只读fd缓存：以(dev, inode)为键，引用计数
+// 路径先映射到inode，再由inode取得共享的fd；同一文件的并发下载共用一个fd，
+// 读取一律用pread/sendfile带显式偏移，不依赖也不修改文件偏移
+// 路径映射在TTL到期或收到inotify事件时失效，超出上限时关闭最久未用的空闲fd
+class FdCache {
+public:
+    // 一次借用：析构时归还引用
+    class Ref {
+    private:
+        FdCache* cache = nullptr;
+        dev_t dev = 0;
+        ino_t ino = 0;
+        bool owned = false; // 未进入缓存（超出上限），由Ref自己关闭
+        int fd_ = -1;
+
+        friend class FdCache;
+
+    public:
+        struct stat st{};   // 借用时的最新属性
+
+        Ref() = default;
+        Ref(const Ref&) = delete;
+        Ref& operator=(const Ref&) = delete;
+        Ref(Ref&& o) noexcept { *this = std::move(o); }
+        Ref& operator=(Ref&& o) noexcept {
+            if (this != &o) {
+                reset();
+                cache = o.cache; dev = o.dev; ino = o.ino; owned = o.owned; fd_ = o.fd_; st = o.st;
+                o.cache = nullptr;
+                o.fd_ = -1;
+            }
+            return *this;
+        }
+        ~Ref() { reset(); }
+
+        int fd() const { return fd_; }
+        explicit operator bool() const { return fd_ >= 0; }
+
+        void reset() {
+            if (fd_ < 0) return;
+            if (owned) close(fd_);
+            else if (cache) cache->release(dev, ino);
+            fd_ = -1;
+            cache = nullptr;
+        }
+    };
+
+    struct Stats {
+        size_t open_fds = 0;
+        size_t max_fds = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct InodeKey {
+        dev_t dev;
+        ino_t ino;
+        bool operator==(const InodeKey& o) const { return dev == o.dev && ino == o.ino; }
+    };
+    struct InodeHash {
+        size_t operator()(const InodeKey& k) const {
+            return std::hash<uint64_t>()(static_cast<uint64_t>(k.dev) * 0x9e3779b97f4a7c15ULL ^ k.ino);
+        }
+    };
+
+    struct Inode {
+        int fd;
+        int refs = 0;
+        bool stale = false;         // 已失效，引用归零后关闭
+        Clock::time_point last_used;
+    };
+    struct PathEntry {
+        InodeKey key;
+        Clock::time_point expires;
+    };
+
+    // 路径和inode各自按哈希落到某个分片，一次只持有一个分片的锁
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<std::string, PathEntry> paths;
+        std::unordered_map<InodeKey, Inode, InodeHash> inodes;
+    };
+
+    Shard shards[FD_CACHE_SHARDS];
+    std::atomic<size_t> open_fds{0};
+    std::atomic<size_t> max_fds{FD_CACHE_MAX_FDS};
+    std::atomic<int> ttl_sec{FD_CACHE_TTL};
+    std::atomic<uint64_t> hits{0}, misses{0}, evictions{0};
+
+    Shard& path_shard(const std::string& rel) {
+        return shards[std::hash<std::string>()(rel) % FD_CACHE_SHARDS];
+    }
+    Shard& inode_shard(const InodeKey& k) {
+        return shards[InodeHash()(k) % FD_CACHE_SHARDS];
+    }
+
+    void release(dev_t dev, ino_t ino) {
+        InodeKey k{dev, ino};
+        Shard& s = inode_shard(k);
+        std::lock_guard<std::mutex> lock(s.mtx);
+        auto it = s.inodes.find(k);
+        if (it == s.inodes.end()) return;
+        it->second.refs--;
+        it->second.last_used = Clock::now();
+        if (it->second.refs == 0 && it->second.stale) {
+            close(it->second.fd);
+            s.inodes.erase(it);
+            open_fds--;
+        }
+    }
+
+    // 在分片s中关闭最久未用的空闲fd，调用者持有s的锁
+    bool evict_one(Shard& s) {
+        auto victim = s.inodes.end();
+        for (auto it = s.inodes.begin(); it != s.inodes.end(); ++it) {
+            if (it->second.refs == 0 &&
+                (victim == s.inodes.end() || it->second.last_used < victim->second.last_used))
+                victim = it;
+        }
+        if (victim == s.inodes.end()) return false;
+        close(victim->second.fd);
+        s.inodes.erase(victim);
+        open_fds--;
+        evictions++;
+        return true;
+    }
+
+    // 超出上限时依次在各分片中淘汰空闲fd
+    void make_room() {
+        for (size_t i = 0; i < FD_CACHE_SHARDS && open_fds >= max_fds; i++) {
+            std::lock_guard<std::mutex> lock(shards[i].mtx);
+            while (open_fds >= max_fds && evict_one(shards[i])) {}
+        }
+    }
+
+    void mark_stale(const InodeKey& k) {
+        Shard& s = inode_shard(k);
+        std::lock_guard<std::mutex> lock(s.mtx);
+        auto it = s.inodes.find(k);
+        if (it == s.inodes.end()) return;
+        if (it->second.refs == 0) {
+            close(it->second.fd);
+            s.inodes.erase(it);
+            open_fds--;
+        } else {
+            it->second.stale = true;
+        }
+    }
+
+    // 在inode表中登记fd并增加引用；已有同一inode时复用旧fd，返回实际使用的fd
+    int attach(const InodeKey& k, int fd, bool& cached) {
+        Shard& s = inode_shard(k);
+        std::lock_guard<std::mutex> lock(s.mtx);
+        auto it = s.inodes.find(k);
+        if (it != s.inodes.end() && !it->second.stale) {
+            it->second.refs++;
+            cached = true;
+            if (fd != it->second.fd) close(fd);
+            return it->second.fd;
+        }
+        if (it != s.inodes.end() || open_fds >= max_fds) {
+            cached = false; // 旧fd已失效仍被占用，或超出上限：不进缓存
+            return fd;
+        }
+        s.inodes[k] = Inode{fd, 1, false, Clock::now()};
+        open_fds++;
+        cached = true;
+        return fd;
+    }
+
+public:
+    // 借用文件name（相对会话当前目录）的只读fd；失败时返回false并设置errno
+    bool acquire(SessionFs& fs, const std::string& name, Ref& out) {
+        out.reset();
+        std::string rel;
+        if (!fs.normalize(name, rel)) {
+            errno = EACCES;
+            return false;
+        }
+
+        // 命中路径映射时直接借用inode的fd
+        InodeKey key{};
+        bool found = false;
+        {
+            Shard& s = path_shard(rel);
+            std::lock_guard<std::mutex> lock(s.mtx);
+            auto it = s.paths.find(rel);
+            if (it != s.paths.end()) {
+                if (Clock::now() < it->second.expires) {
+                    key = it->second.key;
+                    found = true;
+                } else {
+                    s.paths.erase(it);
+                }
+            }
+        }
+        if (found) {
+            Shard& s = inode_shard(key);
+            std::unique_lock<std::mutex> lock(s.mtx);
+            auto it = s.inodes.find(key);
+            if (it != s.inodes.end() && !it->second.stale) {
+                it->second.refs++;
+                int fd = it->second.fd;
+                lock.unlock();
+                out.cache = this;
+                out.dev = key.dev;
+                out.ino = key.ino;
+                out.fd_ = fd;
+                fstat(fd, &out.st); // fd共享，但大小/时间可能被STOR改变，每次重新取
+                hits++;
+                return true;
+            }
+        }
+
+        misses++;
+        int fd = fs.open_file(name, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+            close(fd);
+            errno = EISDIR;
+            return false;
+        }
+
+        size_t slash = rel.rfind('/');
+        FsWatcher::instance().watch_dir(slash == std::string::npos ? "" : rel.substr(0, slash));
+        if (open_fds >= max_fds) make_room();
+
+        key = {st.st_dev, st.st_ino};
+        bool cached;
+        fd = attach(key, fd, cached);
+        if (cached) {
+            Shard& s = path_shard(rel);
+            std::lock_guard<std::mutex> lock(s.mtx);
+            s.paths[rel] = PathEntry{key, Clock::now() + std::chrono::seconds(ttl_sec.load())};
+        }
+        out.cache = this;
+        out.dev = key.dev;
+        out.ino = key.ino;
+        out.owned = !cached;
+        out.fd_ = fd;
+        out.st = st;
+        return true;
+    }
+
+    // 路径对应的文件已变化：删除映射并关闭空闲的fd；rel为空时全部失效
+    // prefix为true时同时失效该目录下的所有路径（目录被改名或删除）
+    void invalidate(const std::string& rel, bool prefix = false) {
+        std::vector<InodeKey> keys;
+        if (rel.empty() || prefix) {
+            std::string dir = rel + "/";
+            for (auto& s : shards) {
+                std::lock_guard<std::mutex> lock(s.mtx);
+                for (auto it = s.paths.begin(); it != s.paths.end(); ) {
+                    if (rel.empty() || it->first == rel || it->first.compare(0, dir.size(), dir) == 0) {
+                        keys.push_back(it->second.key);
+                        it = s.paths.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+        } else {
+            Shard& s = path_shard(rel);
+            std::lock_guard<std::mutex> lock(s.mtx);
+            auto it = s.paths.find(rel);
+            if (it != s.paths.end()) {
+                keys.push_back(it->second.key);
+                s.paths.erase(it);
+            }
+        }
+        for (auto& k : keys) mark_stale(k);
+    }
+
+    // 接收inotify事件
+    void on_fs_event(const std::string& rel, uint32_t mask) {
+        if (mask & IN_Q_OVERFLOW) invalidate("");
+        else if (mask & (IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                         IN_DELETE_SELF | IN_MOVE_SELF))
+            invalidate(rel, (mask & IN_ISDIR) || (mask & (IN_DELETE_SELF | IN_MOVE_SELF)));
+    }
+
+    void set_max_fds(size_t n) {
+        max_fds = std::max<size_t>(n, 1);
+        make_room();
+    }
+
+    void set_ttl(int sec) { ttl_sec = std::max(sec, 1); }
+
+    Stats stats() const {
+        Stats s;
+        s.open_fds = open_fds;
+        s.max_fds = max_fds;
+        s.hits = hits;
+        s.misses = misses;
+        s.evictions = evictions;
+        return s;
+    }
+};
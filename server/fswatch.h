@@ -0,0 +1,159 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+// 需要关注的事件：内容写完、增删、改名、属性变化
+#define FSWATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                      IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// 进程内唯一的inotify监视器：按需监视根目录下的目录，
+// 事件以相对根目录的路径分发给所有监听者（fd缓存等据此失效）
+// 事件队列溢出时以空路径和IN_Q_OVERFLOW通知，监听者应丢弃全部缓存
+class FsWatcher {
+public:
+    using Listener = std::function<void(const std::string& rel, uint32_t mask)>;
+
+private:
+    int inotify_fd = -1;
+    std::string root;
+    std::mutex mtx;
+    std::map<int, std::string> dirs;       // wd -> 相对根目录的目录路径
+    std::map<std::string, int> watched;    // 目录路径 -> wd
+    std::vector<Listener> listeners;
+    std::thread worker;
+    std::atomic<bool> running{false};
+
+    FsWatcher() = default;
+
+    void notify(const std::string& rel, uint32_t mask) {
+        std::vector<Listener> copy;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            copy = listeners;
+        }
+        for (auto& l : copy) l(rel, mask);
+    }
+
+    // 目录被移走后原监视仍跟着inode走，报告的却是旧路径：移除它及其下所有子目录的监视，
+    // 移到根目录内的新位置时由监听者重新watch_dir
+    void unwatch_tree(const std::string& rel) {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto it = watched.lower_bound(rel); it != watched.end(); ) {
+            const std::string& path = it->first;
+            if (path.compare(0, rel.size(), rel) != 0) break;
+            if (path.size() != rel.size() && path[rel.size()] != '/') {
+                ++it;
+                continue;
+            }
+            inotify_rm_watch(inotify_fd, it->second);
+            dirs.erase(it->second);
+            it = watched.erase(it);
+        }
+    }
+
+    void loop() {
+        alignas(struct inotify_event) char buf[64 * 1024];
+        while (running) {
+            struct pollfd pfd = {inotify_fd, POLLIN, 0};
+            if (poll(&pfd, 1, 500) <= 0) continue; // 定期醒来检查running
+            ssize_t n = read(inotify_fd, buf, sizeof(buf));
+            if (n <= 0) continue;
+
+            for (char* p = buf; p < buf + n; ) {
+                auto* ev = reinterpret_cast<struct inotify_event*>(p);
+                p += sizeof(struct inotify_event) + ev->len;
+
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    notify("", IN_Q_OVERFLOW);
+                    continue;
+                }
+                std::string dir;
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    auto it = dirs.find(ev->wd);
+                    if (it == dirs.end()) continue;
+                    dir = it->second;
+                    if (ev->mask & IN_IGNORED) { // 目录已删除或被移走，内核自动移除了监视
+                        watched.erase(dir);
+                        dirs.erase(it);
+                        continue;
+                    }
+                }
+                std::string rel = dir;
+                if (ev->len && ev->name[0]) rel += (rel.empty() ? "" : "/") + std::string(ev->name);
+                if ((ev->mask & IN_MOVED_FROM) && (ev->mask & IN_ISDIR)) unwatch_tree(rel);
+                notify(rel, ev->mask);
+            }
+        }
+    }
+
+public:
+    static FsWatcher& instance() {
+        static FsWatcher watcher;
+        return watcher;
+    }
+
+    FsWatcher(const FsWatcher&) = delete;
+    FsWatcher& operator=(const FsWatcher&) = delete;
+
+    ~FsWatcher() { stop(); }
+
+    bool start(const std::string& root_dir) {
+        if (running) return true;
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd < 0) return false;
+        root = root_dir;
+        running = true;
+        worker = std::thread(&FsWatcher::loop, this);
+        watch_dir("");
+        return true;
+    }
+
+    void stop() {
+        if (!running) return;
+        running = false;
+        if (worker.joinable()) worker.join();
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+
+    bool active() const { return running; }
+
+    // 上传和增量传输过程中的临时文件（.<name>.<id>.part、.<name>.<id>.delta），监听者通常应忽略
+    static bool is_temp_name(const std::string& rel) {
+        size_t slash = rel.rfind('/');
+        std::string leaf = slash == std::string::npos ? rel : rel.substr(slash + 1);
+        auto ends_with = [&](const std::string& s) {
+            return leaf.size() > s.size() && leaf.compare(leaf.size() - s.size(), s.size(), s) == 0;
+        };
+        return !leaf.empty() && leaf[0] == '.' && (ends_with(".part") || ends_with(".delta"));
+    }
+
+    // 监视相对根目录的目录（重复调用无副作用）
+    bool watch_dir(const std::string& rel) {
+        if (!running) return false;
+        std::lock_guard<std::mutex> lock(mtx);
+        if (watched.count(rel)) return true;
+        std::string path = rel.empty() ? root : root + "/" + rel;
+        int wd = inotify_add_watch(inotify_fd, path.c_str(), FSWATCH_MASK | IN_ONLYDIR | IN_DONT_FOLLOW);
+        if (wd < 0) return false;
+        dirs[wd] = rel;
+        watched[rel] = wd;
+        return true;
+    }
+
+    void add_listener(Listener l) {
+        std::lock_guard<std::mutex> lock(mtx);
+        listeners.push_back(std::move(l));
+    }
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <cerrno>
+#include "../common/digest.h"
+
+#define HASH_CACHE_MAX_ENTRIES 100000 // 内存中缓存的摘要条数上限
+#define HASH_XATTR_PREFIX "user.myftp."
+
+// 摘要缓存：以(dev, inode, mtime, size)为键，文件内容变化后自然失效
+// 整个文件的摘要持久化到扩展属性user.myftp.<algo>，
+// 文件系统不支持xattr时追加到旁路索引文件，启动时重新载入
+class HashCache {
+private:
+    std::mutex mtx;
+    std::unordered_map<std::string, std::string> mem; // 键 -> 十六进制摘要
+    std::string index_path;
+
+    static std::string stamp(const struct stat& st) {
+        return std::to_string(st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec) + " " +
+               std::to_string(st.st_size);
+    }
+
+    static std::string key(const struct stat& st, HashAlgo algo, uint64_t start, uint64_t end) {
+        std::ostringstream oss;
+        oss << st.st_dev << ":" << st.st_ino << ":" << stamp(st) << ":"
+            << hash_algo_name(algo) << ":" << start << "-" << end;
+        return oss.str();
+    }
+
+    static std::string xattr_name(HashAlgo algo) {
+        return std::string(HASH_XATTR_PREFIX) + hash_algo_name(algo);
+    }
+
+    void remember(const std::string& k, const std::string& hex) {
+        if (mem.size() >= HASH_CACHE_MAX_ENTRIES) mem.clear();
+        mem[k] = hex;
+    }
+
+public:
+    explicit HashCache(const std::string& index) : index_path(index) {
+        // 载入旁路索引：每行 "dev ino mtime_ns size algo hex"
+        std::ifstream in(index_path);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream iss(line);
+            struct stat st{};
+            long long mtime;
+            std::string algo_name, hex;
+            HashAlgo algo;
+            if (!(iss >> st.st_dev >> st.st_ino >> mtime >> st.st_size >> algo_name >> hex)) continue;
+            if (!parse_hash_algo(algo_name, algo)) continue;
+            st.st_mtim.tv_sec = mtime / 1000000000LL;
+            st.st_mtim.tv_nsec = mtime % 1000000000LL;
+            remember(key(st, algo, 0, st.st_size), hex);
+        }
+    }
+
+    // 查找[start, end)的摘要，fd用于读取扩展属性
+    bool lookup(int fd, const struct stat& st, HashAlgo algo, uint64_t start, uint64_t end,
+                std::string& hex) {
+        std::string k = key(st, algo, start, end);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = mem.find(k);
+            if (it != mem.end()) {
+                hex = it->second;
+                return true;
+            }
+        }
+        if (start != 0 || end != static_cast<uint64_t>(st.st_size)) return false;
+
+        // 扩展属性内容为 "mtime_ns size hex"
+        char value[256];
+        ssize_t n = fgetxattr(fd, xattr_name(algo).c_str(), value, sizeof(value) - 1);
+        if (n <= 0) return false;
+        value[n] = '\0';
+        std::string v(value), s = stamp(st);
+        if (v.compare(0, s.size(), s) != 0 || v.size() <= s.size() + 1) return false;
+        hex = v.substr(s.size() + 1);
+
+        std::lock_guard<std::mutex> lock(mtx);
+        remember(k, hex);
+        return true;
+    }
+
+    void store(int fd, const struct stat& st, HashAlgo algo, uint64_t start, uint64_t end,
+               const std::string& hex) {
+        std::lock_guard<std::mutex> lock(mtx);
+        remember(key(st, algo, start, end), hex);
+        if (start != 0 || end != static_cast<uint64_t>(st.st_size)) return;
+
+        std::string value = stamp(st) + " " + hex;
+        if (fsetxattr(fd, xattr_name(algo).c_str(), value.data(), value.size(), 0) == 0) return;
+        if (errno != ENOTSUP && errno != EPERM && errno != EACCES) return;
+
+        std::ofstream out(index_path, std::ios::app);
+        out << st.st_dev << " " << st.st_ino << " " << value.substr(0, value.find(' ')) << " "
+            << st.st_size << " " << hash_algo_name(algo) << " " << hex << "\n";
+    }
+};
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "fswatch.h"
+#include "sessionfs.h"
+
+#define MANIFEST_TOMBSTONE_MAX 65536 // 保留的删除记录数上限，超出后丢弃最旧的一半
+#define MANIFEST_SCAN_DEPTH 64       // 扫描目录树的最大深度
+
+// 服务器维护的文件清单：根目录下每个普通文件的大小、修改时间和摘要。
+// 每次变化分配一个递增的代号（generation），客户端记下上次同步到的代号，
+// SITE MANIFEST SINCE只取之后的变化，不必逐个目录LIST。
+// 启动时后台线程扫描整棵树并监视所有目录，之后按inotify事件增量更新，摘要在后台补算。
+// 清单只在内存中：代号从启动时的微秒时间戳起算，保证大于上次运行发出的代号，
+// 早于本次启动（或早于被丢弃的删除记录）的SINCE得到全量清单
+class Manifest {
+public:
+    // 计算摘要（十六进制），失败返回空串
+    using Hasher = std::function<std::string(int fd, const struct stat& st)>;
+
+    struct Entry {
+        std::string path;     // 相对根目录
+        uint64_t size = 0;
+        int64_t mtime = 0;    // 秒
+        std::string hash;     // 空表示尚未算出
+        uint64_t gen = 0;
+        bool deleted = false; // 删除记录
+    };
+
+    struct Stats {
+        uint64_t files = 0;
+        uint64_t tombstones = 0;
+        uint64_t generation = 0;
+        uint64_t pending_hashes = 0;
+        bool ready = false;
+    };
+
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    SessionFs fs;  // 只由工作线程使用
+    Hasher hasher;
+    std::map<std::string, Entry> files;  // 按路径排序，便于按目录前缀取区间
+    std::map<uint64_t, std::string> by_gen; // 代号 -> 路径，SINCE查询只遍历变化的部分
+    std::deque<std::pair<std::string, uint32_t>> events;
+    std::deque<std::string> to_hash;
+    uint64_t next_gen = 1;
+    uint64_t floor_gen = 0;  // 早于此代号的SINCE须返回全量
+    uint64_t tombstones = 0;
+    bool ready = false;
+
+    static bool under(const std::string& dir, const std::string& path) {
+        if (dir.empty()) return true;
+        return path.compare(0, dir.size(), dir) == 0 &&
+               (path.size() == dir.size() || path[dir.size()] == '/');
+    }
+
+    // 以下几个函数调用时已持有mtx
+    void bump(Entry& e) {
+        if (e.gen) by_gen.erase(e.gen);
+        e.gen = next_gen++;
+        by_gen[e.gen] = e.path;
+    }
+
+    void update(const std::string& rel, const struct stat& st) {
+        auto it = files.find(rel);
+        if (it == files.end()) {
+            it = files.emplace(rel, Entry()).first;
+            it->second.path = rel;
+        }
+        Entry& e = it->second;
+        if (!e.deleted && e.size == static_cast<uint64_t>(st.st_size) && e.mtime == st.st_mtime) return;
+        if (e.deleted) tombstones--;
+        e.deleted = false;
+        e.size = st.st_size;
+        e.mtime = st.st_mtime;
+        e.hash.clear();
+        bump(e);
+        to_hash.push_back(rel);
+    }
+
+    void remove(std::map<std::string, Entry>::iterator it) {
+        Entry& e = it->second;
+        if (e.deleted) return;
+        e.deleted = true;
+        e.hash.clear();
+        bump(e);
+        tombstones++;
+    }
+
+    // 删除记录过多时丢弃最旧的一半，之后更早的SINCE改为返回全量
+    void trim() {
+        if (tombstones <= MANIFEST_TOMBSTONE_MAX) return;
+        for (auto it = by_gen.begin(); it != by_gen.end() && tombstones > MANIFEST_TOMBSTONE_MAX / 2; ) {
+            auto f = files.find(it->second);
+            if (f == files.end() || !f->second.deleted) {
+                ++it;
+                continue;
+            }
+            floor_gen = it->first + 1;
+            files.erase(f);
+            it = by_gen.erase(it);
+            tombstones--;
+        }
+    }
+
+    // 把dir下不在seen中的条目标为删除
+    void remove_unseen(const std::string& dir, const std::map<std::string, bool>& seen) {
+        auto it = dir.empty() ? files.begin() : files.lower_bound(dir + "/");
+        for (; it != files.end() && under(dir, it->first); ++it)
+            if (!seen.count(it->first)) remove(it);
+        trim();
+    }
+
+    // 遍历dir（相对根目录），先监视再读目录，扫描期间发生的变化不会漏掉
+    void scan(const std::string& dir, int depth, std::map<std::string, bool>& seen) {
+        if (depth > MANIFEST_SCAN_DEPTH) return;
+        FsWatcher::instance().watch_dir(dir);
+        DIR* d = fs.open_dir("/" + dir);
+        if (!d) return;
+        std::vector<std::string> subdirs;
+        std::vector<std::pair<std::string, struct stat>> found;
+        while (struct dirent* ent = readdir(d)) {
+            std::string name = ent->d_name;
+            if (name == "." || name == "..") continue;
+            struct stat st;
+            if (fstatat(dirfd(d), name.c_str(), &st, AT_SYMLINK_NOFOLLOW) < 0) continue;
+            std::string rel = dir.empty() ? name : dir + "/" + name;
+            if (S_ISDIR(st.st_mode)) subdirs.push_back(rel);
+            else if (S_ISREG(st.st_mode) && !FsWatcher::is_temp_name(rel)) found.emplace_back(rel, st);
+        }
+        closedir(d);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (auto& f : found) {
+                update(f.first, f.second);
+                seen[f.first] = true;
+            }
+        }
+        for (auto& sub : subdirs) scan(sub, depth + 1, seen);
+    }
+
+    // 重新扫描dir并与清单对账（新出现的目录、事件队列溢出）
+    void rescan(const std::string& dir) {
+        std::map<std::string, bool> seen;
+        scan(dir, 0, seen);
+        std::lock_guard<std::mutex> lock(mtx);
+        remove_unseen(dir, seen);
+    }
+
+    // 重新查看单个文件
+    void restat(const std::string& rel) {
+        struct stat st;
+        std::string leaf;
+        DirRef dir = fs.parent("/" + rel, leaf);
+        bool exists = dir && fstatat(dir.get(), leaf.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0;
+        std::lock_guard<std::mutex> lock(mtx);
+        if (exists && S_ISREG(st.st_mode)) {
+            update(rel, st);
+            return;
+        }
+        auto it = files.find(rel);
+        if (it != files.end()) remove(it);
+        trim();
+    }
+
+    void handle(const std::string& rel, uint32_t mask) {
+        if (mask & IN_Q_OVERFLOW) {
+            rescan("");
+            return;
+        }
+        if (rel.empty()) return;
+        if (mask & (IN_DELETE_SELF | IN_MOVE_SELF)) return; // 由上级目录的DELETE/MOVED_FROM处理
+        if (mask & IN_ISDIR) {
+            if (mask & (IN_CREATE | IN_MOVED_TO)) {
+                rescan(rel);
+            } else if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+                std::lock_guard<std::mutex> lock(mtx);
+                remove_unseen(rel, {});
+            }
+            return;
+        }
+        if (!FsWatcher::is_temp_name(rel)) restat(rel);
+    }
+
+    // 补算一个文件的摘要；文件在计算期间又变了就留给下一次
+    void hash_one(const std::string& rel) {
+        int fd = fs.open_file("/" + rel, O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        std::string hex;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) hex = hasher(fd, st);
+        close(fd);
+        if (hex.empty()) return;
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = files.find(rel);
+        if (it == files.end()) return;
+        Entry& e = it->second;
+        if (!e.deleted && e.size == static_cast<uint64_t>(st.st_size) && e.mtime == st.st_mtime)
+            e.hash = hex;
+    }
+
+    void run() {
+        rescan("");
+        std::unique_lock<std::mutex> lock(mtx);
+        ready = true;
+        while (true) {
+            cv.wait(lock, [&] { return !events.empty() || (hasher && !to_hash.empty()); });
+            // 事件优先，空闲时才补算摘要
+            if (!events.empty()) {
+                auto ev = events.front();
+                events.pop_front();
+                lock.unlock();
+                handle(ev.first, ev.second);
+            } else {
+                std::string rel = to_hash.front();
+                to_hash.pop_front();
+                lock.unlock();
+                hash_one(rel);
+            }
+            lock.lock();
+        }
+    }
+
+public:
+    // 开始维护root_dir的清单；须在FsWatcher启动之后调用
+    bool start(const std::string& root_dir, Hasher h) {
+        if (!fs.init(root_dir)) return false;
+        hasher = std::move(h);
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        next_gen = std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+        floor_gen = next_gen;
+        FsWatcher::instance().add_listener([this](const std::string& rel, uint32_t mask) {
+            std::lock_guard<std::mutex> lock(mtx);
+            events.emplace_back(rel, mask);
+            cv.notify_one();
+        });
+        std::thread(&Manifest::run, this).detach(); // 随进程存在
+        return true;
+    }
+
+    // 取dir（相对根目录，""为整棵树）下代号大于since的变化；since早于保留的记录时返回全量（full为true，
+    // 只含现存文件）。current为当前最新代号，客户端下次以它作为since。初始扫描未完成时返回false
+    bool query(uint64_t since, const std::string& dir, std::vector<Entry>& out, bool& full,
+               uint64_t& current) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!ready) return false;
+        current = next_gen - 1;
+        full = since < floor_gen;
+        if (full) {
+            auto it = dir.empty() ? files.begin() : files.lower_bound(dir + "/");
+            for (; it != files.end() && under(dir, it->first); ++it)
+                if (!it->second.deleted) out.push_back(it->second);
+            return true;
+        }
+        for (auto it = by_gen.upper_bound(since); it != by_gen.end(); ++it) {
+            if (!under(dir, it->second)) continue;
+            auto f = files.find(it->second);
+            if (f != files.end()) out.push_back(f->second);
+        }
+        return true;
+    }
+
+    Stats stats() {
+        std::lock_guard<std::mutex> lock(mtx);
+        Stats s;
+        s.files = files.size() - tombstones;
+        s.tombstones = tombstones;
+        s.generation = next_gen - 1;
+        s.pending_hashes = to_hash.size();
+        s.ready = ready;
+        return s;
+    }
+};
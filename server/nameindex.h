@@ -0,0 +1,386 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <string_view>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "fswatch.h"
+#include "sessionfs.h"
+
+#define INDEX_SCAN_THREADS 8      // 启动时并行扫描目录的线程数上限
+#define INDEX_RECENT_MAX 65536    // 新增条目先放在小的有序表中，超过此数并入主表
+#define INDEX_NAME_MAX 65535      // 单个文件名的最大长度（节点中以16位保存）
+
+// 文件名索引（SITE FIND）：每个文件或目录一个12字节的节点（上级节点、名字在字符区中的位置和长度），
+// 名字只存一份；另有按名字排序的节点号数组，前缀查找和带字面前缀的通配符都是二分查找后顺序扫描一段。
+// 启动时多个线程并行扫描目录，之后按inotify事件增量维护：新增条目进入小的有序表，攒够后归并进主表；
+// 删除只做标记，已删除目录下的节点在输出路径时据祖先标记过滤，删除过多时整体重建
+class NameIndex {
+public:
+    struct Stats {
+        uint64_t entries = 0;   // 现存条目
+        uint64_t nodes = 0;     // 节点总数（含已删除）
+        uint64_t bytes = 0;     // 节点、名字和排序表占用的内存
+        bool ready = false;
+    };
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+    static constexpr uint16_t DIR_FLAG = 1;
+    static constexpr uint16_t DELETED_FLAG = 2;
+
+    struct Node {
+        uint32_t parent;
+        uint32_t name;   // names中的偏移
+        uint16_t len;
+        uint16_t flags;
+    };
+
+    // 一次完整扫描的结果，扫描在锁外进行，完成后整体换入
+    struct Table {
+        std::vector<Node> nodes;        // 0号为根目录
+        std::vector<char> names;
+        std::vector<uint32_t> sorted;   // 按名字排序的节点号（主表）
+        std::vector<uint32_t> recent;   // 主表之后新增的节点号（有序）
+        uint64_t deleted = 0;
+
+        std::string_view name(uint32_t id) const {
+            return std::string_view(names.data() + nodes[id].name, nodes[id].len);
+        }
+
+        uint32_t add(uint32_t parent, const std::string& leaf, bool dir) {
+            Node n{parent, static_cast<uint32_t>(names.size()), static_cast<uint16_t>(leaf.size()),
+                   static_cast<uint16_t>(dir ? DIR_FLAG : 0)};
+            names.insert(names.end(), leaf.begin(), leaf.end());
+            nodes.push_back(n);
+            return nodes.size() - 1;
+        }
+    };
+
+    std::shared_mutex mtx;   // 查询共享，修改独占
+    Table table;
+    bool ready = false;
+    std::string root;
+
+    std::mutex queue_mtx;
+    std::condition_variable queue_cv;
+    std::deque<std::pair<std::string, uint32_t>> events;
+
+    // 节点号按名字比较；与字符串比较时用于lower_bound/upper_bound
+    struct ByName {
+        const Table& t;
+        bool operator()(uint32_t a, uint32_t b) const { return t.name(a) < t.name(b); }
+        bool operator()(uint32_t a, std::string_view b) const { return t.name(a) < b; }
+        bool operator()(std::string_view a, uint32_t b) const { return a < t.name(b); }
+    };
+
+    // 在list（有序）中找名字以prefix开头的区间
+    static std::pair<std::vector<uint32_t>::const_iterator, std::vector<uint32_t>::const_iterator>
+    prefix_range(const Table& t, const std::vector<uint32_t>& list, std::string_view prefix) {
+        auto first = std::lower_bound(list.begin(), list.end(), prefix, ByName{t});
+        auto last = first;
+        while (last != list.end() && t.name(*last).compare(0, prefix.size(), prefix) == 0) ++last;
+        return {first, last};
+    }
+
+    // parent下名为leaf的现存节点
+    static uint32_t child(const Table& t, uint32_t parent, std::string_view leaf) {
+        for (auto* list : {&t.sorted, &t.recent}) {
+            auto range = std::equal_range(list->begin(), list->end(), leaf, ByName{t});
+            for (auto it = range.first; it != range.second; ++it) {
+                const Node& n = t.nodes[*it];
+                if (n.parent == parent && !(n.flags & DELETED_FLAG)) return *it;
+            }
+        }
+        return NONE;
+    }
+
+    // 相对根目录的路径对应的节点，不存在返回NONE
+    static uint32_t resolve(const Table& t, const std::string& rel) {
+        uint32_t id = 0;
+        size_t start = 0;
+        while (id != NONE && start < rel.size()) {
+            size_t slash = rel.find('/', start);
+            if (slash == std::string::npos) slash = rel.size();
+            id = child(t, id, std::string_view(rel).substr(start, slash - start));
+            start = slash + 1;
+        }
+        return id;
+    }
+
+    // 节点的完整路径（以/开头）；途中有已删除的祖先时返回false
+    static bool path_of(const Table& t, uint32_t id, std::string& out) {
+        std::vector<uint32_t> chain;
+        for (uint32_t cur = id; cur != 0; cur = t.nodes[cur].parent) {
+            if (t.nodes[cur].flags & DELETED_FLAG) return false;
+            chain.push_back(cur);
+        }
+        out.clear();
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            out += '/';
+            out += t.name(*it);
+        }
+        if (out.empty()) out = "/";
+        return true;
+    }
+
+    // 读取一个目录的条目（名字，是否目录），跳过上传临时文件
+    static bool read_dir(SessionFs& dirfs, const std::string& rel,
+                         std::vector<std::pair<std::string, bool>>& out) {
+        DIR* d = dirfs.open_dir("/" + rel);
+        if (!d) return false;
+        while (struct dirent* ent = readdir(d)) {
+            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+            size_t len = strlen(ent->d_name);
+            if (len > INDEX_NAME_MAX) continue;
+            std::string name(ent->d_name, len);
+            if (FsWatcher::is_temp_name(name)) continue;
+            bool dir = ent->d_type == DT_DIR;
+            if (ent->d_type == DT_UNKNOWN) {
+                struct stat st;
+                dir = fstatat(dirfd(d), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+            out.emplace_back(std::move(name), dir);
+        }
+        closedir(d);
+        return true;
+    }
+
+    // 多线程扫描根目录下parent_path对应的子树，节点加入t（parent为其节点号）
+    void scan_into(Table& t, uint32_t parent, const std::string& parent_path) {
+        std::mutex mtx_scan;
+        std::condition_variable cv;
+        std::deque<std::pair<uint32_t, std::string>> pending{{parent, parent_path}};
+        size_t busy = 0;
+        auto worker = [&] {
+            SessionFs dirfs;
+            if (!dirfs.init(root)) return;
+            std::unique_lock<std::mutex> lock(mtx_scan);
+            while (true) {
+                cv.wait(lock, [&] { return !pending.empty() || busy == 0; });
+                if (pending.empty()) return;
+                auto dir = pending.front();
+                pending.pop_front();
+                busy++;
+                lock.unlock();
+                // 先监视再读，读目录期间的变化由事件补上
+                FsWatcher::instance().watch_dir(dir.second);
+                std::vector<std::pair<std::string, bool>> entries;
+                read_dir(dirfs, dir.second, entries);
+                lock.lock();
+                for (auto& e : entries) {
+                    uint32_t id = t.add(dir.first, e.first, e.second);
+                    if (e.second) pending.emplace_back(id, dir.second.empty() ? e.first : dir.second + "/" + e.first);
+                }
+                busy--;
+                cv.notify_all();
+            }
+        };
+        size_t n = std::min<size_t>(INDEX_SCAN_THREADS, std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < n; i++) threads.emplace_back(worker);
+        for (auto& th : threads) th.join();
+    }
+
+    // 分段并行排序后两两归并
+    static void parallel_sort(const Table& t, std::vector<uint32_t>& ids) {
+        size_t parts = std::min<size_t>(INDEX_SCAN_THREADS, std::max(1u, std::thread::hardware_concurrency()));
+        if (ids.size() < 65536) parts = 1;
+        std::vector<size_t> bounds;
+        for (size_t i = 0; i <= parts; i++) bounds.push_back(ids.size() * i / parts);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < parts; i++)
+            threads.emplace_back([&, i] { std::sort(ids.begin() + bounds[i], ids.begin() + bounds[i + 1], ByName{t}); });
+        for (auto& th : threads) th.join();
+        for (size_t width = 1; width < parts; width *= 2)
+            for (size_t i = 0; i + width < parts; i += 2 * width)
+                std::inplace_merge(ids.begin() + bounds[i], ids.begin() + bounds[i + width],
+                                   ids.begin() + bounds[std::min(i + 2 * width, parts)], ByName{t});
+    }
+
+    // 从头建立索引后换入（启动、事件队列溢出、删除标记过多）
+    void rebuild() {
+        Table t;
+        t.nodes.push_back(Node{NONE, 0, 0, DIR_FLAG});
+        scan_into(t, 0, "");
+        for (uint32_t id = 1; id < t.nodes.size(); id++) t.sorted.push_back(id);
+        parallel_sort(t, t.sorted);
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        table = std::move(t);
+        ready = true;
+    }
+
+    // 以下修改函数调用时已持有独占锁
+    void insert_recent(uint32_t id) {
+        auto pos = std::upper_bound(table.recent.begin(), table.recent.end(), id, ByName{table});
+        table.recent.insert(pos, id);
+        if (table.recent.size() < INDEX_RECENT_MAX) return;
+        // 归并进主表，顺便去掉已删除的节点
+        std::vector<uint32_t> merged;
+        merged.reserve(table.sorted.size() + table.recent.size());
+        auto alive = [&](uint32_t n) { return !(table.nodes[n].flags & DELETED_FLAG); };
+        std::merge(table.sorted.begin(), table.sorted.end(), table.recent.begin(), table.recent.end(),
+                   std::back_inserter(merged), ByName{table});
+        merged.erase(std::remove_if(merged.begin(), merged.end(), [&](uint32_t n) { return !alive(n); }),
+                     merged.end());
+        table.sorted.swap(merged);
+        table.recent.clear();
+    }
+
+    // 新增rel（已存在则忽略），返回节点号；上级目录不在索引中时返回NONE
+    uint32_t add_path(const std::string& rel, bool dir) {
+        size_t slash = rel.rfind('/');
+        std::string leaf = slash == std::string::npos ? rel : rel.substr(slash + 1);
+        if (leaf.size() > INDEX_NAME_MAX || table.nodes.size() >= NONE - 1) return NONE;
+        uint32_t parent = slash == std::string::npos ? 0 : resolve(table, rel.substr(0, slash));
+        if (parent == NONE) return NONE;
+        uint32_t id = child(table, parent, leaf);
+        if (id != NONE) {
+            // 同名的文件被目录替换（或相反）
+            if (!(table.nodes[id].flags & DIR_FLAG) == !dir) return id;
+            table.nodes[id].flags |= DELETED_FLAG;
+            table.deleted++;
+        }
+        id = table.add(parent, leaf, dir);
+        insert_recent(id);
+        return id;
+    }
+
+    void remove_path(const std::string& rel) {
+        uint32_t id = resolve(table, rel);
+        if (id == NONE || id == 0) return;
+        table.nodes[id].flags |= DELETED_FLAG;
+        table.deleted++;
+    }
+
+    void handle(const std::string& rel, uint32_t mask) {
+        if (mask & IN_Q_OVERFLOW) {
+            rebuild();
+            return;
+        }
+        if (rel.empty() || (mask & (IN_DELETE_SELF | IN_MOVE_SELF)) || FsWatcher::is_temp_name(rel)) return;
+        bool dir = mask & IN_ISDIR;
+        if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+            bool compact;
+            {
+                std::unique_lock<std::shared_mutex> lock(mtx);
+                remove_path(rel);
+                compact = table.deleted > INDEX_RECENT_MAX && table.deleted * 2 > table.nodes.size();
+            }
+            // 删除标记超过一半时重建，回收节点和名字占用的空间
+            if (compact) rebuild();
+            return;
+        }
+        if (!(mask & (IN_CREATE | IN_MOVED_TO))) return;
+        uint32_t id;
+        {
+            std::unique_lock<std::shared_mutex> lock(mtx);
+            id = add_path(rel, dir);
+        }
+        // 移入或新建的目录可能已有内容（mkdir -p、mv），扫描其子树后合并
+        if (!dir || id == NONE) return;
+        Table sub;
+        sub.nodes.push_back(Node{NONE, 0, 0, DIR_FLAG});
+        scan_into(sub, 0, rel);
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        std::vector<uint32_t> remap(sub.nodes.size(), id);
+        for (uint32_t i = 1; i < sub.nodes.size(); i++) {
+            const Node& n = sub.nodes[i];
+            std::string leaf(sub.name(i));
+            remap[i] = child(table, remap[n.parent], leaf);
+            if (remap[i] != NONE) continue;
+            remap[i] = table.add(remap[n.parent], leaf, n.flags & DIR_FLAG);
+            insert_recent(remap[i]);
+        }
+    }
+
+    void run() {
+        rebuild();
+        std::unique_lock<std::mutex> lock(queue_mtx);
+        while (true) {
+            queue_cv.wait(lock, [&] { return !events.empty(); });
+            auto ev = events.front();
+            events.pop_front();
+            lock.unlock();
+            handle(ev.first, ev.second);
+            lock.lock();
+        }
+    }
+
+public:
+    // 开始为root_dir建立索引；须在FsWatcher启动之后调用
+    void start(const std::string& root_dir) {
+        root = root_dir;
+        FsWatcher::instance().add_listener([this](const std::string& rel, uint32_t mask) {
+            if (!(mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_Q_OVERFLOW))) return;
+            std::lock_guard<std::mutex> lock(queue_mtx);
+            events.emplace_back(rel, mask);
+            queue_cv.notify_one();
+        });
+        std::thread(&NameIndex::run, this).detach(); // 随进程存在
+    }
+
+    // 查找名字匹配pattern的文件和目录，结果为以/开头的路径（目录以/结尾），最多limit个。
+    // pattern不含通配符时按名字前缀匹配；含/时名字部分用于查索引，整个pattern再与完整路径匹配。
+    // dir非空时只返回该目录（相对根目录）之下的条目。索引尚未建好时返回false
+    bool find(const std::string& pattern, const std::string& dir, size_t limit,
+              std::vector<std::string>& out, bool& truncated) {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        if (!ready) return false;
+        truncated = false;
+        size_t slash = pattern.rfind('/');
+        std::string leaf = slash == std::string::npos ? pattern : pattern.substr(slash + 1);
+        size_t wild = leaf.find_first_of("*?[\\");
+        std::string literal = leaf.substr(0, wild);
+        std::string leaf_glob = wild == std::string::npos ? leaf + "*" : leaf;
+        std::string path_glob = slash == std::string::npos ? "" :
+                                (pattern[0] == '/' ? pattern : "*/" + pattern);
+        if (!path_glob.empty() && wild == std::string::npos) path_glob += "*";
+        std::string scope = dir.empty() ? "" : "/" + dir + "/";
+
+        std::string path;
+        for (auto* list : {&table.sorted, &table.recent}) {
+            auto range = prefix_range(table, *list, literal);
+            for (auto it = range.first; it != range.second; ++it) {
+                const Node& n = table.nodes[*it];
+                if (n.flags & DELETED_FLAG) continue;
+                std::string name(table.name(*it));
+                if (wild != std::string::npos && fnmatch(leaf_glob.c_str(), name.c_str(), 0) != 0) continue;
+                if (!path_of(table, *it, path)) continue;
+                if (!scope.empty() && path.compare(0, scope.size(), scope) != 0) continue;
+                if (!path_glob.empty() && fnmatch(path_glob.c_str(), path.c_str(), 0) != 0) continue;
+                if (out.size() >= limit) {
+                    truncated = true;
+                    return true;
+                }
+                if (n.flags & DIR_FLAG) path += '/';
+                out.push_back(path);
+            }
+        }
+        return true;
+    }
+
+    Stats stats() {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        Stats s;
+        s.ready = ready;
+        s.nodes = table.nodes.size();
+        s.entries = table.nodes.empty() ? 0 : table.nodes.size() - 1 - table.deleted;
+        s.bytes = table.nodes.capacity() * sizeof(Node) + table.names.capacity() +
+                  (table.sorted.capacity() + table.recent.capacity()) * sizeof(uint32_t);
+        return s;
+    }
+};
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+
+// 令牌桶（字节/秒），rate为0表示不限速
+// 采用"欠账"模型：取令牌时直接扣减，余额为负则返回需要等待的时间
+class TokenBucket {
+private:
+    std::mutex mtx;
+    double rate_ = 0;       // 每秒补充的令牌数
+    double burst_ = 0;      // 桶容量
+    double tokens_ = 0;     // 当前令牌数（可为负）
+    std::chrono::steady_clock::time_point last_ = std::chrono::steady_clock::now();
+
+    void refill(std::chrono::steady_clock::time_point now) {
+        double elapsed = std::chrono::duration<double>(now - last_).count();
+        last_ = now;
+        tokens_ = std::min(burst_, tokens_ + elapsed * rate_);
+    }
+
+public:
+    explicit TokenBucket(uint64_t rate = 0, uint64_t burst = 0) { set_rate(rate, burst); }
+
+    // 运行时调整速率，burst为0时默认取1/4秒的流量（至少64KB）
+    void set_rate(uint64_t rate, uint64_t burst = 0) {
+        std::lock_guard<std::mutex> lock(mtx);
+        rate_ = static_cast<double>(rate);
+        burst_ = burst ? static_cast<double>(burst)
+                       : std::max(rate_ / 4, 64.0 * 1024);
+        tokens_ = std::min(tokens_, burst_);
+        last_ = std::chrono::steady_clock::now();
+    }
+
+    uint64_t rate() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return static_cast<uint64_t>(rate_);
+    }
+
+    // 取n个令牌，返回调用者需要等待的时间
+    std::chrono::nanoseconds reserve(size_t n) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (rate_ <= 0) return std::chrono::nanoseconds(0);
+        refill(std::chrono::steady_clock::now());
+        tokens_ -= static_cast<double>(n);
+        if (tokens_ >= 0) return std::chrono::nanoseconds(0);
+        return std::chrono::nanoseconds(static_cast<int64_t>(-tokens_ / rate_ * 1e9));
+    }
+};
+
+// 吞吐量统计：累计字节数 + 指数滑动平均速率
+class RateMeter {
+private:
+    std::mutex mtx;
+    std::atomic<uint64_t> total_{0};
+    uint64_t window_bytes_ = 0;
+    double rate_ = 0;
+    std::chrono::steady_clock::time_point window_start_ = std::chrono::steady_clock::now();
+
+    static constexpr double WINDOW = 0.5; // 采样窗口（秒）
+
+    void roll(std::chrono::steady_clock::time_point now) {
+        double elapsed = std::chrono::duration<double>(now - window_start_).count();
+        if (elapsed < WINDOW) return;
+        double sample = window_bytes_ / elapsed;
+        // 长时间空闲时直接衰减到本次采样值
+        rate_ = elapsed > 4 * WINDOW ? sample : rate_ * 0.5 + sample * 0.5;
+        window_bytes_ = 0;
+        window_start_ = now;
+    }
+
+public:
+    void add(size_t n) {
+        total_ += n;
+        std::lock_guard<std::mutex> lock(mtx);
+        window_bytes_ += n;
+        roll(std::chrono::steady_clock::now());
+    }
+
+    uint64_t total() const { return total_; }
+
+    // 当前速率（字节/秒）
+    double rate() {
+        std::lock_guard<std::mutex> lock(mtx);
+        roll(std::chrono::steady_clock::now());
+        return rate_;
+    }
+};
+
+// 限速器：全局桶 + 用户类别桶，会话桶由会话自己持有
+class RateLimiter {
+private:
+    TokenBucket global_;
+    std::mutex mtx;
+    std::unordered_map<std::string, std::shared_ptr<TokenBucket>> class_buckets;
+    std::unordered_map<std::string, std::string> user_classes; // 用户名 -> 类别
+
+public:
+    TokenBucket& global() { return global_; }
+
+    // 获取（必要时创建）某个类别的令牌桶
+    std::shared_ptr<TokenBucket> class_bucket(const std::string& cls) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& bucket = class_buckets[cls];
+        if (!bucket) bucket = std::make_shared<TokenBucket>();
+        return bucket;
+    }
+
+    void set_user_class(const std::string& user, const std::string& cls) {
+        std::lock_guard<std::mutex> lock(mtx);
+        user_classes[user] = cls;
+    }
+
+    // 未指定类别的用户归入default
+    std::string user_class(const std::string& user) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = user_classes.find(user);
+        return it == user_classes.end() ? "default" : it->second;
+    }
+
+    std::unordered_map<std::string, uint64_t> class_rates() {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::unordered_map<std::string, uint64_t> rates;
+        for (auto& kv : class_buckets) rates[kv.first] = kv.second->rate();
+        return rates;
+    }
+
+    // 依次向会话、类别、全局三级桶取令牌，返回需要等待的最长时间
+    std::chrono::nanoseconds reserve(TokenBucket& session, TokenBucket* cls, size_t n) {
+        auto wait = session.reserve(n);
+        if (cls) wait = std::max(wait, cls->reserve(n));
+        return std::max(wait, global_.reserve(n));
+    }
+
+    // 分片休眠以便stop()为真时尽快返回
+    template <typename Stop>
+    static void sleep_for(std::chrono::nanoseconds wait, Stop stop) {
+        auto deadline = std::chrono::steady_clock::now() + wait;
+        while (!stop()) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) break;
+            std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(
+                deadline - now, std::chrono::milliseconds(100)));
+        }
+    }
+};
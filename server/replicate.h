@@ -0,0 +1,336 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <sys/stat.h>
+#include "sessionfs.h"
+#include "durability.h"
+
+#define REPLICA_MAX 4                  // 每个前缀最多的副本目录数
+#define REPLICA_PIPE_SIZE (256 * 1024) // tee/splice所用管道的容量
+
+// 副本位置：服务器配置中允许的副本根目录，加上根目录下的相对路径
+struct ReplicaTarget {
+    std::string root;
+    std::string path;
+
+    std::string display() const { return path.empty() ? root : root + "/" + path; }
+};
+
+// 上传复制策略：路径前缀 -> 副本目录
+// 副本目录只能位于服务器配置文件列出的副本根目录（例如备份盘的挂载点）之下，
+// 之后的打开和创建都相对根目录fd用openat2(RESOLVE_BENEATH)解析，不会越出根目录。
+// 取最长匹配的前缀（按路径分量匹配，""匹配所有路径），文件在前缀之下的相对路径保持不变
+class ReplicationTable {
+private:
+    std::mutex mtx;
+    std::vector<std::string> roots;
+    std::vector<std::pair<std::string, std::vector<ReplicaTarget>>> rules;
+
+    static bool matches(const std::string& prefix, const std::string& path) {
+        if (prefix.empty()) return true;
+        return path.compare(0, prefix.size(), prefix) == 0 &&
+               (path.size() == prefix.size() || path[prefix.size()] == '/');
+    }
+
+public:
+    // 启动时登记配置文件中的副本根目录（绝对路径）；目录不存在时返回false
+    bool allow_root(std::string root) {
+        while (root.size() > 1 && root.back() == '/') root.pop_back();
+        SessionFs fs;
+        if (root.empty() || root[0] != '/' || !fs.init(root)) return false;
+        std::lock_guard<std::mutex> lock(mtx);
+        roots.push_back(root);
+        return true;
+    }
+
+    // 把客户端给出的绝对路径对应到某个副本根目录之下；不在任何根目录下，或不是已有目录时返回false
+    bool resolve(const std::string& dir, ReplicaTarget& out) {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& root : roots) {
+            std::string sub;
+            if (dir == root) sub = "";
+            else if (root == "/") sub = dir.substr(1);
+            else if (matches(root, dir)) sub = dir.substr(root.size() + 1);
+            else continue;
+            // ".."越过根目录时normalize失败，符号链接由openat2限制在根目录内
+            SessionFs fs;
+            std::string rel;
+            if (!fs.init(root) || !fs.normalize("/" + sub, rel)) return false;
+            int fd = fs.open_file(rel, O_PATH | O_DIRECTORY);
+            if (fd < 0) return false;
+            close(fd);
+            out.root = root;
+            out.path = rel;
+            return true;
+        }
+        return false;
+    }
+
+    // rel为相对根目录的文件路径，返回各副本的位置
+    std::vector<ReplicaTarget> targets(const std::string& rel) {
+        std::lock_guard<std::mutex> lock(mtx);
+        const std::pair<std::string, std::vector<ReplicaTarget>>* best = nullptr;
+        for (auto& r : rules)
+            if (matches(r.first, rel) && (!best || r.first.size() > best->first.size())) best = &r;
+        std::vector<ReplicaTarget> out;
+        if (!best) return out;
+        // 前缀本身就是这个文件时，副本放在目录下同名文件
+        std::string suffix;
+        if (best->first.empty()) suffix = rel;
+        else if (rel.size() == best->first.size()) suffix = rel.substr(rel.rfind('/') + 1);
+        else suffix = rel.substr(best->first.size() + 1);
+        for (auto& t : best->second)
+            out.push_back({t.root, t.path.empty() ? suffix : t.path + "/" + suffix});
+        return out;
+    }
+
+    void set(const std::string& prefix, const std::vector<ReplicaTarget>& dirs) {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& r : rules) {
+            if (r.first == prefix) {
+                r.second = dirs;
+                return;
+            }
+        }
+        rules.emplace_back(prefix, dirs);
+    }
+
+    bool remove(const std::string& prefix) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = std::find_if(rules.begin(), rules.end(),
+                               [&](const std::pair<std::string, std::vector<ReplicaTarget>>& r) {
+                                   return r.first == prefix;
+                               });
+        if (it == rules.end()) return false;
+        rules.erase(it);
+        return true;
+    }
+
+    std::vector<std::pair<std::string, std::vector<ReplicaTarget>>> list() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return rules;
+    }
+
+    std::vector<std::string> allowed_roots() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return roots;
+    }
+};
+
+// 一次上传的所有副本
+// 内核路径：socket数据先splice进输入管道，tee到每个副本自己的管道再splice进副本文件，
+// 最后输入管道splice进主文件，数据不进入用户态；tee只复制了一部分时（副本管道较小），
+// 缺的部分在主文件写完后用copy_file_range从主文件补上
+// 缓冲路径（MODE Z、稀疏、O_DIRECT等需要在用户态处理数据的上传）：按偏移pwrite到每个副本
+// 每个副本先写到同目录的临时文件 .<name>.<id>.part，主文件发布后再落盘并rename替换，
+// 副本目录中原有的版本在新副本完整落盘之前保持不变。单个副本失败只记录错误，
+// 删除它的临时文件，不影响主文件和其他副本
+class ReplicaSet {
+public:
+    struct Replica {
+        std::string path;              // 显示用的绝对路径
+        std::unique_ptr<SessionFs> fs; // 以副本根目录为根
+        std::string rel;               // 根目录下的相对路径
+        std::string part;              // 临时文件的相对路径
+        int fd = -1;
+        int pipe[2] = {-1, -1};
+        uint64_t tee_bytes = 0;    // 经tee/splice写入的字节
+        uint64_t copy_bytes = 0;   // 经缓冲写入或从主文件补齐的字节
+        uint64_t gap_off = 0;      // 待从主文件补齐的区间
+        uint64_t gap_len = 0;
+        int error = 0;
+    };
+
+private:
+    std::vector<Replica> reps;
+
+    static void close_pipe(Replica& r) {
+        for (int& p : r.pipe) {
+            if (p >= 0) close(p);
+            p = -1;
+        }
+    }
+
+    static void fail(Replica& r, int err) {
+        if (!r.error) r.error = err ? err : EIO;
+        close_pipe(r);
+    }
+
+    // 在副本根目录下逐级创建rel的上级目录，每一级都相对根目录fd解析
+    static void make_parents(SessionFs& fs, const std::string& rel) {
+        for (size_t pos = rel.find('/'); pos != std::string::npos; pos = rel.find('/', pos + 1)) {
+            std::string leaf;
+            DirRef dir = fs.parent(rel.substr(0, pos), leaf);
+            if (dir) mkdirat(dir.get(), leaf.c_str(), 0777);
+        }
+    }
+
+    static std::string part_name(const std::string& rel) {
+        static std::atomic<uint64_t> seq{0};
+        size_t slash = rel.rfind('/');
+        std::string dir = slash == std::string::npos ? "" : rel.substr(0, slash + 1);
+        std::string leaf = slash == std::string::npos ? rel : rel.substr(slash + 1);
+        return dir + "." + leaf + "." + std::to_string(getpid()) + "-" + std::to_string(++seq) + ".part";
+    }
+
+    static bool pwrite_all(int fd, const char* data, size_t len, uint64_t offset) {
+        for (size_t done = 0; done < len; ) {
+            ssize_t n = pwrite(fd, data + done, len - done, offset + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                if (n == 0) errno = EIO;
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+public:
+    // size为ALLO预告的大小（未知为0），用于预分配副本空间
+    ReplicaSet(const std::vector<ReplicaTarget>& targets, uint64_t size) {
+        for (auto& t : targets) {
+            reps.emplace_back();
+            Replica& r = reps.back();
+            r.path = t.display();
+            r.rel = t.path;
+            r.part = part_name(t.path);
+            r.fs.reset(new SessionFs());
+            if (!r.fs->init(t.root)) {
+                r.error = errno ? errno : ENOENT;
+                continue;
+            }
+            make_parents(*r.fs, r.rel);
+            r.fd = r.fs->open_file(r.part, O_WRONLY | O_CREAT | O_EXCL, 0644);
+            if (r.fd < 0) r.error = errno;
+            else if (size && fallocate(r.fd, 0, 0, size) < 0 && (errno == ENOSPC || errno == EDQUOT))
+                r.error = errno;
+        }
+    }
+
+    ~ReplicaSet() {
+        for (auto& r : reps) {
+            close_pipe(r);
+            if (r.fd >= 0) close(r.fd);
+        }
+    }
+
+    ReplicaSet(const ReplicaSet&) = delete;
+    ReplicaSet& operator=(const ReplicaSet&) = delete;
+
+    // 为内核路径准备每个副本的管道；管道不可用时返回false，调用方改用缓冲路径
+    bool prepare_pipes() {
+        for (auto& r : reps) {
+            if (r.error) continue;
+            if (pipe2(r.pipe, O_CLOEXEC) < 0) return false;
+            fcntl(r.pipe[1], F_SETPIPE_SZ, REPLICA_PIPE_SIZE);
+        }
+        return true;
+    }
+
+    // 把输入管道中的len字节（对应文件偏移offset）复制到各副本，不从输入管道取走数据
+    void tee(int in_pipe, size_t len, uint64_t offset) {
+        for (auto& r : reps) {
+            if (r.error) continue;
+            ssize_t n;
+            while ((n = ::tee(in_pipe, r.pipe[1], len, 0)) < 0 && errno == EINTR) {}
+            size_t copied = n > 0 ? n : 0;
+            loff_t out = offset;
+            for (size_t left = copied; left > 0; ) {
+                ssize_t m = splice(r.pipe[0], nullptr, r.fd, &out, left, SPLICE_F_MOVE);
+                if (m < 0 && errno == EINTR) continue;
+                if (m <= 0) {
+                    fail(r, m < 0 ? errno : EIO);
+                    break;
+                }
+                left -= m;
+            }
+            if (r.error) continue;
+            r.tee_bytes += copied;
+            r.gap_off = offset + copied;
+            r.gap_len = len - copied;
+        }
+    }
+
+    // 从主文件复制[offset, offset + len)到副本
+    static bool copy_from(int primary, Replica& r, uint64_t offset, uint64_t len) {
+        loff_t in = offset, out = offset;
+        while (len > 0) {
+            ssize_t n = copy_file_range(primary, &in, r.fd, &out, len, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                fail(r, n < 0 ? errno : EIO);
+                return false;
+            }
+            len -= n;
+            r.copy_bytes += n;
+        }
+        return true;
+    }
+
+    // 主文件写完这一块后，补齐tee未能复制的部分
+    void catch_up(int primary) {
+        for (auto& r : reps) {
+            if (r.error || !r.gap_len) continue;
+            if (copy_from(primary, r, r.gap_off, r.gap_len)) r.gap_len = 0;
+        }
+    }
+
+    // 续传：先把主文件中已有的前len字节复制到各副本
+    void seed(int primary, uint64_t len) {
+        for (auto& r : reps)
+            if (!r.error) copy_from(primary, r, 0, len);
+    }
+
+    // 缓冲路径：把用户态的数据写到各副本的对应偏移
+    void write_at(uint64_t offset, const char* data, size_t len) {
+        for (auto& r : reps) {
+            if (r.error) continue;
+            if (!pwrite_all(r.fd, data, len, offset)) fail(r, errno);
+            else r.copy_bytes += len;
+        }
+    }
+
+    // 上传结束：成功时把副本截断到主文件的长度（去掉预分配的多余部分），经durability落盘后
+    // rename替换副本目录中的旧版本，再同步目录项；失败时只删除临时文件
+    void finish(uint64_t size, bool ok, DurabilityManager& durability) {
+        for (auto& r : reps) {
+            close_pipe(r);
+            if (r.fd < 0) continue; // 没能创建的副本
+            bool published = false;
+            if (ok && !r.error) {
+                std::string part_leaf, leaf;
+                DirRef part_dir = r.fs->parent(r.part, part_leaf);
+                DirRef dir = r.fs->parent(r.rel, leaf);
+                int err;
+                if (ftruncate(r.fd, size) < 0) r.error = errno;
+                else if ((err = durability.commit(r.fd, -1)) != 0) r.error = err;
+                else if (!part_dir || !dir ||
+                         renameat(part_dir.get(), part_leaf.c_str(), dir.get(), leaf.c_str()) < 0)
+                    r.error = errno ? errno : EIO;
+                else {
+                    published = true;
+                    if ((err = durability.commit(r.fd, dir.get())) != 0) r.error = err;
+                }
+            }
+            if (close(r.fd) < 0 && !r.error) r.error = errno;
+            r.fd = -1;
+            if (!published) {
+                std::string part_leaf;
+                DirRef part_dir = r.fs->parent(r.part, part_leaf);
+                if (part_dir) unlinkat(part_dir.get(), part_leaf.c_str(), 0);
+            }
+        }
+    }
+
+    const std::vector<Replica>& replicas() const { return reps; }
+};
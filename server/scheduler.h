@@ -0,0 +1,223 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+
+#define SCHED_WRITE_TIMEOUT_MS 60000 // 数据连接持续不可写超过该时间视为传输失败
+
+// 传输调度器：加权差额轮询（Deficit Round Robin）
+// 每个活动的数据连接是一个流，每轮获得 quantum * weight 字节的额度，
+// 同一时刻最多slots个流持有发送许可，其余流按轮询顺序排队
+class TransferScheduler {
+public:
+    struct Flow {
+        uint32_t weight = 1;
+        size_t deficit = 0;     // 本轮剩余额度
+        size_t want = 0;        // 本次申请的字节数
+        size_t granted = 0;     // 已授予但未归还的字节数
+        bool queued = false;    // 是否在就绪队列中
+        bool ready = false;     // 许可已下发
+        std::condition_variable cv;
+        std::chrono::steady_clock::time_point enqueued;
+
+        // 排队时延统计（微秒）
+        uint64_t grants = 0;
+        uint64_t last_wait_us = 0;
+        uint64_t total_wait_us = 0;
+    };
+
+    struct Stats {
+        size_t flows = 0;       // 活动流数
+        size_t queued = 0;      // 排队等待的流数
+        size_t busy = 0;        // 持有许可的流数
+        size_t slots = 0;
+        size_t quantum = 0;
+        uint64_t grants = 0;
+        uint64_t total_wait_us = 0;
+        uint64_t max_wait_us = 0;
+    };
+
+private:
+    std::mutex mtx;
+    std::deque<Flow*> ready_queue;
+    size_t quantum_;
+    size_t slots_;
+    size_t busy_ = 0;
+    size_t flows_ = 0;
+    uint64_t grants_ = 0;
+    uint64_t total_wait_us_ = 0;
+    uint64_t max_wait_us_ = 0;
+
+    // 在有空闲许可时按DRR顺序下发
+    void dispatch() {
+        while (busy_ < slots_ && !ready_queue.empty()) {
+            Flow* f = ready_queue.front();
+            ready_queue.pop_front();
+            f->queued = false;
+
+            // 新一轮开始：补充额度
+            if (f->deficit == 0) f->deficit = quantum_ * f->weight;
+            f->granted = std::min(f->want, f->deficit);
+            f->deficit -= f->granted;
+
+            auto now = std::chrono::steady_clock::now();
+            uint64_t wait = std::chrono::duration_cast<std::chrono::microseconds>(
+                now - f->enqueued).count();
+            f->grants++;
+            f->last_wait_us = wait;
+            f->total_wait_us += wait;
+            grants_++;
+            total_wait_us_ += wait;
+            max_wait_us_ = std::max(max_wait_us_, wait);
+
+            busy_++;
+            f->ready = true;
+            f->cv.notify_one();
+        }
+    }
+
+public:
+    explicit TransferScheduler(size_t quantum = 64 * 1024, size_t slots = 4)
+        : quantum_(quantum), slots_(slots) {}
+
+    std::shared_ptr<Flow> open(uint32_t weight) {
+        auto f = std::make_shared<Flow>();
+        f->weight = std::max<uint32_t>(weight, 1);
+        std::lock_guard<std::mutex> lock(mtx);
+        flows_++;
+        return f;
+    }
+
+    // 申请发送want字节，阻塞到轮到该流，返回实际授予的字节数
+    size_t acquire(Flow& f, size_t want) {
+        std::unique_lock<std::mutex> lock(mtx);
+        f.want = std::max<size_t>(want, 1);
+        f.ready = false;
+        f.queued = true;
+        f.enqueued = std::chrono::steady_clock::now();
+        // 本轮额度未用完的流继续占据队首，否则排到队尾
+        if (f.deficit > 0) ready_queue.push_front(&f);
+        else ready_queue.push_back(&f);
+        dispatch();
+        f.cv.wait(lock, [&] { return f.ready; });
+        return f.granted;
+    }
+
+    // 归还许可，未用完的字节退回本轮额度
+    void release(Flow& f, size_t used) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!f.ready) return;
+        f.deficit += f.granted - std::min(used, f.granted);
+        f.granted = 0;
+        f.ready = false;
+        busy_--;
+        dispatch();
+    }
+
+    void close(Flow& f) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (f.ready) {
+            f.ready = false;
+            busy_--;
+        }
+        if (f.queued) {
+            ready_queue.erase(std::find(ready_queue.begin(), ready_queue.end(), &f));
+            f.queued = false;
+        }
+        flows_--;
+        dispatch();
+    }
+
+    void set_quantum(size_t quantum) {
+        std::lock_guard<std::mutex> lock(mtx);
+        quantum_ = std::max<size_t>(quantum, 1024);
+    }
+
+    void set_slots(size_t slots) {
+        std::lock_guard<std::mutex> lock(mtx);
+        slots_ = std::max<size_t>(slots, 1);
+        dispatch();
+    }
+
+    Stats stats() {
+        std::lock_guard<std::mutex> lock(mtx);
+        Stats s;
+        s.flows = flows_;
+        s.queued = ready_queue.size();
+        s.busy = busy_;
+        s.slots = slots_;
+        s.quantum = quantum_;
+        s.grants = grants_;
+        s.total_wait_us = total_wait_us_;
+        s.max_wait_us = max_wait_us_;
+        return s;
+    }
+};
+
+// 单个传输的调度句柄（RAII）。许可只覆盖一次不阻塞的发送：先在不持有许可时等数据连接可写，
+// 再按DRR顺序取得许可，发送返回后立即用charge()按实际字节扣额度并归还。
+// 对端不收数据时只有这个流在等待，不会占着发送名额卡住其他传输
+class ScheduledTransfer {
+private:
+    TransferScheduler& sched;
+    std::shared_ptr<TransferScheduler::Flow> flow;
+    int sock;
+    int sock_flags = -1; // 构造前的文件状态标志，析构时恢复
+    size_t granted = 0;  // 当前许可的字节数，0表示未持有许可
+
+    bool wait_writable() {
+        struct pollfd p{sock, POLLOUT, 0};
+        while (true) {
+            int r = poll(&p, 1, SCHED_WRITE_TIMEOUT_MS);
+            if (r > 0) return true; // 出错或对端关闭也返回，交给随后的发送报告
+            if (r == 0) {
+                errno = ETIMEDOUT;
+                return false;
+            }
+            if (errno != EINTR) return false;
+        }
+    }
+
+public:
+    // sock为数据连接，存在期间设为非阻塞；发送返回EAGAIN时重新调用next()等待
+    ScheduledTransfer(TransferScheduler& s, uint32_t weight, int sock = -1)
+        : sched(s), flow(s.open(weight)), sock(sock) {
+        if (sock >= 0 && (sock_flags = fcntl(sock, F_GETFL)) >= 0)
+            fcntl(sock, F_SETFL, sock_flags | O_NONBLOCK);
+    }
+
+    ~ScheduledTransfer() {
+        sched.close(*flow);
+        if (sock_flags >= 0) fcntl(sock, F_SETFL, sock_flags);
+    }
+
+    ScheduledTransfer(const ScheduledTransfer&) = delete;
+    ScheduledTransfer& operator=(const ScheduledTransfer&) = delete;
+
+    // 申请最多n字节的发送额度；数据连接超时仍不可写时返回0，errno为ETIMEDOUT
+    size_t next(size_t n) {
+        yield();
+        if (sock >= 0 && !wait_writable()) return 0;
+        granted = sched.acquire(*flow, n);
+        return granted;
+    }
+
+    // 本次发送结束，按实际发送的字节扣本轮额度，归还许可
+    void charge(size_t used) {
+        if (granted == 0) return;
+        sched.release(*flow, used);
+        granted = 0;
+    }
+
+    // 未发送就放弃许可
+    void yield() { charge(0); }
+
+    const TransferScheduler::Flow& stats() const { return *flow; }
+};
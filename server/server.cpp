@@ -7,6 +7,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <fstream>
@@ -15,22 +16,141 @@
 #include <atomic>
 #include<signal.h>
 #include<algorithm>
+#include <fcntl.h>
+#include <zlib.h>
+#include <map>
+#include <memory>
+#include "ratelimit.h"
+#include "scheduler.h"
+#include "zmode.h"
+#include "hashcache.h"
+#include "sessionfs.h"
+#include "fswatch.h"
+#include "fdcache.h"
+#include "../common/filecopy.h"
+#include "cachepolicy.h"
+#include "directio.h"
+#include "tarstream.h"
+#include "replicate.h"
+#include "durability.h"
+#include "uploadjournal.h"
+#include "manifest.h"
+#include "watchhub.h"
+#include "nameindex.h"
+#include "serverconfig.h"
+#include "slab.h"
+#include "sessionreactor.h"
+#include "../common/sparse.h"
+#include "../common/delta.h"
+#include "../common/fdpass.h"
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <sys/statvfs.h>
+#include <sys/resource.h>
 
 #define CONTROL_PORT 2100
 #define BUFFER_SIZE 1024
 #define SERVER_IP "127.0.0.1"  // 服务器IP地址
 #define ROOT_DIR "/home/lfd/FTP/server" // 服务器根目录
+#define STATE_DIR ROOT_DIR ".state"     // 服务器状态目录（摘要索引等，不对外提供）
+#define LOCAL_SOCKET_PATH ROOT_DIR ".sock" // 同机客户端连接的Unix域socket（可传递文件描述符）
+#define CONFIG_FILE STATE_DIR "/server.conf" // 管理员、用户类别等服务器端配置
+#define MRETR_INLINE_MAX (1024 * 1024)  // SITE MRETR中整块读入内存的文件大小上限
+#define MRETR_FLUSH_SIZE (64 * 1024)    // SITE MRETR合并发送的缓冲大小
+#define ZMODE_LEVEL 6                   // MODE Z默认压缩级别
+#define ZMODE_MAX_WORKERS 8             // MODE Z共享压缩线程池的线程数上限
+#define HASH_MAX_WORKERS 8              // 并行计算CRC的线程数上限
+#define SENDFILE_CHUNK (64 * 1024)      // RETR每次sendfile的字节数上限
+#define STOR_BUFFER_SIZE (256 * 1024)   // STOR每次接收/写入的缓冲大小
+#define PREALLOC_STEP (64ULL * 1024 * 1024) // 未知大小的上传每次提前预分配的空间
+#define RETRDIR_READ_CHUNK (256 * 1024) // SITE RETRDIR压缩时每次读取的文件数据
+#define WATCH_TIMEOUT 300               // SITE WATCH默认最长等待时间（秒）
+#define WATCH_MAX_TIMEOUT 3600          // SITE WATCH允许的最长等待时间（秒）
+#define FIND_MAX_RESULTS 100000         // SITE FIND最多返回的条目数
+#define DATA_IO_TIMEOUT 60              // 数据连接单次收发的超时（秒）
 
 std::atomic<bool> server_running(true); // 服务器运行状态标志
 
+RateLimiter rate_limiter; // 全局/用户类别限速
+TransferScheduler scheduler; // 并发传输的DRR调度器
+HashCache* hash_cache = nullptr; // 文件摘要缓存，main中创建
+FdCache fd_cache; // 下载共享的只读fd缓存
+CachePolicyTable cache_policies; // 按路径前缀的页缓存策略
+ReplicationTable replication; // 按路径前缀的上传副本目录
+DurabilityManager durability; // 上传完成后的持久化（组提交）
+UploadJournal* upload_journal = nullptr; // 上传日志（续传检查点），main中创建
+Manifest manifest; // 文件清单（SITE MANIFEST），main中启动
+WatchHub watch_hub; // SITE WATCH的目录订阅
+NameIndex name_index; // 文件名索引（SITE FIND），main中启动
+SessionReactor session_reactor; // 空闲会话停放在这里，不占线程
+ServerConfig server_config; // 服务器端配置（CONFIG_FILE），main中载入
+CompressPool compress_pool; // MODE Z分块压缩的共享线程池，main中启动
+std::atomic<uint64_t> direct_io_threshold(DIRECT_IO_THRESHOLD); // 超过此大小的传输走O_DIRECT，0为关闭
+
+// 会话信息（供SITE STATS统计和会话级限速使用）
+struct SessionInfo {
+    uint64_t id;
+    std::string peer;       // 客户端地址
+    std::string user = "-"; // 登录用户名（受mtx保护）
+    std::mutex mtx;
+    TokenBucket bucket;     // 会话级令牌桶
+    RateMeter meter;        // 会话吞吐量
+    std::atomic<uint32_t> weight{1};          // 调度权重
+    std::atomic<uint64_t> queue_wait_us{0};   // 累计排队时延
+    std::atomic<uint64_t> queue_grants{0};    // 获得发送许可的次数
+};
+
+std::mutex sessions_mutex;
+std::map<uint64_t, std::shared_ptr<SessionInfo>> sessions; // 活动会话表
+std::atomic<uint64_t> next_session_id(1);
+
+// 解析带K/M/G后缀的字节数
+bool parse_size(const std::string& str, uint64_t& value) {
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long v = strtoull(str.c_str(), &end, 10);
+    if (errno != 0 || end == str.c_str()) return false;
+    switch (toupper(*end)) {
+        case 'K': v <<= 10; ++end; break;
+        case 'M': v <<= 20; ++end; break;
+        case 'G': v <<= 30; ++end; break;
+    }
+    if (*end != '\0') return false;
+    value = v;
+    return true;
+}
+
 // 客户端会话处理类
-class ClientHandler {
+class ClientHandler final : public ParkedSession {
 private:
     int ctrl_sock;      // 控制连接socket
     int data_listen_sock = -1; // 数据监听socket
     int data_sock = -1; // 数据连接socket
-    std::string current_dir; // 当前工作目录
+    SessionFs fs;           // 根目录/当前目录fd，所有路径都相对根目录解析
     std::mutex data_mutex;  // 数据连接互斥锁
+    std::string ctrl_buf;   // 控制连接接收缓冲（未处理完的命令）
+    std::shared_ptr<SessionInfo> info; // 会话统计与限速信息
+    std::shared_ptr<TokenBucket> class_bucket; // 所属用户类别的令牌桶
+    ScheduledTransfer* transfer = nullptr; // 当前正在进行的传输
+    bool mode_z = false;                   // MODE Z（压缩传输）
+    bool sparse = false;                   // OPTS SPARSE：只传输数据区段，保留空洞
+    ZEngine z_engine = ZEngine::Deflate;   // MODE Z压缩引擎
+    int z_level = ZMODE_LEVEL;             // MODE Z压缩级别
+    HashAlgo hash_algo = HashAlgo::SHA256; // HASH命令使用的算法（OPTS HASH）
+    uint64_t rang_start = 0;               // RANG设置的范围，rang_end为0表示未设置
+    uint64_t rang_end = 0;
+    std::string rename_from;               // RNFR记下的源路径
+    std::string copy_from;                 // SITE CPFR记下的源路径
+    uint64_t alloc_size = 0;               // ALLO预告的下一个上传文件大小
+    uint64_t rest_offset = 0;              // REST给出的续传偏移（只对下一个STOR有效）
+    bool local = false;                    // 经Unix域socket连接，RETR/STOR可直接传递文件描述符
+    bool admin = false;                    // 以配置文件中的管理员身份登录
+    int passed_fd = -1;                    // 客户端随当前命令传来的文件描述符
+    std::shared_ptr<WatchHub::Subscription> watch_sub; // SITE WATCH订阅的目录
+    bool on_reactor = false;               // 由SessionReactor驱动（resume），等待时可以停放
+    bool watching = false;                 // SITE WATCH等待中，会话停放在reactor上
+    bool watch_settling = false;           // 已有变化，再等WATCH_COALESCE_MS合并同一批事件
+    std::chrono::steady_clock::time_point watch_wake; // 等待的截止时间
 
     // 发送响应到客户端（自动添加CRLF）
     void send_response(const std::string& response) {
@@ -38,274 +158,2173 @@ private:
         send(ctrl_sock, msg.c_str(), msg.size(), 0);
     }
 
-    // 路径安全检查（防止目录遍历）
-    bool is_safe_path(const std::string& path) {
-        std::string full_path = current_dir + "/" + path;
-        return full_path.find(ROOT_DIR) == 0; // 必须包含根目录
+    // 从控制连接读取一行命令（去掉CRLF），连接关闭时返回false
+    bool recv_line(std::string& line) {
+        size_t pos;
+        while ((pos = ctrl_buf.find('\n')) == std::string::npos) {
+            char buffer[BUFFER_SIZE];
+            ssize_t bytes = local ? recv_with_fd(ctrl_sock, buffer, sizeof(buffer), passed_fd)
+                                  : recv(ctrl_sock, buffer, sizeof(buffer), 0);
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes <= 0) return false;
+            ctrl_buf.append(buffer, bytes);
+        }
+        line = ctrl_buf.substr(0, pos);
+        ctrl_buf.erase(0, pos + 1);
+        line.erase(line.find_last_not_of("\r\n") + 1);
+        return true;
     }
 
+
 public:
-    explicit ClientHandler(int sock) : ctrl_sock(sock) {
-        current_dir = ROOT_DIR;
+    explicit ClientHandler(int sock, const std::string& peer = "") : ctrl_sock(sock) {
         mkdir(ROOT_DIR, 0777); // 确保根目录存在
+        if (!fs.init(ROOT_DIR)) std::cerr << "无法打开根目录: " << strerror(errno) << std::endl;
+
+        info = std::make_shared<SessionInfo>();
+        info->id = next_session_id++;
+        info->peer = peer;
+        sockaddr_storage addr{};
+        socklen_t len = sizeof(addr);
+        local = getsockname(sock, reinterpret_cast<sockaddr*>(&addr), &len) == 0 && addr.ss_family == AF_UNIX;
+        class_bucket = rate_limiter.class_bucket("default");
+        std::lock_guard<std::mutex> lock(sessions_mutex);
+        sessions[info->id] = info;
     }
 
     ~ClientHandler() {
+        {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            sessions.erase(info->id);
+        }
+        watch_hub.unsubscribe(watch_sub);
         close(ctrl_sock);
+        if (passed_fd >= 0) close(passed_fd);
         if(data_listen_sock != -1) close(data_listen_sock);
         if(data_sock != -1) close(data_sock);
     }
 
-    // 主处理循环
-    void handle() {
-        std::cout<<"连接成功"<<std::endl;
-        send_response("220 Welcome to MyFTP Server");
+    // 主处理循环：阻塞读取命令（经Unix域socket连接的会话，或reactor不可用时）
+    void handle() {
+        greet();
+        serve();
+    }
+
+    void serve() {
+        on_reactor = false;
+        std::string cmd;
+        // 按行读取命令，支持客户端流水线发送多条命令
+        while (server_running && recv_line(cmd))
+            if (!execute(cmd)) break;
+    }
+
+    void greet() {
+        std::cout<<"连接成功"<<std::endl;
+        send_response("220 Welcome to MyFTP Server");
+    }
+
+    int park_fd() const override { return ctrl_sock; }
+
+    // 控制连接可读（在工作线程上）：处理已到达的全部命令，没有更多输入时释放空闲资源并重新停放；
+    // QUIT或连接断开时销毁会话
+    void resume() override {
+        on_reactor = true;
+        std::string cmd;
+        while (server_running) {
+            // SITE WATCH等待中：停放在订阅的eventfd和截止时间上，不占工作线程
+            if (watching && !watch_step()) {
+                if (session_reactor.park(this, watch_sub->event_fd, watch_wake)) return; // 之后不得再访问this
+                watching = false;
+                watch_wait();
+                continue;
+            }
+            size_t pos = ctrl_buf.find('\n');
+            if (pos != std::string::npos) {
+                cmd = ctrl_buf.substr(0, pos);
+                ctrl_buf.erase(0, pos + 1);
+                cmd.erase(cmd.find_last_not_of("\r\n") + 1);
+                if (!execute(cmd)) break;
+                continue;
+            }
+            char buffer[BUFFER_SIZE];
+            ssize_t bytes = recv(ctrl_sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (bytes > 0) {
+                ctrl_buf.append(buffer, bytes);
+                continue;
+            }
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                release_idle();
+                if (session_reactor.park(this)) return; // 之后不得再访问this
+                serve();
+            }
+            break;
+        }
+        session_reactor.retire(this);
+    }
+
+    // 会话转入空闲：释放接收缓冲和目录fd缓存，只保留会话记录和控制连接
+    void release_idle() {
+        if (ctrl_buf.empty()) std::string().swap(ctrl_buf);
+        fs.invalidate();
+    }
+
+    // 会话记录从slab分配
+    static void* operator new(size_t size) {
+        return size == sizeof(ClientHandler) ? session_slab().allocate() : ::operator new(size);
+    }
+    static void operator delete(void* p, size_t size) {
+        if (size == sizeof(ClientHandler)) session_slab().release(p);
+        else ::operator delete(p);
+    }
+    static Slab<ClientHandler>& session_slab();
+
+    // 执行一条命令，QUIT后返回false
+    bool execute(const std::string& cmd) {
+        std::cout << "收到命令: " << cmd << std::endl;
+
+        // 命令解析
+        std::istringstream iss(cmd);//创建一个字符串流 iss，用于从字符串 cmd 中读取数据。
+        std::vector<std::string> tokens;
+        std::string token;
+        while(iss >> token) tokens.push_back(token);//从字符串流 iss 中逐个读取令牌，并将其添加到 tokens 向量中。
+        if(tokens.empty()) return true;
+        std::cout<<"1"<<std::endl;
+        std::string command = tokens[0];
+        std::transform(command.begin(), command.end(), command.begin(), ::toupper);//用于对容器中的元素进行转换操作
+
+        if (command == "USER") {
+            admin = false;
+            if (tokens.size() > 1) set_user(tokens[1]);
+            send_response("331 Please specify the password");
+        } 
+        else if (command == "PASS") {
+            handle_pass(tokens.size() > 1 ? tokens[1] : "");
+        }
+        else if (command == "PASV") {
+            handle_pasv();
+        }
+        else if (command == "LIST") {
+            handle_list();
+        }
+        else if (command == "MLSD") {
+            handle_mlsd(tokens.size() > 1 ? tokens[1] : ".");
+        }
+        else if (command == "CWD" && tokens.size() > 1) {
+            handle_cwd(tokens[1]);
+        }
+        else if (command == "CDUP") {
+            handle_cwd("..");
+        }
+        else if (command == "PWD") {
+            send_response("257 \"" + fs.pwd() + "\" is the current directory");
+        }
+        else if (command == "FEAT") {
+            handle_feat();
+        }
+        else if (command == "MODE" && tokens.size() > 1) {
+            handle_mode(tokens[1]);
+        }
+        else if (command == "OPTS" && tokens.size() > 1) {
+            handle_opts(tokens);
+        }
+        else if (command == "RANG" && tokens.size() > 2) {
+            handle_rang(tokens[1], tokens[2]);
+        }
+        else if (command == "HASH" && tokens.size() > 1) {
+            handle_hash(tokens[1]);
+        }
+        else if ((command == "XCRC" || command == "XMD5" || command == "XSHA256") &&
+                 tokens.size() > 1) {
+            handle_xhash(command, tokens);
+        }
+        else if (command == "ALLO" && tokens.size() > 1) {
+            handle_allo(tokens[1]);
+        }
+        else if (command == "REST" && tokens.size() > 1) {
+            handle_rest(tokens[1]);
+        }
+        else if (command == "RNFR" && tokens.size() > 1) {
+            handle_rnfr(tokens[1]);
+        }
+        else if (command == "RNTO" && tokens.size() > 1) {
+            handle_rnto(tokens[1]);
+        }
+        else if (command == "MKD" && tokens.size() > 1) {
+            handle_mkd(tokens[1]);
+        }
+        else if (command == "RETR" && tokens.size() > 1) {
+            handle_retr(tokens[1]);
+        }
+        else if (command == "STOR" && tokens.size() > 1) {
+            handle_stor(tokens[1]);
+        }
+        else if (command == "SITE" && tokens.size() > 1) {
+            handle_site(tokens);
+        }
+        else if (command == "QUIT") {
+            send_response("221 Goodbye");
+            return false;
+        }
+        else {
+            send_response("500 Unknown command");
+        }
+        // 传来的描述符只对随它一起到达的命令有效
+        if (passed_fd >= 0) {
+            close(passed_fd);
+            passed_fd = -1;
+        }
+        // REST只作用于紧随其后的传输命令（中间允许PASV）
+        if (command != "REST" && command != "PASV") rest_offset = 0;
+        return true;
+    }
+
+private:
+    // 记录用户名并切换到该用户所属类别的令牌桶
+    void set_user(const std::string& user) {
+        {
+            std::lock_guard<std::mutex> lock(info->mtx);
+            info->user = user;
+        }
+        class_bucket = rate_limiter.class_bucket(rate_limiter.user_class(user));
+    }
+
+    // 配置文件中的管理员必须给出正确的密码，其他用户照旧任意密码登录
+    void handle_pass(const std::string& password) {
+        std::string user;
+        {
+            std::lock_guard<std::mutex> lock(info->mtx);
+            user = info->user;
+        }
+        if (!server_config.is_admin(user)) {
+            send_response("230 Login successful");
+            return;
+        }
+        admin = server_config.check_admin(user, password);
+        send_response(admin ? "230 Login successful (admin)" : "530 Login incorrect");
+    }
+
+    // 修改全局状态的命令只允许管理员执行
+    bool require_admin() {
+        if (!admin) send_response("550 Permission denied: admin only");
+        return admin;
+    }
+
+    // 传输限速：会话、用户类别、全局三级令牌桶
+    // 在数据块收发完成后调用；需要休眠时先让出调度许可，避免占着发送名额睡眠
+    void throttle(size_t bytes) {
+        auto wait = rate_limiter.reserve(info->bucket, class_bucket.get(), bytes);
+        if (wait.count() > 0) {
+            if (transfer) transfer->yield();
+            RateLimiter::sleep_for(wait, [] { return !server_running; });
+        }
+        info->meter.add(bytes);
+    }
+
+    // 接受数据连接并设置收发超时，客户端停止收发时会话不会一直阻塞
+    int accept_data() {
+        int fd = accept(data_listen_sock, nullptr, nullptr);
+        if (fd >= 0) {
+            struct timeval tv{DATA_IO_TIMEOUT, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        }
+        return fd;
+    }
+
+    // 本次传输的调度权重，由用户所属类别在服务器配置中的权重决定
+    uint32_t transfer_weight() {
+        std::string user;
+        {
+            std::lock_guard<std::mutex> lock(info->mtx);
+            user = info->user;
+        }
+        info->weight = server_config.class_weight(rate_limiter.user_class(user));
+        return info->weight;
+    }
+
+    // 向调度器申请本块的发送额度，并记录排队时延
+    size_t schedule(ScheduledTransfer& t, size_t n) {
+        uint64_t grants = t.stats().grants;
+        size_t k = t.next(n);
+        if (t.stats().grants != grants) {
+            info->queue_grants++;
+            info->queue_wait_us += t.stats().last_wait_us;
+        }
+        return k;
+    }
+
+    // 处理SITE扩展命令
+    void handle_site(const std::vector<std::string>& tokens) {
+        std::string sub = tokens[1];
+        std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+
+        if (sub == "RATE") {
+            site_rate(tokens);
+        }
+        else if (sub == "CLASS" && tokens.size() > 3) {
+            // SITE CLASS <user> <class>：把用户划入某个限速类别
+            if (!require_admin()) return;
+            rate_limiter.set_user_class(tokens[2], tokens[3]);
+            std::string user;
+            {
+                std::lock_guard<std::mutex> lock(info->mtx);
+                user = info->user;
+            }
+            if (user == tokens[2]) set_user(user);
+            send_response("200 User " + tokens[2] + " assigned to class " + tokens[3]);
+        }
+        else if (sub == "STATS") {
+            site_stats();
+        }
+        else if (sub == "WEIGHT" && tokens.size() > 3) {
+            // SITE WEIGHT <class> <1-100>：某个用户类别传输的调度权重
+            if (!require_admin()) return;
+            int weight = atoi(tokens[3].c_str());
+            if (weight < 1 || weight > 100) {
+                send_response("501 Weight must be 1-100");
+                return;
+            }
+            server_config.set_class_weight(tokens[2], weight);
+            send_response("200 Class " + tokens[2] + " weight set to " + std::to_string(weight));
+        }
+        else if (sub == "SCHED") {
+            if (require_admin()) site_sched(tokens);
+        }
+        else if (sub == "MRETR" && tokens.size() > 2) {
+            handle_mretr(tokens);
+        }
+        else if (sub == "RETRDIR" && tokens.size() > 2) {
+            site_retrdir(tokens);
+        }
+        else if (sub == "DSTOR" && tokens.size() > 2) {
+            site_dstor(tokens[2]);
+        }
+        else if (sub == "DRETR" && tokens.size() > 2) {
+            site_dretr(tokens[2]);
+        }
+        else if (sub == "CPFR" && tokens.size() > 2) {
+            site_cpfr(tokens[2]);
+        }
+        else if (sub == "CPTO" && tokens.size() > 2) {
+            site_cpto(tokens[2]);
+        }
+        else if (sub == "DIRECTIO") {
+            if (require_admin()) site_directio(tokens);
+        }
+        else if (sub == "CACHE") {
+            if (require_admin()) site_cache(tokens);
+        }
+        else if (sub == "WATCH" && tokens.size() > 2) {
+            site_watch(tokens);
+        }
+        else if (sub == "FIND" && tokens.size() > 2) {
+            site_find(tokens);
+        }
+        else if (sub == "MANIFEST") {
+            site_manifest(tokens);
+        }
+        else if (sub == "RESUME" && tokens.size() > 2) {
+            site_resume(tokens[2]);
+        }
+        else if (sub == "DURABLE") {
+            if (require_admin()) site_durable(tokens);
+        }
+        else if (sub == "REPLICATE") {
+            if (require_admin()) site_replicate(tokens);
+        }
+        else if (sub == "FDCACHE") {
+            if (require_admin()) site_fdcache(tokens);
+        }
+        else {
+            send_response("504 Unknown SITE command");
+        }
+    }
+
+    // SITE RATE                          查看当前限速
+    // SITE RATE SESSION <bytes/s>        设置本会话限速
+    // SITE RATE CLASS <class> <bytes/s>  设置用户类别限速（管理员）
+    // SITE RATE GLOBAL <bytes/s>         设置全局限速（管理员）
+    // 速率可带K/M/G后缀，0表示不限速
+    void site_rate(const std::vector<std::string>& tokens) {
+        if (tokens.size() == 2) {
+            std::ostringstream oss;
+            oss << "211-Rate limits (bytes/s, 0 = unlimited)\r\n"
+                << " GLOBAL " << rate_limiter.global().rate() << "\r\n"
+                << " SESSION " << info->bucket.rate() << "\r\n";
+            for (auto& kv : rate_limiter.class_rates())
+                oss << " CLASS " << kv.first << " " << kv.second << "\r\n";
+            oss << "211 End";
+            send_response(oss.str());
+            return;
+        }
+
+        std::string scope = tokens[2];
+        std::transform(scope.begin(), scope.end(), scope.begin(), ::toupper);
+        uint64_t rate = 0;
+        if ((scope == "GLOBAL" || scope == "CLASS") && !require_admin()) return;
+        if (scope == "SESSION" && tokens.size() > 3 && parse_size(tokens[3], rate)) {
+            info->bucket.set_rate(rate);
+        }
+        else if (scope == "GLOBAL" && tokens.size() > 3 && parse_size(tokens[3], rate)) {
+            rate_limiter.global().set_rate(rate);
+        }
+        else if (scope == "CLASS" && tokens.size() > 4 && parse_size(tokens[4], rate)) {
+            rate_limiter.class_bucket(tokens[3])->set_rate(rate);
+        }
+        else {
+            send_response("501 Usage: SITE RATE [SESSION|GLOBAL|CLASS <name>] <bytes/s>");
+            return;
+        }
+        send_response("200 Rate limit updated");
+    }
+
+    // SITE SCHED                       查看调度器状态
+    // SITE SCHED QUANTUM <bytes>       每轮基础额度
+    // SITE SCHED SLOTS <n>             同时发送的传输数上限
+    void site_sched(const std::vector<std::string>& tokens) {
+        if (tokens.size() > 3) {
+            std::string opt = tokens[2];
+            std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+            uint64_t value = 0;
+            if (!parse_size(tokens[3], value) || value == 0) {
+                send_response("501 Invalid value");
+                return;
+            }
+            if (opt == "QUANTUM") scheduler.set_quantum(value);
+            else if (opt == "SLOTS") scheduler.set_slots(value);
+            else {
+                send_response("501 Usage: SITE SCHED [QUANTUM <bytes>|SLOTS <n>]");
+                return;
+            }
+            send_response("200 Scheduler updated");
+            return;
+        }
+
+        auto st = scheduler.stats();
+        std::ostringstream oss;
+        oss << "211-Scheduler: quantum=" << st.quantum << " slots=" << st.slots << "\r\n"
+            << " flows=" << st.flows << " busy=" << st.busy << " queued=" << st.queued << "\r\n"
+            << " grants=" << st.grants
+            << " avg_wait=" << (st.grants ? st.total_wait_us / st.grants : 0) << "us"
+            << " max_wait=" << st.max_wait_us << "us\r\n"
+            << "211 End";
+        send_response(oss.str());
+    }
+
+    // 文件适用的页缓存策略
+    CachePolicy cache_policy(const std::string& path) {
+        std::string rel;
+        return fs.normalize(path, rel) ? cache_policies.lookup(rel) : CachePolicy();
+    }
+
+    // SITE CACHE                                              列出页缓存策略
+    // SITE CACHE <prefix> <KEEP|STREAM|AUTO> [threshold] [readahead]  设置路径前缀的策略
+    // SITE CACHE <prefix> REMOVE                              删除策略
+    void site_cache(const std::vector<std::string>& tokens) {
+        if (tokens.size() > 3) {
+            std::string prefix;
+            if (!fs.normalize(tokens[2], prefix)) {
+                send_response("550 Invalid path");
+                return;
+            }
+            std::string mode = tokens[3];
+            std::transform(mode.begin(), mode.end(), mode.begin(), ::toupper);
+            if (mode == "REMOVE") {
+                if (cache_policies.remove(prefix)) send_response("200 Cache policy removed");
+                else send_response("550 No such cache policy");
+                return;
+            }
+            CachePolicy p;
+            if (!parse_cache_mode(mode, p.mode) ||
+                (tokens.size() > 4 && !parse_size(tokens[4], p.threshold)) ||
+                (tokens.size() > 5 && !parse_size(tokens[5], p.readahead))) {
+                send_response("501 Usage: SITE CACHE <prefix> <KEEP|STREAM|AUTO> [threshold] [readahead]");
+                return;
+            }
+            cache_policies.set(prefix, p);
+            send_response("200 Cache policy for /" + prefix + " set to " + cache_mode_name(p.mode));
+            return;
+        }
+
+        std::ostringstream oss;
+        oss << "211-Cache policies\r\n";
+        for (auto& r : cache_policies.list()) {
+            oss << " /" << r.first << " " << cache_mode_name(r.second.mode)
+                << " threshold=" << r.second.threshold
+                << " readahead=" << r.second.readahead << "\r\n";
+        }
+        oss << "211 End";
+        send_response(oss.str());
+    }
+
+    // SITE DURABLE                                  查看持久化方式和组提交统计
+    // SITE DURABLE OFF|SYNC                         不同步 / 每个文件单独fdatasync
+    // SITE DURABLE GROUP [window_us] [batch_max]    组提交：收集窗口越长批次越大，单个上传的延迟也越高
+    void site_durable(const std::vector<std::string>& tokens) {
+        if (tokens.size() > 2) {
+            std::string mode = tokens[2];
+            std::transform(mode.begin(), mode.end(), mode.begin(), ::toupper);
+            uint64_t window = durability.window(), batch = durability.batch_limit();
+            if ((mode != "OFF" && mode != "SYNC" && mode != "GROUP") ||
+                (tokens.size() > 3 && (mode != "GROUP" || !parse_size(tokens[3], window))) ||
+                (tokens.size() > 4 && (!parse_size(tokens[4], batch) || batch == 0))) {
+                send_response("501 Usage: SITE DURABLE OFF|SYNC|GROUP [window_us] [batch_max]");
+                return;
+            }
+            durability.set_mode(mode == "OFF" ? DurableMode::Off
+                                : mode == "SYNC" ? DurableMode::Sync : DurableMode::Group);
+            durability.set_window(window);
+            durability.set_batch_max(batch);
+        }
+        auto st = durability.stats();
+        std::ostringstream oss;
+        oss << "211-Durability: " << durable_mode_name(durability.mode())
+            << " window=" << durability.window() << "us batch_max=" << durability.batch_limit() << "\r\n"
+            << " commits=" << st.commits << " batches=" << st.batches
+            << " avg_batch=" << (st.batches ? st.commits / st.batches : 0)
+            << " syncfs=" << st.syncfs_calls
+            << " avg_wait=" << (st.commits ? st.total_wait_us / st.commits : 0) << "us"
+            << " max_wait=" << st.max_wait_us << "us\r\n"
+            << "211 End";
+        send_response(oss.str());
+    }
+
+    // SITE REPLICATE                          列出上传复制策略
+    // SITE REPLICATE <prefix> <dir> [dir...]  上传到prefix下的文件同时写入各副本目录
+    // SITE REPLICATE <prefix> REMOVE          删除策略
+    void site_replicate(const std::vector<std::string>& tokens) {
+        if (tokens.size() > 3) {
+            std::string prefix;
+            if (!fs.normalize(tokens[2], prefix)) {
+                send_response("550 Invalid path");
+                return;
+            }
+            std::string arg = tokens[3];
+            std::transform(arg.begin(), arg.end(), arg.begin(), ::toupper);
+            if (arg == "REMOVE" && tokens.size() == 4) {
+                if (replication.remove(prefix)) send_response("200 Replication removed");
+                else send_response("550 No such replication policy");
+                return;
+            }
+            if (tokens.size() - 3 > REPLICA_MAX) {
+                send_response("501 At most " + std::to_string(REPLICA_MAX) + " replica directories");
+                return;
+            }
+            std::vector<ReplicaTarget> dirs;
+            for (size_t i = 3; i < tokens.size(); i++) {
+                std::string dir = tokens[i];
+                while (dir.size() > 1 && dir.back() == '/') dir.pop_back();
+                ReplicaTarget target;
+                if (dir[0] != '/' || !replication.resolve(dir, target)) {
+                    send_response("550 " + dir + ": not a directory under a configured replica root");
+                    return;
+                }
+                dirs.push_back(target);
+            }
+            replication.set(prefix, dirs);
+            send_response("200 Uploads to /" + prefix + " replicated to " + std::to_string(dirs.size()) +
+                          " directories");
+            return;
+        }
+
+        std::ostringstream oss;
+        oss << "211-Replication policies\r\n";
+        for (auto& root : replication.allowed_roots()) oss << " root " << root << "\r\n";
+        for (auto& r : replication.list()) {
+            oss << " /" << r.first;
+            for (auto& d : r.second) oss << " " << d.display();
+            oss << "\r\n";
+        }
+        oss << "211 End";
+        send_response(oss.str());
+    }
+
+    // SITE DIRECTIO                    查看直接I/O阈值
+    // SITE DIRECTIO <bytes>|OFF        超过该大小的RETR/STOR（STOR需先ALLO）绕过页缓存
+    void site_directio(const std::vector<std::string>& tokens) {
+        if (tokens.size() > 2) {
+            std::string arg = tokens[2];
+            std::transform(arg.begin(), arg.end(), arg.begin(), ::toupper);
+            uint64_t value = 0;
+            if (arg != "OFF" && (!parse_size(arg, value) || value == 0)) {
+                send_response("501 Usage: SITE DIRECTIO <bytes>|OFF");
+                return;
+            }
+            direct_io_threshold = value;
+        }
+        uint64_t t = direct_io_threshold;
+        send_response(t ? "200 Direct I/O for files >= " + std::to_string(t) + " bytes"
+                        : "200 Direct I/O disabled");
+    }
+
+    // 用O_DIRECT发送：后台线程读盘，多块在途，与网络发送重叠
+    bool retr_direct(int fd, uint64_t size) {
+        ScheduledTransfer sched(scheduler, transfer_weight(), data_sock);
+        transfer = &sched;
+        DirectReader reader(fd, size);
+        DirectQueue::Block b;
+        uint64_t sent = 0;
+        bool ok = true;
+        while (ok && reader.next(b)) {
+            ok = send_all_data(sched, b.data, b.len);
+            sent += b.len;
+            reader.release(b);
+        }
+        transfer = nullptr;
+        return ok && reader.status() == 0 && sent == size;
+    }
+
+    // SITE FDCACHE                  查看fd缓存状态
+    // SITE FDCACHE MAX <n>          缓存的打开文件数上限
+    // SITE FDCACHE TTL <seconds>    路径映射有效期
+    void site_fdcache(const std::vector<std::string>& tokens) {
+        if (tokens.size() > 3) {
+            std::string opt = tokens[2];
+            std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+            int value = atoi(tokens[3].c_str());
+            if (value <= 0) {
+                send_response("501 Invalid value");
+                return;
+            }
+            if (opt == "MAX") fd_cache.set_max_fds(value);
+            else if (opt == "TTL") fd_cache.set_ttl(value);
+            else {
+                send_response("501 Usage: SITE FDCACHE [MAX <n>|TTL <seconds>]");
+                return;
+            }
+            send_response("200 Fd cache updated");
+            return;
+        }
+
+        auto st = fd_cache.stats();
+        std::ostringstream oss;
+        oss << "211-Fd cache: open=" << st.open_fds << " max=" << st.max_fds << "\r\n"
+            << " hits=" << st.hits << " misses=" << st.misses << " evictions=" << st.evictions
+            << " inotify=" << (FsWatcher::instance().active() ? "on" : "off") << "\r\n"
+            << "211 End";
+        send_response(oss.str());
+    }
+
+    // SITE STATS：列出所有会话的用户、累计流量和当前吞吐量
+    void site_stats() {
+        std::vector<std::shared_ptr<SessionInfo>> list;
+        {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            for (auto& kv : sessions) list.push_back(kv.second);
+        }
+
+        std::ostringstream oss;
+        auto rs = session_reactor.stats();
+        oss << "211-" << list.size() << " active sessions\r\n"
+            << " idle=" << rs.parked << " workers=" << rs.workers << " busy=" << rs.busy
+            << " queued=" << rs.queued << " record=" << ClientHandler::session_slab().slot_size() << "B"
+            << " slab=" << ClientHandler::session_slab().reserved_bytes() << "B\r\n";
+        for (auto& s : list) {
+            std::string user;
+            {
+                std::lock_guard<std::mutex> lock(s->mtx);
+                user = s->user;
+            }
+            oss << " #" << s->id << " " << s->peer << " user=" << user
+                << " class=" << rate_limiter.user_class(user)
+                << " bytes=" << s->meter.total()
+                << " rate=" << static_cast<uint64_t>(s->meter.rate()) << "B/s"
+                << " limit=" << s->bucket.rate()
+                << " weight=" << s->weight
+                << " avg_wait=" << (s->queue_grants ? s->queue_wait_us / s->queue_grants : 0)
+                << "us\r\n";
+        }
+        auto st = scheduler.stats();
+        oss << " scheduler: flows=" << st.flows << " queued=" << st.queued
+            << " avg_wait=" << (st.grants ? st.total_wait_us / st.grants : 0) << "us"
+            << " max_wait=" << st.max_wait_us << "us\r\n";
+        auto fc = fd_cache.stats();
+        oss << " fdcache: open=" << fc.open_fds << " hits=" << fc.hits
+            << " misses=" << fc.misses << "\r\n";
+        auto ds = durability.stats();
+        oss << " durability: " << durable_mode_name(durability.mode()) << " commits=" << ds.commits
+            << " batches=" << ds.batches
+            << " avg_wait=" << (ds.commits ? ds.total_wait_us / ds.commits : 0) << "us\r\n";
+        oss << "211 End";
+        send_response(oss.str());
+    }
+
+    // 处理PASV命令（被动模式）
+    void handle_pasv() {
+        std::lock_guard<std::mutex> lock(data_mutex);
+        
+        // if(data_listen_sock != -1) {
+        //     close(data_listen_sock);
+        //     data_listen_sock = -1;
+        // }
+
+        // 创建数据监听socket
+        data_listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+        if(data_listen_sock < 0) {
+            send_response("500 Internal server error");
+            return;
+        }
+
+        // 绑定随机端口
+        sockaddr_in data_addr{};
+        data_addr.sin_family = AF_INET;
+        data_addr.sin_addr.s_addr = INADDR_ANY;
+        data_addr.sin_port = 0; // 自动分配端口
+
+        if(bind(data_listen_sock, (sockaddr*)&data_addr, sizeof(data_addr)) < 0) {
+            send_response("500 Port allocation failed");
+            close(data_listen_sock);
+            data_listen_sock = -1;
+            return;
+        }
+
+        // 开始监听
+        if(listen(data_listen_sock, 1) < 0) {
+            send_response("500 Listen failed");
+            close(data_listen_sock);
+            data_listen_sock = -1;
+            return;
+        }
+
+        // 获取绑定的端口号
+        socklen_t addr_len = sizeof(data_addr);
+        getsockname(data_listen_sock, (sockaddr*)&data_addr, &addr_len);//getsockname 可以用于获取绑定到套接字的实际地址和端口。
+        uint16_t port = ntohs(data_addr.sin_port);// 获取端口号（网络字节序转主机字节序）
+
+        // 构造响应字符串
+        std::string ip_str = SERVER_IP;
+        std::replace(ip_str.begin(), ip_str.end(), '.', ',');
+        std::ostringstream oss;
+        //在FTP的PASV模式响应中，端口号需要被分解为高8位和低8位两个部分
+        oss << "227 Entering Passive Mode (" 
+            << ip_str << "," 
+            << (port >> 8) << "," //高8位
+            << (port & 0xff) << ")";// 低8位
+        
+        send_response(oss.str());
+    }
+
+
+void handle_list() {
+    std::lock_guard<std::mutex> lock(data_mutex);
+    
+    if (data_listen_sock == -1) {
+        send_response("425 Use PASV first");
+        return;
+    }
+
+    // 必须接受数据连接
+    data_sock = accept_data();
+    if (data_sock < 0) {
+        send_response("425 Data connection failed");
+        return;
+    }
+
+    send_response("150 Here comes the directory listing");
+
+    // 生成完整目录列表
+    std::string list;
+    DIR* dir = fs.open_dir(".");
+    if (dir) {
+        dirent* entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (strcmp(entry->d_name, ".") == 0 || 
+                strcmp(entry->d_name, "..") == 0) continue;
+            if (FsWatcher::is_temp_name(entry->d_name)) continue; // 上传中的临时文件不列出
+                
+            list += entry->d_name;
+            list += "\r\n"; // 必须使用CRLF
+        }
+        closedir(dir);
+        
+        // 一次性发送完整列表
+        send(data_sock, list.c_str(), list.size(), 0);
+    }
+
+    // 关闭数据连接（保留监听socket）
+    close(data_sock);
+    data_sock = -1;
+    
+    send_response("226 Directory send OK");
+}
+
+    // 处理MLSD命令：机器可读的目录列表（RFC 3659），供客户端递归传输使用
+    void handle_mlsd(const std::string& path) {
+        std::lock_guard<std::mutex> lock(data_mutex);
+        if (data_listen_sock == -1) {
+            send_response("425 Use PASV first");
+            return;
+        }
+
+        data_sock = accept_data();
+        if (data_sock < 0) {
+            send_response("425 Data connection failed");
+            return;
+        }
+
+        DIR* dir = fs.open_dir(path);
+        if (!dir) {
+            send_response("550 Directory not found");
+        } else {
+            send_response("150 Here comes the directory listing");
+            std::string list;
+            dirent* entry;
+            while ((entry = readdir(dir)) != nullptr) {
+                if (strcmp(entry->d_name, ".") == 0 ||
+                    strcmp(entry->d_name, "..") == 0) continue;
+                if (FsWatcher::is_temp_name(entry->d_name)) continue;
+
+                struct stat st;
+                if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) continue;
+
+                char modify[32];
+                strftime(modify, sizeof(modify), "%Y%m%d%H%M%S", gmtime(&st.st_mtime));
+                list += S_ISDIR(st.st_mode) ? "type=dir;" : "type=file;";
+                list += "size=" + std::to_string(st.st_size) + ";";
+                list += "modify=" + std::string(modify) + "; ";
+                list += entry->d_name;
+                list += "\r\n";
+            }
+            closedir(dir);
+            send(data_sock, list.c_str(), list.size(), MSG_NOSIGNAL);
+            send_response("226 Directory send OK");
+        }
+
+        close(data_sock);
+        close(data_listen_sock);
+        data_sock = -1;
+        data_listen_sock = -1;
+    }
+
+    // 处理FEAT命令：列出支持的扩展
+    void handle_feat() {
+        std::string feat = "211-Extensions supported\r\n"
+                           " MLSD\r\n"
+                           " MRETR\r\n"
+                           " MODE Z\r\n";
+        if (zstd_available()) feat += " MODE Z ENGINE zstd\r\n";
+        feat += " HASH ";
+        for (HashAlgo a : {HashAlgo::CRC32, HashAlgo::CRC32C, HashAlgo::MD5, HashAlgo::SHA256}) {
+            feat += hash_algo_name(a);
+            if (a == hash_algo) feat += "*";
+            feat += a == HashAlgo::SHA256 ? "\r\n" : ";";
+        }
+        feat += " RANG STREAM\r\n"
+                " REST STREAM\r\n"
+                " SPARSE\r\n"
+                " SITE CPFR\r\n"
+                " SITE DELTA\r\n"
+                " SITE FIND\r\n"
+                " SITE MANIFEST\r\n"
+                " SITE RESUME\r\n"
+                " SITE RETRDIR\r\n"
+                " SITE WATCH\r\n"
+                " XCRC\r\n"
+                " XMD5\r\n"
+                " XSHA256\r\n";
+        if (local) feat += " FDPASS\r\n";
+        send_response(feat + "211 End");
+    }
+
+    // 处理MODE命令：S为流模式，Z为压缩模式
+    void handle_mode(std::string mode) {
+        std::transform(mode.begin(), mode.end(), mode.begin(), ::toupper);
+        if (mode == "S") mode_z = false;
+        else if (mode == "Z" && sparse) {
+            send_response("504 MODE Z cannot be combined with OPTS SPARSE");
+            return;
+        }
+        else if (mode == "Z") mode_z = true;
+        else {
+            send_response("504 Unsupported mode");
+            return;
+        }
+        send_response("200 Mode set to " + mode);
+    }
+
+    // OPTS MODE Z LEVEL <0-9>
+    // OPTS MODE Z ENGINE <deflate|zstd>
+    // OPTS HASH [<algo>]
+    void handle_opts(const std::vector<std::string>& tokens) {
+        std::vector<std::string> args(tokens.begin() + 1, tokens.end());
+        for (auto& a : args) std::transform(a.begin(), a.end(), a.begin(), ::toupper);
+
+        if (args[0] == "HASH") {
+            HashAlgo algo;
+            if (args.size() == 1) {
+                send_response(std::string("200 ") + hash_algo_name(hash_algo));
+            } else if (parse_hash_algo(args[1], algo)) {
+                hash_algo = algo;
+                send_response(std::string("200 ") + hash_algo_name(hash_algo));
+            } else {
+                send_response("504 Unknown algorithm");
+            }
+            return;
+        }
+
+        // OPTS SPARSE ON|OFF：RETR/STOR改用稀疏格式（见common/sparse.h）
+        if (args[0] == "SPARSE" && args.size() == 2 && (args[1] == "ON" || args[1] == "OFF")) {
+            if (args[1] == "ON" && mode_z) {
+                send_response("504 OPTS SPARSE cannot be combined with MODE Z");
+                return;
+            }
+            sparse = args[1] == "ON";
+            send_response("200 Sparse transfers " + std::string(sparse ? "enabled" : "disabled"));
+            return;
+        }
+
+        if (args.size() == 4 && args[0] == "MODE" && args[1] == "Z") {
+            if (args[2] == "LEVEL" && isdigit(args[3][0]) && args[3].size() == 1) {
+                z_level = args[3][0] - '0';
+                send_response("200 MODE Z level set to " + args[3]);
+                return;
+            }
+            if (args[2] == "ENGINE" && args[3] == "DEFLATE") {
+                z_engine = ZEngine::Deflate;
+                send_response("200 MODE Z engine set to deflate");
+                return;
+            }
+            if (args[2] == "ENGINE" && args[3] == "ZSTD" && zstd_available()) {
+                z_engine = ZEngine::Zstd;
+                send_response("200 MODE Z engine set to zstd");
+                return;
+            }
+        }
+        send_response("501 Unsupported option");
+    }
+
+    // RANG <start> <end>：为下一条HASH命令指定字节范围（含end），"RANG 1 0"清除
+    void handle_rang(const std::string& start, const std::string& end) {
+        uint64_t a = 0, b = 0;
+        if (!parse_size(start, a) || !parse_size(end, b)) {
+            send_response("501 Invalid range");
+            return;
+        }
+        if (a == 1 && b == 0) {
+            rang_start = rang_end = 0;
+            send_response("350 Restarting at 0. Range cleared");
+            return;
+        }
+        if (b < a) {
+            send_response("501 Invalid range");
+            return;
+        }
+        rang_start = a;
+        rang_end = b + 1;
+        send_response("350 Restarting at " + start + ". Ending byte " + end);
+    }
+
+    // 计算文件[start, end)的摘要，优先查缓存；end为0表示到文件末尾
+    // 返回false时err为错误回复
+    bool file_digest(const std::string& filename, HashAlgo algo, uint64_t& start, uint64_t& end,
+                     std::string& hex, std::string& err) {
+        FdCache::Ref file;
+        if (!fd_cache.acquire(fs, filename, file)) {
+            err = "550 File not found";
+            return false;
+        }
+        int fd = file.fd();
+        const struct stat& st = file.st;
+
+        uint64_t size = st.st_size;
+        if (end == 0 || end > size) end = size;
+        if (start > end) {
+            err = "501 Invalid range";
+            return false;
+        }
+
+        bool ok = true;
+        if (!hash_cache->lookup(fd, st, algo, start, end, hex)) {
+            size_t workers = std::min<size_t>(HASH_MAX_WORKERS,
+                                              std::max(1u, std::thread::hardware_concurrency()));
+            hex = hash_fd(fd, algo, start, end, workers);
+            ok = !hex.empty();
+            if (ok) hash_cache->store(fd, st, algo, start, end, hex);
+            else err = "451 Read error";
+        }
+        return ok;
+    }
+
+    // HASH <file>（draft-bryan-ftp-hash）：213 <algo> <start>-<end> <hex> <file>
+    void handle_hash(const std::string& filename) {
+        uint64_t start = rang_start, end = rang_end;
+        rang_start = rang_end = 0; // RANG只对下一条命令有效
+        std::string hex, err;
+        if (!file_digest(filename, hash_algo, start, end, hex, err)) {
+            send_response(err);
+            return;
+        }
+        std::ostringstream oss;
+        oss << "213 " << hash_algo_name(hash_algo) << " " << start << "-"
+            << (end > start ? end - 1 : start) << " " << hex << " " << filename;
+        send_response(oss.str());
+    }
+
+    // XCRC/XMD5/XSHA256 <file> [<start> [<end>]]：250 <HEX>，end为不含的字节位置
+    void handle_xhash(const std::string& command, const std::vector<std::string>& tokens) {
+        HashAlgo algo = command == "XCRC" ? HashAlgo::CRC32
+                      : command == "XMD5" ? HashAlgo::MD5 : HashAlgo::SHA256;
+        uint64_t start = 0, end = 0;
+        if ((tokens.size() > 2 && !parse_size(tokens[2], start)) ||
+            (tokens.size() > 3 && !parse_size(tokens[3], end))) {
+            send_response("501 Invalid range");
+            return;
+        }
+        if (tokens.size() > 3 && end == 0) {
+            send_response("501 Invalid range");
+            return;
+        }
+        std::string hex, err;
+        if (!file_digest(tokens[1], algo, start, end, hex, err)) {
+            send_response(err);
+            return;
+        }
+        std::transform(hex.begin(), hex.end(), hex.begin(), ::toupper);
+        send_response("250 " + hex);
+    }
+
+    // MODE Z下的RETR：分块并行压缩后发送，已压缩的文件以存储块原样发送
+    bool retr_compressed(const std::string& filename, int fd, uint64_t size) {
+        int level = z_level;
+        if (looks_compressed(filename, fd)) level = z_engine == ZEngine::Zstd ? 1 : 0;
+
+        ScheduledTransfer sched(scheduler, transfer_weight(), data_sock);
+        transfer = &sched;
+        ParallelCompressor compressor(compress_pool, z_engine, level, compress_pool.size());
+        bool ok = compressor.run(fd, size, [&](const char* data, size_t len) {
+            return send_all_data(sched, data, len);
+        });
+        transfer = nullptr;
+        return ok;
+    }
+
+    // 在数据连接上发送一段数据，按调度额度和限速分块
+    bool send_all_data(ScheduledTransfer& sched, const char* buf, size_t len) {
+        size_t off = 0;
+        while (off < len) {
+            size_t k = schedule(sched, len - off);
+            ssize_t sent = k ? send(data_sock, buf + off, k, MSG_NOSIGNAL) : -1;
+            sched.charge(sent > 0 ? sent : 0);
+            if (sent < 0 && k && (errno == EINTR || errno == EAGAIN)) continue;
+            if (sent <= 0) {
+                std::cerr << "发送失败: " << strerror(errno) << std::endl;
+                return false;
+            }
+            off += sent;
+            throttle(sent);
+        }
+        return true;
+    }
+
+    // SITE MRETR <file>...：在一个数据连接上顺序发送多个文件
+    // 每个文件前有一行头部 "FILE <size> <name>\n"，之后紧跟size字节内容和一行 "CRC <crc32>\n"，
+    // 校验和在发送时边读边算，只读一遍文件，且与实际发出的字节一致；
+    // 无法发送的文件输出 "ERR <name> <reason>\n"，最后以 "END <count>\n" 结束。
+    // 小文件整块读入并与头部合并发送，减少系统调用
+    void handle_mretr(const std::vector<std::string>& tokens) {
+        std::lock_guard<std::mutex> lock(data_mutex);
+        if (data_listen_sock == -1) {
+            send_response("425 Use PASV first");
+            return;
+        }
+        data_sock = accept_data();
+        if (data_sock < 0) {
+            send_response("425 Data connection failed");
+            return;
+        }
+        send_response("150 Opening multi-file data connection");
+
+        ScheduledTransfer sched(scheduler, transfer_weight(), data_sock);
+        transfer = &sched;
+        std::string out;
+        std::vector<char> content;
+        size_t sent_files = 0;
+        bool ok = true;
+
+        for (size_t i = 2; i < tokens.size() && ok; i++) {
+            const std::string& name = tokens[i];
+            FdCache::Ref file;
+            if (FsWatcher::is_temp_name(name) || !fd_cache.acquire(fs, name, file)) {
+                out += "ERR " + name + " File not found\n";
+                continue;
+            }
+            int fd = file.fd();
+            const struct stat& st = file.st;
+
+            // 小文件整块读入内存，大文件分块读取并发送
+            uLong crc = crc32(0L, Z_NULL, 0);
+            size_t size = st.st_size;
+            bool inline_data = size <= MRETR_INLINE_MAX;
+            content.resize(inline_data ? size : BUFFER_SIZE * 64);
+            if (inline_data) {
+                size_t pos = 0;
+                while (pos < size) {
+                    ssize_t n = pread(fd, content.data() + pos, size - pos, pos);
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n <= 0) break;
+                    pos += n;
+                }
+                if (pos != size) {
+                    out += "ERR " + name + " Read error\n";
+                    continue;
+                }
+                crc = crc32(crc, reinterpret_cast<Bytef*>(content.data()), size);
+            }
+
+            out += "FILE " + std::to_string(size) + " " + name + "\n";
+            if (inline_data) {
+                out.append(content.data(), size);
+            } else {
+                ok = send_all_data(sched, out.data(), out.size());
+                out.clear();
+                // 头部已发出，文件在发送中被截断时数据流无法继续，中止整个传输
+                for (off_t pos = 0; ok && pos < st.st_size; ) {
+                    ssize_t n = pread(fd, content.data(),
+                                      std::min<size_t>(content.size(), st.st_size - pos), pos);
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n <= 0) {
+                        ok = false;
+                        break;
+                    }
+                    crc = crc32(crc, reinterpret_cast<Bytef*>(content.data()), n);
+                    ok = send_all_data(sched, content.data(), n);
+                    pos += n;
+                }
+            }
+            char trailer[32];
+            snprintf(trailer, sizeof(trailer), "CRC %08lx\n", crc);
+            out += trailer;
+            sent_files++;
+
+            if (ok && out.size() >= MRETR_FLUSH_SIZE) {
+                ok = send_all_data(sched, out.data(), out.size());
+                out.clear();
+            }
+        }
+
+        if (ok) {
+            out += "END " + std::to_string(sent_files) + "\n";
+            ok = send_all_data(sched, out.data(), out.size());
+        }
+        transfer = nullptr;
+
+        close(data_sock);
+        close(data_listen_sock);
+        data_sock = -1;
+        data_listen_sock = -1;
+        if (ok) send_response("226 " + std::to_string(sent_files) + " files sent");
+        else send_response("426 Connection closed; transfer aborted");
+    }
+
+    // 处理CWD命令：切换当前目录（不能越出根目录）
+    void handle_cwd(const std::string& path) {
+        if (!fs.change_dir(path)) {
+            send_response("550 " + std::string(strerror(errno)));
+            return;
+        }
+        send_response("250 Directory changed to " + fs.pwd());
+    }
+
+    // ALLO <size> [R <record>]：预告下一个STOR的大小，空间不足时立即以452拒绝
+    void handle_allo(const std::string& arg) {
+        uint64_t size = 0;
+        if (!parse_size(arg, size)) {
+            send_response("501 Invalid size");
+            return;
+        }
+        struct statvfs vfs;
+        if (size > 0 && statvfs(ROOT_DIR, &vfs) == 0 &&
+            static_cast<uint64_t>(vfs.f_bavail) * vfs.f_frsize < size) {
+            alloc_size = 0;
+            send_response("452 Insufficient storage space");
+            return;
+        }
+        alloc_size = size;
+        send_response(size ? "200 ALLO " + std::to_string(size) + " bytes reserved for next STOR"
+                           : "202 No storage allocation necessary");
+    }
+
+    // REST <offset>：下一个STOR从offset续传未完成的上传（偏移须不超过SITE RESUME给出的值）
+    void handle_rest(const std::string& arg) {
+        char* end = nullptr;
+        errno = 0;
+        unsigned long long offset = strtoull(arg.c_str(), &end, 10);
+        if (errno != 0 || end == arg.c_str() || *end != '\0') {
+            send_response("501 Invalid offset");
+            return;
+        }
+        rest_offset = offset;
+        send_response("350 Restarting at " + std::to_string(offset) + ". Send STOR to resume");
+    }
+
+    // SITE RESUME <path>：查询未完成的上传可以从哪个偏移续传
+    void site_resume(const std::string& path) {
+        std::string rel;
+        uint64_t offset = 0;
+        if (!fs.normalize(path, rel) || !upload_journal->resumable(rel, offset)) {
+            send_response("550 No resumable upload for " + path);
+            return;
+        }
+        send_response("213 " + std::to_string(offset));
+    }
+
+    // 检查路径存在，返回其属性
+    bool lookup(const std::string& path, struct stat& st) {
+        std::string leaf;
+        DirRef dir = fs.parent(path, leaf);
+        return dir && fstatat(dir.get(), leaf.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0;
+    }
+
+    // RNFR <path>：记下改名的源路径，等待RNTO
+    void handle_rnfr(const std::string& path) {
+        struct stat st;
+        if (!lookup(path, st)) {
+            rename_from.clear();
+            send_response(std::string("550 ") + strerror(errno));
+            return;
+        }
+        rename_from = path;
+        send_response("350 Ready for RNTO");
+    }
+
+    // RNTO <path>：在服务器上用renameat改名/移动，不经过数据连接
+    void handle_rnto(const std::string& path) {
+        if (rename_from.empty()) {
+            send_response("503 Bad sequence of commands: RNFR first");
+            return;
+        }
+        std::string from = rename_from;
+        rename_from.clear();
+
+        struct stat st;
+        std::string old_leaf, new_leaf, old_rel, new_rel;
+        bool is_dir = lookup(from, st) && S_ISDIR(st.st_mode);
+        DirRef old_dir = fs.parent(from, old_leaf);
+        DirRef new_dir = old_dir ? fs.parent(path, new_leaf) : DirRef();
+        if (!new_dir || renameat(old_dir.get(), old_leaf.c_str(), new_dir.get(), new_leaf.c_str()) < 0) {
+            send_response(std::string("550 ") + strerror(errno));
+            return;
+        }
+
+        // 不等inotify，立即让本会话和共享缓存中的旧路径失效
+        if (is_dir) {
+            fs.invalidate();
+            SessionFs::directories_changed();
+        }
+        if (fs.normalize(from, old_rel)) fd_cache.invalidate(old_rel, is_dir);
+        if (fs.normalize(path, new_rel)) fd_cache.invalidate(new_rel, is_dir);
+        send_response("250 Rename successful");
+    }
+
+    // SITE CPFR <path>：记下复制的源文件
+    void site_cpfr(const std::string& path) {
+        struct stat st;
+        if (!lookup(path, st) || !S_ISREG(st.st_mode)) {
+            copy_from.clear();
+            send_response("550 Not a regular file");
+            return;
+        }
+        copy_from = path;
+        send_response("350 Ready for SITE CPTO");
+    }
+
+    // SITE CPTO <path>：在服务器上复制文件，优先reflink，其次copy_file_range
+    void site_cpto(const std::string& path) {
+        if (copy_from.empty()) {
+            send_response("503 Bad sequence of commands: SITE CPFR first");
+            return;
+        }
+        std::string from = copy_from;
+        copy_from.clear();
+
+        int src = fs.open_file(from, O_RDONLY);
+        struct stat st;
+        if (src < 0 || fstat(src, &st) < 0 || !S_ISREG(st.st_mode)) {
+            if (src >= 0) close(src);
+            send_response("550 Source file not found");
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        std::string error, report;
+        const char* method = copy_to_path(src, st.st_size, path, st.st_mode & 0777, error, report);
+        close(src);
+        if (!method) {
+            send_response(error);
+            return;
+        }
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        send_response((report.empty() ? "" : "250-Replicas:\r\n" + report) + "250 Copied " + std::to_string(st.st_size) + " bytes (" + method + ", " +
+                      std::to_string(ms) + " ms)");
+    }
+
+    // 逐个报告副本的结果，每个副本一行（多行回复的中间部分）
+    static std::string replica_report(const ReplicaSet& replicas, uint64_t written) {
+        std::string reply;
+        for (auto& r : replicas.replicas()) {
+            reply += " " + r.path + (r.error ? std::string(" FAILED: ") + strerror(r.error)
+                                             : " OK " + std::to_string(written) + " bytes (" +
+                                               (r.copy_bytes ? (r.tee_bytes ? "tee+copy" : "buffered") : "tee") + ")");
+            reply += "\r\n";
+        }
+        return reply;
+    }
+
+    // 把src的内容复制成path（reflink/copy_file_range/sendfile）。与STOR一样先复制到同目录的
+    // 临时文件（登记在上传日志中），落盘后rename替换目标文件：失败时目标文件保持原样；
+    // 路径有复制策略时从发布的文件复制出各副本，结果写入report（每个副本一行）
+    // 返回所用方法，失败返回nullptr并在error中给出回复
+    const char* copy_to_path(int src, uint64_t size, const std::string& path, mode_t mode,
+                             std::string& error, std::string& report) {
+        std::string rel, leaf, part_leaf;
+        if (!fs.normalize(path, rel) || rel.empty()) {
+            error = "550 Can't create file";
+            return nullptr;
+        }
+        UploadJournal::Upload upload;
+        std::vector<std::string> stale;
+        if (!upload_journal->begin(rel, 0, upload, stale, error)) return nullptr;
+        for (auto& part : stale) {
+            DirRef dir = fs.parent("/" + part, leaf);
+            if (dir) unlinkat(dir.get(), leaf.c_str(), 0);
+        }
+        std::string part_path = "/" + upload.part;
+        DirRef dir = fs.parent(path, leaf);
+        DirRef part_dir = fs.parent(part_path, part_leaf);
+        // 读写打开：副本从这个文件复制
+        int dst = part_dir ? openat(part_dir.get(), part_leaf.c_str(),
+                                    O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, mode) : -1;
+        if (!dir || dst < 0) {
+            error = std::string("550 ") + strerror(errno);
+            upload_journal->finish(upload.id);
+            return nullptr;
+        }
+        const char* method = copy_file_data(src, dst, size);
+        int saved = errno;
+        std::unique_ptr<ReplicaSet> replicas;
+        std::vector<ReplicaTarget> targets = replication.targets(rel);
+        if (method && !targets.empty()) {
+            replicas.reset(new ReplicaSet(targets, size));
+            replicas->seed(dst, size);
+        }
+        bool published = false;
+        int err;
+        if (method && (err = durability.commit(dst, -1)) != 0) {
+            saved = err;
+            method = nullptr;
+        } else if (method && renameat(part_dir.get(), part_leaf.c_str(), dir.get(), leaf.c_str()) < 0) {
+            saved = errno;
+            method = nullptr;
+        } else if (method) {
+            published = true;
+            if ((err = durability.commit(dst, dir.get())) != 0) {
+                saved = err;
+                method = nullptr;
+            }
+        }
+        // 副本在主文件发布之后才替换副本目录中的旧版本
+        if (replicas) replicas->finish(size, method != nullptr, durability);
+        if (close(dst) < 0 && method) {
+            saved = errno;
+            method = nullptr;
+        }
+        if (!published) unlinkat(part_dir.get(), part_leaf.c_str(), 0); // 不留下不完整的副本
+        if (method && replicas) report = replica_report(*replicas, size);
+        upload_journal->finish(upload.id);
+        fd_cache.invalidate(rel);
+        if (!method)
+            error = saved == ENOSPC || saved == EDQUOT ? "452 Insufficient storage space"
+                                                       : std::string("451 Copy failed: ") + strerror(saved);
+        return method;
+    }
+
+    // 处理MKD命令（创建目录）
+    void handle_mkd(const std::string& path) {
+        std::string leaf;
+        DirRef dir = fs.parent(path, leaf);
+        if (!dir || mkdirat(dir.get(), leaf.c_str(), 0777) < 0) {
+            send_response(std::string("550 ") + strerror(errno));
+            return;
+        }
+        send_response("257 \"" + path + "\" created");
+    }
+
+   // 处理RETR命令（文件下载）
+    void handle_retr(const std::string& filename) {
+        std::lock_guard<std::mutex> lock(data_mutex);
+        
+        // 同机客户端没有PASV时直接传递文件描述符
+        if (local && data_listen_sock == -1) {
+            retr_local(filename);
+            return;
+        }
+        if(data_listen_sock == -1) {
+            send_response("425 Use PASV first");
+            return;
+        }
+
+        // 建立数据连接
+        data_sock = accept_data();
+        if(data_sock < 0) {
+            send_response("425 Data connection failed");
+            return;
+        }
+
+        // 从共享缓存借用文件fd（相对会话根目录解析，".."和符号链接无法越界）
+        // 上传中的临时文件不对外提供
+        FdCache::Ref file;
+        if(FsWatcher::is_temp_name(filename) || !fd_cache.acquire(fs, filename, file)) {
+            send_response("550 File not found");
+            close(data_sock);
+            return;
+        }
+        int fd = file.fd();
+
+        send_response("150 Opening binary mode data connection");
+
+        // MODE Z：并行压缩后发送
+        if (mode_z) {
+            CacheCursor cache(fd, cache_policy(filename), file.st.st_size, false);
+            bool ok = retr_compressed(filename, fd, file.st.st_size);
+            cache.finish(file.st.st_size);
+            file.reset();
+            close(data_sock);
+            close(data_listen_sock);
+            data_sock = -1;
+            data_listen_sock = -1;
+            send_response(ok ? "226 Transfer complete" : "426 Connection closed; transfer aborted");
+            return;
+        }
+        
+        // 按路径策略预读并丢弃已发送的页，大文件不挤掉热点小文件的缓存
+        CacheCursor cache(fd, cache_policy(filename), file.st.st_size, false);
+
+        // 稀疏模式：只发送SEEK_DATA/SEEK_HOLE找到的数据区段
+        if (sparse) {
+            bool ok = retr_sparse(fd, file.st.st_size, cache);
+            cache.finish(file.st.st_size);
+            file.reset();
+            close(data_sock);
+            close(data_listen_sock);
+            data_sock = -1;
+            data_listen_sock = -1;
+            send_response(ok ? "226 Transfer complete" : "426 Connection closed; transfer aborted");
+            return;
+        }
+
+        // 超大文件：另开O_DIRECT的fd绕过页缓存（文件系统不支持时退回sendfile）
+        uint64_t threshold = direct_io_threshold;
+        if (threshold && static_cast<uint64_t>(file.st.st_size) >= threshold) {
+            int dfd = fs.open_file(filename, O_RDONLY | O_DIRECT);
+            if (dfd >= 0) {
+                bool ok = retr_direct(dfd, file.st.st_size);
+                close(dfd);
+                file.reset();
+                close(data_sock);
+                close(data_listen_sock);
+                data_sock = -1;
+                data_listen_sock = -1;
+                send_response(ok ? "226 Transfer complete" : "426 Connection closed; transfer aborted");
+                return;
+            }
+        }
+
+        // 每块发送前向调度器申请额度，保证多个传输公平分享带宽
+        ScheduledTransfer sched(scheduler, transfer_weight(), data_sock);
+        transfer = &sched;
+        bool ok = send_file_range(sched, fd, 0, file.st.st_size, cache);
+        transfer = nullptr;
+        cache.finish(file.st.st_size);
+        file.reset();
+
+        // 清理资源
+        close(data_sock);
+        close(data_listen_sock);
+        data_sock = -1;
+        data_listen_sock = -1;
+        send_response(ok ? "226 Transfer complete" : "426 Connection closed; transfer aborted");
+    }
+
+    // SITE RETRDIR <dir> [TAR|GZIP|ZSTD]：把整个目录打成tar流发送，可选压缩
+    // 边遍历边发送，不在磁盘上生成临时文件；不压缩时文件内容用sendfile发送
+    void site_retrdir(const std::vector<std::string>& tokens) {
+        std::string format = tokens.size() > 3 ? tokens[3] : "TAR";
+        std::transform(format.begin(), format.end(), format.begin(), ::toupper);
+        bool compress = format != "TAR";
+        ZEngine engine = format == "ZSTD" ? ZEngine::Zstd : ZEngine::Deflate;
+        if ((compress && format != "GZIP" && format != "ZSTD") ||
+            (engine == ZEngine::Zstd && !zstd_available())) {
+            send_response("504 Unsupported archive format");
+            return;
+        }
+
+        std::string rel;
+        int dir_fd = fs.normalize(tokens[2], rel) ? fs.open_file(tokens[2], O_RDONLY | O_DIRECTORY) : -1;
+        if (dir_fd < 0) {
+            send_response("550 Directory not found");
+            return;
+        }
+        // 归档内的条目以目录自身的名字为前缀，与tar -C <parent> <dir>一致
+        std::string top = rel.empty() ? "." : rel.substr(rel.rfind('/') + 1);
+        CachePolicy policy = cache_policy(tokens[2]);
+
+        std::lock_guard<std::mutex> lock(data_mutex);
+        if (data_listen_sock == -1) {
+            close(dir_fd);
+            send_response("425 Use PASV first");
+            return;
+        }
+        data_sock = accept_data();
+        if (data_sock < 0) {
+            close(dir_fd);
+            send_response("425 Data connection failed");
+            return;
+        }
+        send_response("150 Opening data connection for " + top + ".tar" +
+                      (compress ? (engine == ZEngine::Zstd ? ".zst" : ".gz") : ""));
+
+        ScheduledTransfer sched(scheduler, transfer_weight(), data_sock);
+        transfer = &sched;
+        std::unique_ptr<StreamCompressor> zstream;
+        if (compress) zstream.reset(new StreamCompressor(engine, engine == ZEngine::Zstd ? 3 : z_level));
+        auto to_socket = [&](const char* data, size_t len) { return send_all_data(sched, data, len); };
+
+        // 头部等小块先合并，发送文件内容前再一起发出
+        std::string pending;
+        std::vector<char> chunk;
+        auto flush = [&]() {
+            bool ok = compress ? zstream->feed(pending.data(), pending.size(), to_socket)
+                               : send_all_data(sched, pending.data(), pending.size());
+            pending.clear();
+            return ok;
+        };
+        TarStreamWriter tar(
+            [&](const char* data, size_t len) {
+                pending.append(data, len);
+                return pending.size() < MRETR_FLUSH_SIZE || flush();
+            },
+            [&](int fd, uint64_t size) -> int64_t {
+                if (!pending.empty() && !flush()) return -1;
+                CacheCursor cache(fd, policy, size, false);
+                uint64_t done = 0;
+                if (!compress) {
+                    // 文件在遍历期间被截断时sendfile返回0，不足部分由TarStreamWriter补零
+                    while (done < size) {
+                        cache.advance(done);
+                        size_t want = schedule(sched, std::min<uint64_t>(SENDFILE_CHUNK, size - done));
+                        off_t off = done;
+                        ssize_t sent = want ? sendfile(data_sock, fd, &off, want) : -1;
+                        sched.charge(sent > 0 ? sent : 0);
+                        if (sent < 0 && want && (errno == EINTR || errno == EAGAIN)) continue;
+                        if (sent < 0) return -1;
+                        if (sent == 0) break;
+                        done += sent;
+                        throttle(sent);
+                    }
+                } else {
+                    chunk.resize(RETRDIR_READ_CHUNK);
+                    while (done < size) {
+                        cache.advance(done);
+                        ssize_t n = pread(fd, chunk.data(), std::min<uint64_t>(chunk.size(), size - done), done);
+                        if (n < 0 && errno == EINTR) continue;
+                        if (n < 0) return -1;
+                        if (n == 0) break;
+                        if (!zstream->feed(chunk.data(), n, to_socket)) return -1;
+                        done += n;
+                    }
+                }
+                cache.finish(done);
+                return done;
+            });
+        bool ok = tar.write_tree(dir_fd, top) && (pending.empty() || flush());
+        if (ok && compress) ok = zstream->finish(to_socket);
+        transfer = nullptr;
+
+        close(data_sock);
+        close(data_listen_sock);
+        data_sock = -1;
+        data_listen_sock = -1;
+        const TarStreamWriter::Stats& st = tar.stats();
+        if (ok) {
+            send_response("226 " + std::to_string(st.files) + " files, " + std::to_string(st.dirs) +
+                          " directories, " + std::to_string(st.bytes) + " bytes archived" +
+                          (st.skipped ? ", " + std::to_string(st.skipped) + " skipped" : ""));
+        } else {
+            send_response("426 Connection closed; transfer aborted");
+        }
+    }
+
+    // SITE DSTOR <file>：增量上传。服务器先在数据连接上发出现有版本的块签名并关闭写方向，
+    // 客户端回送增量流；未变的块用copy_file_range从旧文件复制，重建到临时文件后rename发布
+    void site_dstor(const std::string& filename) {
+        std::string rel, leaf;
+        DirRef dir = fs.normalize(filename, rel) && !rel.empty() ? fs.parent(filename, leaf) : DirRef();
+        int dirfd = dir.get(); // 由dir持有到函数结束
+        if (dirfd < 0) {
+            send_response("550 Can't create file");
+            return;
+        }
+        std::lock_guard<std::mutex> lock(data_mutex);
+        if (data_listen_sock == -1) {
+            send_response("425 Use PASV first");
+            return;
+        }
+        // 文件不存在时没有旧版本，签名为空，客户端发来的全是新数据
+        int old_fd = openat(dirfd, leaf.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        struct stat st{};
+        if (old_fd >= 0 && (fstat(old_fd, &st) < 0 || !S_ISREG(st.st_mode))) {
+            close(old_fd);
+            send_response("550 Not a regular file");
+            return;
+        }
+        uint64_t old_size = old_fd >= 0 ? st.st_size : 0;
+        std::string tmp_leaf = "." + leaf + "." + std::to_string(info->id) + ".delta";
+        int out = openat(dirfd, tmp_leaf.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644);
+        if (out < 0) {
+            if (old_fd >= 0) close(old_fd);
+            send_response("550 Can't create file");
+            return;
+        }
+        data_sock = accept_data();
+        uint32_t block = delta_block_size(old_size);
+        bool ok = data_sock >= 0;
+        if (ok) send_response("150 Sending block signatures (" + std::to_string(block) + " byte blocks)");
+
+        {
+            ScheduledTransfer sched(scheduler, transfer_weight(), data_sock);
+            transfer = &sched;
+            ok = ok && DeltaSignature::build(old_fd, old_size, block,
+                                             [&](const char* data, size_t len) { return send_all_data(sched, data, len); });
+            transfer = nullptr;
+        }
+        if (ok) shutdown(data_sock, SHUT_WR);
+        // 接收不经过调度器：发送方的速度由它自己决定，只按限速控制
+        DeltaApplier applier(old_fd, old_size, block, out);
+        std::vector<char> buffer(STOR_BUFFER_SIZE);
+        while (ok && !applier.done()) {
+            ssize_t bytes = recv(data_sock, buffer.data(), buffer.size(), 0);
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes <= 0) break;
+            throttle(bytes);
+            ok = applier.feed(buffer.data(), bytes);
+        }
 
-        char buffer[BUFFER_SIZE];
-        while (server_running) {
-            std::cout<<"2"<<std::endl;
-            
-                memset(buffer, 0, BUFFER_SIZE);
-                ssize_t bytes = recv(ctrl_sock, buffer, BUFFER_SIZE, 0);
-                std::cout << "收到命令: " << buffer << std::endl; // 添加此行
-                if (bytes <= 0) break;
-            std::string cmd(buffer);
-            cmd.erase(cmd.find_last_not_of("\r\n") + 1); // 清理命令结尾
-
-            // 命令解析
-            std::istringstream iss(cmd);//创建一个字符串流 iss，用于从字符串 cmd 中读取数据。
-            std::vector<std::string> tokens;
-            std::string token;
-            while(iss >> token) tokens.push_back(token);//从字符串流 iss 中逐个读取令牌，并将其添加到 tokens 向量中。
-            if(tokens.empty()) continue;
-            std::cout<<"1"<<std::endl;
-            std::string command = tokens[0];
-            std::transform(command.begin(), command.end(), command.begin(), ::toupper);//用于对容器中的元素进行转换操作
-
-            if (command == "USER") {
-                send_response("331 Please specify the password");
-            } 
-            else if (command == "PASS") {
-                send_response("230 Login successful");
-            }
-            else if (command == "PASV") {
-                handle_pasv();
-            }
-            else if (command == "LIST") {
-                handle_list();
-            }
-            else if (command == "RETR" && tokens.size() > 1) {
-                handle_retr(tokens[1]);
-            }
-            else if (command == "STOR" && tokens.size() > 1) {
-                handle_stor(tokens[1]);
-            }
-            else if (command == "QUIT") {
-                send_response("221 Goodbye");
-                break;
-            }
-            else {
-                send_response("500 Unknown command");
+        std::string reply;
+        bool renamed = false;
+        int err = applier.error();
+        if (data_sock < 0) reply = "425 Data connection failed";
+        else if (err) reply = err == ENOSPC || err == EDQUOT ? "452 Insufficient storage space" : "451 本地文件写入错误";
+        else if (applier.corrupt()) reply = "451 Invalid delta stream";
+        else if (!ok || !applier.done()) reply = "426 Connection closed; transfer aborted";
+        // 发布：数据落盘后rename替换旧文件，再同步目录项
+        else if ((err = durability.commit(out, -1)) != 0) reply = std::string("451 Sync failed: ") + strerror(err);
+        else if (renameat(dirfd, tmp_leaf.c_str(), dirfd, leaf.c_str()) < 0)
+            reply = std::string("451 Can't publish file: ") + strerror(errno);
+        else {
+            renamed = true;
+            if ((err = durability.commit(out, dirfd)) != 0) reply = std::string("451 Sync failed: ") + strerror(err);
+        }
+        if (!renamed) unlinkat(dirfd, tmp_leaf.c_str(), 0);
+        if (reply.empty()) {
+            // 副本整份复制（副本目录下的旧版本不一定与主文件一致，不能按增量更新）
+            std::vector<ReplicaTarget> targets = replication.targets(rel);
+            if (!targets.empty()) {
+                ReplicaSet replicas(targets, applier.size());
+                replicas.seed(out, applier.size());
+                replicas.finish(applier.size(), true, durability);
             }
         }
+        close(out);
+        if (old_fd >= 0) close(old_fd);
+        fd_cache.invalidate(rel);
+
+        if (data_sock >= 0) close(data_sock);
+        close(data_listen_sock);
+        data_sock = -1;
+        data_listen_sock = -1;
+        const DeltaApplier::Stats& ds = applier.stats();
+        send_response(reply.empty() ? "226 Delta applied: " + std::to_string(ds.copied) + " bytes reused, " +
+                                          std::to_string(ds.received) + " bytes received"
+                                    : reply);
     }
 
-private:
-    // 处理PASV命令（被动模式）
-    void handle_pasv() {
+    // SITE DRETR <file>：增量下载。客户端先在数据连接上发来本地旧版本的块签名并关闭写方向，
+    // 服务器对照签名把文件编码成增量流发回
+    void site_dretr(const std::string& filename) {
         std::lock_guard<std::mutex> lock(data_mutex);
-        
-        // if(data_listen_sock != -1) {
-        //     close(data_listen_sock);
-        //     data_listen_sock = -1;
-        // }
-
-        // 创建数据监听socket
-        data_listen_sock = socket(AF_INET, SOCK_STREAM, 0);
-        if(data_listen_sock < 0) {
-            send_response("500 Internal server error");
+        if (data_listen_sock == -1) {
+            send_response("425 Use PASV first");
             return;
         }
-
-        // 绑定随机端口
-        sockaddr_in data_addr{};
-        data_addr.sin_family = AF_INET;
-        data_addr.sin_addr.s_addr = INADDR_ANY;
-        data_addr.sin_port = 0; // 自动分配端口
-
-        if(bind(data_listen_sock, (sockaddr*)&data_addr, sizeof(data_addr)) < 0) {
-            send_response("500 Port allocation failed");
-            close(data_listen_sock);
-            data_listen_sock = -1;
+        int fd = FsWatcher::is_temp_name(filename) ? -1 : fs.open_file(filename, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+            if (fd >= 0) close(fd);
+            send_response("550 File not found");
             return;
         }
-
-        // 开始监听
-        if(listen(data_listen_sock, 1) < 0) {
-            send_response("500 Listen failed");
-            close(data_listen_sock);
-            data_listen_sock = -1;
+        data_sock = accept_data();
+        if (data_sock < 0) {
+            close(fd);
+            send_response("425 Data connection failed");
             return;
         }
+        send_response("150 Send block signatures");
 
-        // 获取绑定的端口号
-        socklen_t addr_len = sizeof(data_addr);
-        getsockname(data_listen_sock, (sockaddr*)&data_addr, &addr_len);//getsockname 可以用于获取绑定到套接字的实际地址和端口。
-        uint16_t port = ntohs(data_addr.sin_port);// 获取端口号（网络字节序转主机字节序）
-
-        // 构造响应字符串
-        std::string ip_str = SERVER_IP;
-        std::replace(ip_str.begin(), ip_str.end(), '.', ',');
-        std::ostringstream oss;
-        //在FTP的PASV模式响应中，端口号需要被分解为高8位和低8位两个部分
-        oss << "227 Entering Passive Mode (" 
-            << ip_str << "," 
-            << (port >> 8) << "," //高8位
-            << (port & 0xff) << ")";// 低8位
-        
-        send_response(oss.str());
+        DeltaSignature sig;
+        char buffer[64 * 1024];
+        bool ok = true;
+        while (ok) {
+            ssize_t bytes = recv(data_sock, buffer, sizeof(buffer), 0);
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes <= 0) break;
+            ok = sig.feed(buffer, bytes);
+        }
+        std::string reply;
+        if (!ok || !sig.complete()) {
+            reply = "451 Invalid signature stream";
+        } else {
+            ScheduledTransfer sched(scheduler, transfer_weight(), data_sock);
+            transfer = &sched;
+            DeltaEncoder encoder(sig);
+            if (encoder.encode(fd, st.st_size,
+                               [&](const char* data, size_t len) { return send_all_data(sched, data, len); })) {
+                reply = "226 Delta sent: " + std::to_string(encoder.stats().matched) + " bytes reused, " +
+                        std::to_string(encoder.stats().literal) + " bytes sent";
+            } else {
+                reply = "426 Connection closed; transfer aborted";
+            }
+            transfer = nullptr;
+        }
+        close(fd);
+        close(data_sock);
+        close(data_listen_sock);
+        data_sock = -1;
+        data_listen_sock = -1;
+        send_response(reply);
     }
 
+    // SITE WATCH <dir> [seconds]：长轮询，等到目录中有文件新建、写完关闭或改名时返回，
+    // 最多等待seconds秒（默认WATCH_TIMEOUT，0为只取已累积的变化）
+    //   213-<n> changes in <dir>
+    //    CREATE,CLOSE_WRITE <name>    同一文件的多个事件合并为一行
+    //    RENAME_TO <name>
+    //    OVERFLOW                     事件过多被丢弃，应重新LIST
+    //    GONE                         目录已删除或被移走，订阅随之取消
+    //   213 End
+    // 没有变化时回复"213 No changes"。订阅在会话内保留，两次SITE WATCH之间的变化留到下一次返回；
+    // 等待期间收到新命令或连接断开时提前返回
+    void site_watch(const std::vector<std::string>& tokens) {
+        std::string rel;
+        struct stat st;
+        if (!fs.normalize(tokens[2], rel) || !lookup(tokens[2], st) || !S_ISDIR(st.st_mode)) {
+            send_response("550 Not a directory");
+            return;
+        }
+        long seconds = tokens.size() > 3 ? atol(tokens[3].c_str()) : WATCH_TIMEOUT;
+        seconds = std::max(0L, std::min<long>(seconds, WATCH_MAX_TIMEOUT));
+        if (!watch_sub || watch_sub->dir != rel) {
+            drop_watch();
+            watch_sub = watch_hub.subscribe(rel);
+            if (!watch_sub) {
+                send_response("550 Cannot watch directory: " + std::string(strerror(errno)));
+                return;
+            }
+        }
 
-void handle_list() {
-    std::lock_guard<std::mutex> lock(data_mutex);
-    
-    if (data_listen_sock == -1) {
-        send_response("425 Use PASV first");
-        return;
+        watch_wake = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+        watch_settling = false;
+        if (on_reactor) {
+            watching = true; // 回到resume()后停放等待，由watch_step()回复
+            return;
+        }
+        watch_wait();
     }
 
-    // 必须接受数据连接
-    sockaddr_in client_addr{};
-    socklen_t addr_len = sizeof(client_addr);
-    data_sock = accept(data_listen_sock, 
-                      (sockaddr*)&client_addr, &addr_len);
-    if (data_sock < 0) {
-        send_response("425 Data connection failed");
-        return;
+    // 在当前线程阻塞等待并回复（不经reactor的会话）
+    void watch_wait() {
+        auto interrupted = [this] {
+            struct pollfd pfd = {ctrl_sock, POLLIN | POLLRDHUP, 0};
+            return poll(&pfd, 1, 0) > 0;
+        };
+        std::map<std::string, uint32_t> changes;
+        bool overflow = false, gone = false;
+        if (!watch_hub.wait(*watch_sub, watch_wake, interrupted, changes, overflow, gone)) {
+            send_response("213 No changes");
+            return;
+        }
+        watch_reply(changes, overflow, gone);
     }
 
-    send_response("150 Here comes the directory listing");
+    // 停放的会话被唤醒后检查SITE WATCH：可以回复时回复并返回true，否则返回false继续停放。
+    // 第一个变化到达后把截止时间提前到WATCH_COALESCE_MS之后，同一批写入的事件一起返回；
+    // 溢出、目录消失、控制连接上有新命令或断开时立即回复
+    bool watch_step() {
+        bool urgent = false;
+        bool ready = watch_hub.pending(*watch_sub, urgent);
+        auto now = std::chrono::steady_clock::now();
+        struct pollfd pfd = {ctrl_sock, POLLIN | POLLRDHUP, 0};
+        bool interrupted = !ctrl_buf.empty() || poll(&pfd, 1, 0) > 0;
+        if (!interrupted && !urgent && now < watch_wake) {
+            if (ready && !watch_settling) {
+                watch_settling = true;
+                watch_wake = std::min(watch_wake, now + std::chrono::milliseconds(WATCH_COALESCE_MS));
+            }
+            return false;
+        }
+        watching = false;
+        std::map<std::string, uint32_t> changes;
+        bool overflow = false, gone = false;
+        if (watch_hub.take(*watch_sub, changes, overflow, gone)) watch_reply(changes, overflow, gone);
+        else send_response("213 No changes");
+        return true;
+    }
 
-    // 生成完整目录列表
-    std::string list;
-    DIR* dir = opendir(current_dir.c_str());
-    if (dir) {
-        dirent* entry;
-        while ((entry = readdir(dir)) != nullptr) {
-            if (strcmp(entry->d_name, ".") == 0 || 
-                strcmp(entry->d_name, "..") == 0) continue;
-                
-            list += entry->d_name;
-            list += "\r\n"; // 必须使用CRLF
+    void watch_reply(const std::map<std::string, uint32_t>& changes, bool overflow, bool gone) {
+        std::ostringstream oss;
+        oss << "213-" << changes.size() << " changes in /" << watch_sub->dir << "\r\n";
+        for (auto& c : changes) oss << " " << WatchHub::mask_names(c.second) << " " << c.first << "\r\n";
+        if (overflow) oss << " OVERFLOW\r\n";
+        if (gone) {
+            oss << " GONE\r\n";
+            drop_watch();
         }
-        closedir(dir);
-        
-        // 一次性发送完整列表
-        send(data_sock, list.c_str(), list.size(), 0);
+        oss << "213 End";
+        send_response(oss.str());
     }
 
-    // 关闭数据连接（保留监听socket）
-    close(data_sock);
-    data_sock = -1;
-    
-    send_response("226 Directory send OK");
-}
+    // 取消订阅；订阅的eventfd随之关闭，先从reactor的epoll中移除
+    void drop_watch() {
+        session_reactor.drop_extra(this);
+        watch_hub.unsubscribe(watch_sub);
+        watch_sub.reset();
+    }
 
-   // 处理RETR命令（文件下载）
-    void handle_retr(const std::string& filename) {
-        if(!is_safe_path(filename)) {
-            send_response("550 Invalid filename");
+    // SITE FIND <glob|prefix> [dir]：在文件名索引中查找，经数据连接每行返回一个路径（目录以/结尾）。
+    // 不含通配符时按文件名前缀匹配；含/时与完整路径匹配。dir限定查找范围
+    void site_find(const std::vector<std::string>& tokens) {
+        std::string dir;
+        if (tokens.size() > 3 && !fs.normalize(tokens[3], dir)) {
+            send_response("550 Invalid directory");
             return;
         }
-
         std::lock_guard<std::mutex> lock(data_mutex);
-        
-        if(data_listen_sock == -1) {
+        if (data_listen_sock == -1) {
             send_response("425 Use PASV first");
             return;
         }
-
-        // 建立数据连接
-        data_sock = accept(data_listen_sock, nullptr, nullptr);
-        if(data_sock < 0) {
-            send_response("425 Data connection failed");
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::string> results;
+        bool truncated = false;
+        if (!name_index.find(tokens[2], dir, FIND_MAX_RESULTS, results, truncated)) {
+            send_response("450 Index not ready, try again later");
             return;
         }
-
-        // 打开文件
-        std::string fullpath = current_dir + "/" + filename;
-        std::ifstream file(fullpath, std::ios::binary);//以二进制模式（std::ios::binary）打开文件。
-        if(!file) {
-            send_response("550 File not found");
-            close(data_sock);
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        data_sock = accept_data();
+        if (data_sock < 0) {
+            send_response("425 Data connection failed");
             return;
         }
+        send_response("150 Sending " + std::to_string(results.size()) + " matches");
 
-        send_response("150 Opening binary mode data connection");
-        
-        // 分块传输文件
-        char buffer[BUFFER_SIZE];
-        // while(file.read(buffer, BUFFER_SIZE)) {
-        //     if(send(data_sock, buffer, file.gcount(), 0) < 0) {
-        //         break;
-        //     }
-        // }
-         while (true) {
-        file.read(buffer, sizeof(buffer));
-        std::streamsize bytes_read = file.gcount();
-        if (bytes_read <= 0) break;
-
-        ssize_t total_sent = 0;
-        while (total_sent < bytes_read) {
-            ssize_t sent = send(data_sock, 
-                              buffer + total_sent, 
-                              bytes_read - total_sent, 
-                              MSG_NOSIGNAL);
-            if (sent <= 0) {
-                std::cerr << "发送失败: " << strerror(errno) << std::endl;
-                break;
+        ScheduledTransfer sched(scheduler, transfer_weight(), data_sock);
+        transfer = &sched;
+        std::string pending;
+        bool ok = true;
+        for (auto& path : results) {
+            pending += path + "\n";
+            if (pending.size() >= MRETR_FLUSH_SIZE) {
+                ok = send_all_data(sched, pending.data(), pending.size());
+                pending.clear();
+                if (!ok) break;
             }
-            total_sent += sent;
         }
+        if (ok && !pending.empty()) ok = send_all_data(sched, pending.data(), pending.size());
+        transfer = nullptr;
+        close(data_sock);
+        close(data_listen_sock);
+        data_sock = -1;
+        data_listen_sock = -1;
+        if (!ok) {
+            send_response("426 Connection closed; transfer aborted");
+            return;
+        }
+        auto st = name_index.stats();
+        send_response("226 " + std::to_string(results.size()) + " matches" + (truncated ? " (truncated)" : "") +
+                      " in " + std::to_string(us) + " us; index " + std::to_string(st.entries) + " entries, " +
+                      std::to_string(st.bytes) + " bytes");
     }
 
+    // SITE MANIFEST [SINCE <gen>] [dir]：经数据连接发送dir下的文件清单（路径相对dir）
+    //   MANIFEST <gen> FULL|DELTA                   gen供下次SINCE使用；FULL时未列出的文件都已不存在
+    //   F <gen> <size> <mtime> <sha256|-> <path>    新增或修改的文件（摘要尚未算出时为-）
+    //   D <gen> <path>                              已删除（只在DELTA中出现）
+    //   END <count>
+    void site_manifest(const std::vector<std::string>& tokens) {
+        size_t arg = 2;
+        uint64_t since = 0;
+        if (tokens.size() > arg + 1 && strcasecmp(tokens[arg].c_str(), "SINCE") == 0) {
+            since = strtoull(tokens[arg + 1].c_str(), nullptr, 10);
+            arg += 2;
+        }
+        std::string dir;
+        if (tokens.size() > arg && !fs.normalize(tokens[arg], dir)) {
+            send_response("550 Invalid directory");
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(data_mutex);
+        if (data_listen_sock == -1) {
+            send_response("425 Use PASV first");
+            return;
+        }
+        std::vector<Manifest::Entry> entries;
+        bool full = false;
+        uint64_t current = 0;
+        if (!manifest.query(since, dir, entries, full, current)) {
+            send_response("450 Manifest not ready, try again later");
+            return;
+        }
+        data_sock = accept_data();
+        if (data_sock < 0) {
+            send_response("425 Data connection failed");
+            return;
+        }
+        send_response("150 Sending manifest (" + std::to_string(entries.size()) + " entries)");
 
-        // 清理资源
+        ScheduledTransfer sched(scheduler, transfer_weight(), data_sock);
+        transfer = &sched;
+        std::string pending = "MANIFEST " + std::to_string(current) + (full ? " FULL\n" : " DELTA\n");
+        size_t skip = dir.empty() ? 0 : dir.size() + 1;
+        bool ok = true;
+        uint64_t count = 0;
+        for (auto& e : entries) {
+            if (e.path.size() <= skip) continue; // dir本身是文件
+            std::string name = e.path.substr(skip);
+            if (e.deleted) {
+                pending += "D " + std::to_string(e.gen) + " " + name + "\n";
+            } else {
+                pending += "F " + std::to_string(e.gen) + " " + std::to_string(e.size) + " " +
+                           std::to_string(e.mtime) + " " + (e.hash.empty() ? "-" : e.hash) + " " + name + "\n";
+            }
+            count++;
+            if (pending.size() >= MRETR_FLUSH_SIZE) {
+                ok = send_all_data(sched, pending.data(), pending.size());
+                pending.clear();
+                if (!ok) break;
+            }
+        }
+        if (ok) {
+            pending += "END " + std::to_string(count) + "\n";
+            ok = send_all_data(sched, pending.data(), pending.size());
+        }
+        transfer = nullptr;
         close(data_sock);
         close(data_listen_sock);
         data_sock = -1;
         data_listen_sock = -1;
-        send_response("226 Transfer complete");
+        send_response(ok ? "226 Manifest sent: " + std::to_string(count) + " entries"
+                         : "426 Connection closed; transfer aborted");
     }
 
-    // 处理STOR命令（文件上传）
-    void handle_stor(const std::string& filename) {
-        if(!is_safe_path(filename)) {
-            send_response("550 Invalid filename");
+    // 用sendfile从fd按显式偏移发送[offset, offset + len)，不经过用户态缓冲
+    bool send_file_range(ScheduledTransfer& sched, int fd, off_t offset, uint64_t len,
+                         CacheCursor& cache) {
+        while (len > 0) {
+            cache.advance(offset);
+            size_t want = schedule(sched, std::min<uint64_t>(SENDFILE_CHUNK, len));
+            ssize_t sent = want ? sendfile(data_sock, fd, &offset, want) : -1;
+            sched.charge(sent > 0 ? sent : 0);
+            if (sent < 0 && want && (errno == EINTR || errno == EAGAIN)) continue;
+            if (sent <= 0) {
+                if (sent < 0) std::cerr << "发送失败: " << strerror(errno) << std::endl;
+                return false; // 出错，或文件在传输中被截断
+            }
+            len -= sent;
+            throttle(sent);
+        }
+        return true;
+    }
+
+    // 同机RETR：新打开一个只读fd随150回复发给客户端，客户端自己读取，文件数据不经过socket
+    // 不借用fd缓存中的描述符，否则客户端的read会移动共享的文件偏移
+    void retr_local(const std::string& filename) {
+        int fd = FsWatcher::is_temp_name(filename) ? -1 : fs.open_file(filename, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+            if (fd >= 0) close(fd);
+            send_response("550 File not found");
+            return;
+        }
+        std::string msg = "150 File descriptor attached (" + std::to_string(st.st_size) + " bytes)\r\n";
+        bool ok = send_with_fd(ctrl_sock, msg.data(), msg.size(), fd);
+        close(fd);
+        if (ok) send_response("226 Transfer complete");
+    }
+
+    // 同机STOR：从客户端传来的源文件fd复制到目标文件，与STOR一样经临时文件发布并写入副本
+    void stor_local(const std::string& filename) {
+        int src = passed_fd;
+        passed_fd = -1;
+        alloc_size = 0; // 复制时按源文件大小分配，不需要ALLO
+        rest_offset = 0; // 总是复制整个文件
+        struct stat st;
+        int flags = fcntl(src, F_GETFL);
+        if (fstat(src, &st) < 0 || !S_ISREG(st.st_mode) || flags < 0 || (flags & O_ACCMODE) == O_WRONLY) {
+            close(src);
+            send_response("501 Passed descriptor is not a readable regular file");
+            return;
+        }
+        send_response("150 Copying from passed file descriptor");
+        std::string error, report;
+        const char* method = copy_to_path(src, st.st_size, filename, 0644, error, report);
+        close(src);
+        if (!method) {
+            send_response(error);
             return;
         }
+        send_response((report.empty() ? "" : "226-Replicas:\r\n" + report) + "226 Transfer complete (" + std::to_string(st.st_size) + " bytes, " + method + ")");
+    }
+
+    // 稀疏RETR：每个数据区段先发段头再发数据，最后发送文件总长度
+    bool retr_sparse(int fd, uint64_t size, CacheCursor& cache) {
+        ScheduledTransfer sched(scheduler, transfer_weight(), data_sock);
+        transfer = &sched;
+        bool ok = sparse_segments(fd, size, [&](uint64_t offset, uint64_t len) {
+            std::string header = sparse_data_header(offset, len);
+            return send_all_data(sched, header.data(), header.size()) &&
+                   send_file_range(sched, fd, offset, len, cache);
+        });
+        if (ok) {
+            std::string end = sparse_end(size);
+            ok = send_all_data(sched, end.data(), end.size());
+        }
+        transfer = nullptr;
+        return ok;
+    }
 
+    // 处理STOR命令（文件上传）
+    void handle_stor(const std::string& filename) {
         std::lock_guard<std::mutex> lock(data_mutex);
         
+        // 同机客户端随STOR传来源文件描述符时，由内核直接复制，不经过数据连接
+        if (local && passed_fd >= 0) {
+            stor_local(filename);
+            return;
+        }
         if(data_listen_sock == -1) {
             send_response("425 Use PASV first");
             return;
         }
+        // 数据先写入同目录的临时文件并登记到上传日志，完成后rename发布；
+        // REST给出偏移时接着之前未完成的上传写
+        uint64_t rest = rest_offset;
+        rest_offset = 0;
+        std::string rel_path;
+        if (!fs.normalize(filename, rel_path) || rel_path.empty()) {
+            send_response("550 Can't create file");
+            return;
+        }
+        UploadJournal::Upload upload;
+        std::vector<std::string> stale;
+        std::string journal_error;
+        if (!upload_journal->begin(rel_path, rest, upload, stale, journal_error)) {
+            send_response(journal_error);
+            return;
+        }
+        for (auto& part : stale) { // 被新上传作废的临时文件
+            std::string leaf;
+            DirRef dir = fs.parent("/" + part, leaf);
+            if (dir) unlinkat(dir.get(), leaf.c_str(), 0);
+        }
+        std::string part_path = "/" + upload.part;
+        uint64_t checkpointed = rest; // 日志中记录的可续传偏移
+        // 上传失败：有检查点时保留临时文件等待续传，否则删除
+        auto abandon = [&]() {
+            if (checkpointed > 0) {
+                upload_journal->release(upload.id);
+                return;
+            }
+            std::string leaf;
+            DirRef dir = fs.parent(part_path, leaf);
+            if (dir) unlinkat(dir.get(), leaf.c_str(), 0);
+            upload_journal->finish(upload.id);
+        };
+
         send_response("150 Ready to receive data");
         // 建立数据连接
-        data_sock = accept(data_listen_sock, nullptr, nullptr);
+        data_sock = accept_data();
         if(data_sock < 0) {
             send_response("425 Data connection failed");
+            if (rest) upload_journal->release(upload.id);
+            else upload_journal->finish(upload.id);
             return;
         }
 
-        // 创建文件
-        std::string fullpath = current_dir + "/" + filename;
-        std::ofstream file(fullpath, std::ios::binary);
-        if(!file) {
+        // 创建临时文件（读写打开：splice写入的数据要读回计算检查点的校验和）
+        int fd = fs.open_file(part_path, O_RDWR | O_CREAT | O_NOFOLLOW | (rest ? 0 : O_TRUNC), 0644);
+        if(fd < 0) {
             send_response("550 Can't create file");
+            if (rest) upload_journal->release(upload.id);
+            else upload_journal->finish(upload.id);
+            close(data_sock);
+            return;
+        }
+
+        // 续传：丢弃检查点之后未验证的数据；续传点在检查点之前时重新计算前缀的校验和
+        uint32_t crc = upload.crc;
+        if (rest) {
+            struct stat st;
+            bool valid = fstat(fd, &st) == 0 && static_cast<uint64_t>(st.st_size) >= rest &&
+                         (rest == upload.offset || UploadJournal::prefix_crc(fd, rest, crc)) &&
+                         ftruncate(fd, rest) == 0 && lseek(fd, rest, SEEK_SET) == static_cast<off_t>(rest);
+            if (!valid) {
+                close(fd);
+                checkpointed = 0;
+                abandon();
+                close(data_sock);
+                close(data_listen_sock);
+                data_sock = -1;
+                data_listen_sock = -1;
+                send_response("554 Partial upload is missing or damaged");
+                return;
+            }
+            if (rest != upload.offset) upload_journal->checkpoint(upload.id, rest, crc);
+        }
+
+        // 预分配空间减少碎片：ALLO给出大小时一次分配整个文件，
+        // 否则随写入进度以KEEP_SIZE提前分配PREALLOC_STEP；空间不足立即返回452
+        uint64_t alloc = alloc_size;
+        alloc_size = 0;
+        uint64_t reserved = rest; // 已预分配到的偏移
+        uint64_t written = rest;  // 已写入的字节数
+        bool prealloc = !sparse; // 稀疏上传不预分配，否则空洞会被填满
+        // 至少保证need字节，尽量多分配ahead字节；连need都分配不到时返回false
+        auto reserve = [&](uint64_t need, uint64_t ahead, int mode) {
+            for (uint64_t upto : {need + ahead, need}) {
+                if (!prealloc || upto <= reserved) return true;
+                if (fallocate(fd, mode, reserved, upto - reserved) == 0) {
+                    reserved = upto;
+                    return true;
+                }
+                if (errno != ENOSPC && errno != EDQUOT) {
+                    prealloc = false; // 文件系统不支持fallocate，退回普通写入
+                    return true;
+                }
+            }
+            return false;
+        };
+        if (alloc ? !reserve(alloc, 0, 0) : !reserve(rest, PREALLOC_STEP, FALLOC_FL_KEEP_SIZE)) {
+            close(fd);
+            abandon();
             close(data_sock);
+            close(data_listen_sock);
+            data_sock = -1;
+            data_listen_sock = -1;
+            send_response("452 Insufficient storage space");
             return;
         }
 
@@ -327,36 +2346,260 @@ void handle_list() {
         //             file.write(buffer, bytes);
         //             total += bytes;
         //         }
-        char buffer[BUFFER_SIZE];
+    std::vector<char> buffer(STOR_BUFFER_SIZE);
     ssize_t total = 0;
+    bool ok = true;
+
+    // 按路径策略同时写入副本目录
+    std::unique_ptr<ReplicaSet> replicas;
+    std::vector<ReplicaTarget> targets = replication.targets(rel_path);
+    if (!targets.empty()) {
+        replicas.reset(new ReplicaSet(targets, alloc));
+        if (rest) replicas->seed(fd, rest); // 续传：副本先补上已上传的部分
+    }
+
+    // MODE Z：边接收边解压
+    std::unique_ptr<StreamDecompressor> inflater;
+    if (mode_z) inflater.reset(new StreamDecompressor(z_engine));
+    // 边接收边计算摘要，上传结束时即写入缓存
+    Hasher hasher(hash_algo);
+    bool write_failed = false;
+    bool no_space = false;
+    // 大文件边写边回写并丢弃页缓存，避免脏页挤占热点文件
+    CacheCursor cache(fd, cache_policy(filename), alloc, true);
+    // ALLO预告的大小超过阈值时切换为O_DIRECT，由后台线程按对齐的整块写盘
+    std::unique_ptr<DirectWriter> direct;
+    uint64_t threshold = direct_io_threshold;
+    if (!sparse && !rest && threshold && alloc >= threshold &&
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) == 0)
+        direct.reset(new DirectWriter(fd));
+    // 续传检查点：滚动计算已写入前缀的crc32，每UPLOAD_CHECKPOINT字节fdatasync后记入日志；
+    // 稀疏和O_DIRECT上传的数据不是顺序落盘的，不记检查点
+    bool journaled = !sparse && !direct;
+    uint64_t crc_off = rest; // crc覆盖到的偏移
+    auto write_file = [&](const char* data, size_t len) {
+        if (written + len > reserved && !reserve(written + len, PREALLOC_STEP, FALLOC_FL_KEEP_SIZE)) {
+            write_failed = no_space = true;
+            return false;
+        }
+        if (direct) {
+            if (!direct->write(data, len)) {
+                no_space = errno == ENOSPC || errno == EDQUOT;
+                return !(write_failed = true);
+            }
+            if (replicas) replicas->write_at(written, data, len);
+            written += len;
+            hasher.update(data, len);
+            return true;
+        }
+        for (size_t done = 0; done < len; ) {
+            ssize_t n = write(fd, data + done, len - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                no_space = n < 0 && (errno == ENOSPC || errno == EDQUOT);
+                return !(write_failed = true);
+            }
+            done += n;
+        }
+        if (replicas) replicas->write_at(written, data, len);
+        written += len;
+        cache.advance(written);
+        hasher.update(data, len);
+        if (journaled) {
+            crc = crc32(crc, reinterpret_cast<const Bytef*>(data), len);
+            crc_off = written;
+        }
+        return true;
+    };
+
+    // 稀疏模式：数据段写到各自的偏移，未出现的区域保持为空洞
+    std::unique_ptr<SparseReceiver> sparse_rx;
+    if (sparse) sparse_rx.reset(new SparseReceiver);
+    auto write_at = [&](uint64_t offset, const char* data, size_t len) {
+        for (size_t done = 0; done < len; ) {
+            ssize_t n = pwrite(fd, data + done, len - done, offset + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                no_space = n < 0 && (errno == ENOSPC || errno == EDQUOT);
+                return !(write_failed = true);
+            }
+            done += n;
+        }
+        if (replicas) replicas->write_at(offset, data, len);
+        written = std::max<uint64_t>(written, offset + len);
+        cache.advance(written);
+        return true;
+    };
     
+    // 有副本且数据不需要在用户态处理时，socket数据splice进管道，tee给各副本后再写入主文件，
+    // 摘要无法边收边算，留到HASH时再算；socket不支持splice时退回缓冲路径
+    int in_pipe[2] = {-1, -1};
+    bool spliced = replicas && !inflater && !sparse_rx && !direct && replicas->prepare_pipes() &&
+                   pipe2(in_pipe, O_CLOEXEC) == 0;
+    size_t pipe_size = buffer.size();
+    if (spliced) {
+        fcntl(in_pipe[1], F_SETPIPE_SZ, REPLICA_PIPE_SIZE);
+        int sz = fcntl(in_pipe[1], F_GETPIPE_SZ);
+        if (sz > 0) pipe_size = std::min<size_t>(pipe_size, sz);
+    }
+    auto splice_file = [&](size_t len) {
+        if (written + len > reserved && !reserve(written + len, PREALLOC_STEP, FALLOC_FL_KEEP_SIZE)) {
+            write_failed = no_space = true;
+            return false;
+        }
+        replicas->tee(in_pipe[0], len, written);
+        for (size_t left = len; left > 0; ) {
+            ssize_t n = splice(in_pipe[0], nullptr, fd, nullptr, left, SPLICE_F_MOVE);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                no_space = n < 0 && (errno == ENOSPC || errno == EDQUOT);
+                return !(write_failed = true);
+            }
+            left -= n;
+        }
+        written += len;
+        replicas->catch_up(fd);
+        cache.advance(written);
+        return true;
+    };
+
+    auto checkpoint = [&]() {
+        if (!journaled || written - checkpointed < UPLOAD_CHECKPOINT) return;
+        // splice写入的数据没有经过用户态，从文件读回补算（此时buffer空闲）
+        while (crc_off < written) {
+            ssize_t n = pread(fd, buffer.data(), std::min<uint64_t>(buffer.size(), written - crc_off), crc_off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            crc = crc32(crc, reinterpret_cast<const Bytef*>(buffer.data()), n);
+            crc_off += n;
+        }
+        if (fdatasync(fd) < 0) return; // 本次不记检查点，续传时从上一个检查点开始
+        upload_journal->checkpoint(upload.id, written, crc);
+        checkpointed = written;
+    };
+
+    // 接收不经过调度器，只按限速控制；数据连接的SO_RCVTIMEO防止客户端停发后一直等待
     while (true) {
-        ssize_t bytes = recv(data_sock, buffer, sizeof(buffer), 0);
+        size_t want = spliced ? pipe_size : buffer.size();
+        ssize_t bytes = spliced ? splice(data_sock, nullptr, in_pipe[1], nullptr, want, SPLICE_F_MOVE)
+                                : recv(data_sock, buffer.data(), want, 0);
+        if (bytes < 0 && spliced && errno == EINVAL && total == 0) {
+            spliced = false;
+            continue;
+        }
         if (bytes < 0) {
             if (errno == EINTR) continue; // 处理中断
+            send_response("426 Connection closed; transfer aborted"); // 出错或超时，留待续传
+            ok = false;
             break;
         }
         if (bytes == 0) break; // 客户端关闭连接
+        throttle(bytes);
         
-        file.write(buffer, bytes);
-        if (!file) {
-            send_response("451 本地文件写入错误");
+        if (spliced) {
+            if (!splice_file(bytes)) {
+                send_response(no_space ? "452 Insufficient storage space" : "451 本地文件写入错误");
+                ok = false;
+                break;
+            }
+        } else if (sparse_rx) {
+            if (!sparse_rx->feed(buffer.data(), bytes, write_at)) {
+                send_response(no_space ? "452 Insufficient storage space"
+                              : write_failed ? "451 本地文件写入错误" : "451 Invalid sparse stream");
+                ok = false;
+                break;
+            }
+        } else if (inflater) {
+            if (!inflater->feed(buffer.data(), bytes, write_file)) {
+                send_response(no_space ? "452 Insufficient storage space"
+                              : write_failed ? "451 本地文件写入错误" : "451 Compressed data is corrupt");
+                ok = false;
+                break;
+            }
+        } else if (!write_file(buffer.data(), bytes)) {
+            send_response(no_space ? "452 Insufficient storage space" : "451 本地文件写入错误");
+            ok = false;
             break;
         }
         total += bytes;
-        
-        file.flush(); // 确保写入磁盘
+        checkpoint();
+    }
+    if (ok && inflater && !inflater->complete()) {
+        send_response("451 Compressed stream truncated");
+        ok = false;
+    }
+    if (ok && sparse_rx) {
+        if (sparse_rx->done()) {
+            written = sparse_rx->size(); // 文件长度以END为准，末尾的空洞由ftruncate保留
+        } else {
+            send_response("451 Sparse stream truncated");
+            ok = false;
+        }
+    }
+    if (direct && !direct->finish() && ok) {
+        bool full = errno == ENOSPC || errno == EDQUOT;
+        send_response(full ? "452 Insufficient storage space" : "451 本地文件写入错误");
+        ok = false;
+    }
+    // 截掉多预分配的部分（ALLO偏大，或KEEP_SIZE超出文件末尾的块）；稀疏上传按END设定长度
+    if ((reserved > 0 || (ok && sparse_rx)) && ftruncate(fd, written) < 0 && ok) {
+        send_response("451 本地文件写入错误");
+        ok = false;
     }
+    cache.finish(written);
+    for (int p : in_pipe) if (p >= 0) close(p);
+    // 稀疏上传的数据不连续，续传时只看到了后半部分，摘要都留到HASH时再算
+    if (ok && !sparse_rx && !spliced && !rest) {
+        struct stat st;
+        if (fstat(fd, &st) == 0)
+            hash_cache->store(fd, st, hash_algo, 0, st.st_size, hasher.hex_digest());
+    }
+    // 发布：数据先落盘再把临时文件rename为目标文件，之后同步目录项才回复226，
+    // 目标文件要么是旧内容要么是完整的新内容；组提交时与其他会话完成的上传一起批量同步
+    if (ok) {
+        std::string leaf, part_leaf;
+        DirRef dir = fs.parent(filename, leaf);
+        DirRef part_dir = fs.parent(part_path, part_leaf);
+        int err = durability.commit(fd, -1);
+        if (err) {
+            send_response(std::string("451 Sync failed: ") + strerror(err));
+            ok = false;
+        } else if (!dir || !part_dir ||
+                   renameat(part_dir.get(), part_leaf.c_str(), dir.get(), leaf.c_str()) < 0) {
+            send_response(std::string("451 Can't publish file: ") + strerror(errno));
+            ok = false;
+        } else if ((err = durability.commit(fd, dir.get())) != 0) {
+            send_response(std::string("451 Sync failed: ") + strerror(err));
+            ok = false;
+            checkpointed = 0; // 已经rename，没有临时文件可续传
+        }
+    }
+    // 副本在主文件发布之后才替换副本目录中的旧版本
+    if (replicas) replicas->finish(written, ok, durability);
+    close(fd);
+    if (ok) upload_journal->finish(upload.id);
+    else abandon();
+    // 不等inotify事件，立即让缓存中的旧映射失效
+    fd_cache.invalidate(rel_path);
 
         // 清理资源
         close(data_sock);
         close(data_listen_sock);
         data_sock = -1;
         data_listen_sock = -1;
-        send_response("226 Transfer complete");
+        if (ok && replicas) {
+            send_response("226-Replicas:\r\n" + replica_report(*replicas, written) + "226 Transfer complete");
+        } else if (ok) {
+            send_response("226 Transfer complete");
+        }
     }
 };
 
+Slab<ClientHandler>& ClientHandler::session_slab() {
+    static Slab<ClientHandler> slab;
+    return slab;
+}
+
 // 信号处理函数
 void handle_signal(int sig) {
     server_running = false;
@@ -367,6 +2610,58 @@ int main() {
     signal(SIGINT, handle_signal);// 捕获Ctrl+C
     signal(SIGTERM, handle_signal);// 捕获kill命令
 
+    // 每个空闲会话至少占一个fd（控制连接），把打开文件数的软限制提到硬限制
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < nofile.rlim_max) {
+        nofile.rlim_cur = nofile.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &nofile);
+    }
+
+    mkdir(STATE_DIR, 0700);
+    std::string config_error;
+    if (!server_config.load(CONFIG_FILE, config_error)) {
+        std::cerr << config_error << std::endl;
+        return 1;
+    }
+    for (auto& uc : server_config.user_classes()) rate_limiter.set_user_class(uc.first, uc.second);
+    for (auto& root : server_config.replica_roots()) {
+        if (!replication.allow_root(root)) std::cerr << "副本根目录不可用: " << root << std::endl;
+    }
+    HashCache cache(STATE_DIR "/hashes");
+    hash_cache = &cache;
+    // 载入上传日志，校验上次未完成的上传，供客户端REST续传
+    UploadJournal journal(STATE_DIR "/uploads.journal");
+    {
+        mkdir(ROOT_DIR, 0777);
+        SessionFs root;
+        if (root.init(ROOT_DIR)) journal.recover(root);
+    }
+    upload_journal = &journal;
+
+    // 文件变化时让fd缓存失效；inotify不可用时只靠TTL
+    mkdir(ROOT_DIR, 0777);
+    if (FsWatcher::instance().start(ROOT_DIR)) {
+        FsWatcher::instance().add_listener([](const std::string& rel, uint32_t mask) {
+            fd_cache.on_fs_event(rel, mask);
+            if (mask & (IN_ISDIR | IN_DELETE_SELF | IN_MOVE_SELF | IN_Q_OVERFLOW))
+                SessionFs::directories_changed();
+        });
+        // 文件清单：扫描整棵树，之后按inotify事件增量更新，SHA256在后台补算（与HASH共用摘要缓存）
+        manifest.start(ROOT_DIR, [](int fd, const struct stat& st) {
+            std::string hex;
+            if (hash_cache->lookup(fd, st, HashAlgo::SHA256, 0, st.st_size, hex)) return hex;
+            hex = hash_fd(fd, HashAlgo::SHA256, 0, st.st_size, 1);
+            if (!hex.empty()) hash_cache->store(fd, st, HashAlgo::SHA256, 0, st.st_size, hex);
+            return hex;
+        });
+        // 文件名索引：并行扫描建立，之后同样按inotify事件维护
+        name_index.start(ROOT_DIR);
+    } else {
+        std::cerr << "inotify不可用: " << strerror(errno) << std::endl;
+    }
+
+    compress_pool.start(std::min<size_t>(ZMODE_MAX_WORKERS, std::max(1u, std::thread::hardware_concurrency())));
+
     // 创建控制socket
     int server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if(server_fd < 0) {
@@ -395,7 +2690,7 @@ int main() {
     }
 
     // 开始监听
-    if(listen(server_fd, 5) < 0) {
+    if(listen(server_fd, SOMAXCONN) < 0) {
         std::cerr << "Listen failed" << std::endl;
         close(server_fd);
         return 1;
@@ -403,6 +2698,33 @@ int main() {
 
     std::cout << "FTP Server started on port " << CONTROL_PORT << std::endl;
 
+    // 同机客户端的Unix域socket，RETR/STOR可直接传递文件描述符
+    int local_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un local_addr{};
+    local_addr.sun_family = AF_UNIX;
+    strncpy(local_addr.sun_path, LOCAL_SOCKET_PATH, sizeof(local_addr.sun_path) - 1);
+    unlink(LOCAL_SOCKET_PATH);
+    if (local_fd >= 0 && bind(local_fd, (sockaddr*)&local_addr, sizeof(local_addr)) == 0 &&
+        listen(local_fd, 5) == 0) {
+        chmod(LOCAL_SOCKET_PATH, 0666);
+        std::thread([local_fd]() {
+            while (server_running) {
+                int client_fd = accept(local_fd, nullptr, nullptr);
+                if (client_fd < 0) continue;
+                std::thread([client_fd]() {
+                    ClientHandler handler(client_fd, "local");
+                    handler.handle();
+                }).detach();
+            }
+        }).detach();
+    } else {
+        std::cerr << "无法监听" << LOCAL_SOCKET_PATH << ": " << strerror(errno) << std::endl;
+    }
+
+    // 空闲会话停放在reactor上，命令到达时才占用工作线程
+    bool reactor = session_reactor.start();
+    if (!reactor) std::cerr << "epoll不可用，每个会话使用一个线程: " << strerror(errno) << std::endl;
+
     // 主循环接受连接
     while(server_running) {
         sockaddr_in client_addr{};
@@ -414,15 +2736,25 @@ int main() {
             continue;
         }
 
+        // 控制连接上的回复都很短，关闭Nagle避免流水线命令被延迟确认拖慢
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
         // 创建新线程处理客户端
-        std::thread([client_fd]() {
-            ClientHandler handler(client_fd);
-            handler.handle();
-        }).detach();
+        std::string peer = std::string(inet_ntoa(client_addr.sin_addr)) + ":" +
+                           std::to_string(ntohs(client_addr.sin_port));
+        ClientHandler* handler = new ClientHandler(client_fd, peer);
+        handler->greet();
+        if (!reactor || !session_reactor.park(handler)) {
+            std::thread([handler]() {
+                handler->serve();
+                delete handler;
+            }).detach();
+        }
     }
 
     // 清理资源
     close(server_fd);
+    unlink(LOCAL_SOCKET_PATH);
     std::cout << "\nServer stopped" << std::endl;
     return 0;
 }
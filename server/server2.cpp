@@ -18,34 +18,59 @@
 #include <sys/epoll.h>
 #include <unordered_map>
 #include <memory>
-#include "threadpool.h"
+#include "eventsource.h"
 
 #define CONTROL_PORT 2100
 #define BUFFER_SIZE 1024
-#define MAX_EVENTS 1024
-#define THREAD_POOL_SIZE 4
+#define REACTOR_THREADS 4
+#define DATA_ACCEPT_TIMEOUT_MS 5000 // PASV之后等待数据连接的时间
 #define SERVER_IP "127.0.0.1"
 #define ROOT_DIR "/home/lfd/FTP/server"
 
 std::atomic<bool> server_running(true);
+ReactorGroup reactors;
 
-// 全局数据连接映射和互斥锁
-std::unordered_map<int, std::weak_ptr<class ClientHandler>> data_listen_map;
-std::mutex map_mutex;
+void set_nonblock(int sock) {
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+}
+
+class ClientHandler;
+
+// PASV打开的数据监听socket
+class DataListener : public EventSource {
+public:
+    ClientHandler& owner;
+    DataListener(ClientHandler& h, int sock) : EventSource(DATA_LISTENER, sock), owner(h) {}
+    void handle(uint32_t events) override;
+};
+
+// 已建立的数据连接，把待发送的内容在可写时发出
+class DataConnection : public EventSource {
+public:
+    ClientHandler& owner;
+    std::string out;
+    size_t sent = 0;
+    bool active = false; // 已开始发送LIST内容
+    DataConnection(ClientHandler& h, int sock) : EventSource(DATA, sock), owner(h) {}
+    void handle(uint32_t events) override;
+};
 
-class ClientHandler : public std::enable_shared_from_this<ClientHandler> {
+// 控制连接。会话及其数据连接、定时器都在同一个reactor线程上处理，成员无需加锁
+class ClientHandler : public EventSource {
 //private:
 public:
-    int ctrl_sock;
-    int data_listen_sock = -1;
-    int data_sock = -1;
-    int epoll_fd;
     std::string current_dir;
-    std::mutex data_mutex;
+    std::string ctrl_buf;
+    DataListener* data_listener = nullptr;
+    DataConnection* data_conn = nullptr;
+    TimerSource* data_timer = nullptr;
+    bool list_pending = false; // LIST已应答150，等待数据连接
+    std::string pending;
 
     void send_response(const std::string& response) {
         std::string msg = response + "\r\n";
-        send(ctrl_sock, msg.c_str(), msg.size(), 0);
+        send(fd, msg.c_str(), msg.size(), MSG_NOSIGNAL);
     }
 
     bool is_safe_path(const std::string& path) {
@@ -54,14 +79,36 @@ public:
     }
 
 public:
-    ClientHandler(int sock, int epoll) : ctrl_sock(sock), epoll_fd(epoll) {
+    explicit ClientHandler(int sock) : EventSource(CONTROL, sock) {
         current_dir = ROOT_DIR;
         mkdir(ROOT_DIR, 0777);
     }
 
-    ~ClientHandler() {
-        close(ctrl_sock);
-        cleanup_data_connection();
+    // 控制连接可读（边沿触发，读到EAGAIN为止），逐行执行命令
+    void handle(uint32_t events) override {
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            close_session();
+            return;
+        }
+        char buffer[BUFFER_SIZE];
+        while (true) {
+            ssize_t bytes = recv(fd, buffer, sizeof(buffer), 0);
+            if (bytes > 0) {
+                ctrl_buf.append(buffer, bytes);
+                continue;
+            }
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            close_session(); // 对端关闭或出错
+            return;
+        }
+        size_t pos;
+        while (!removed() && (pos = ctrl_buf.find('\n')) != std::string::npos) {
+            std::string cmd = ctrl_buf.substr(0, pos);
+            ctrl_buf.erase(0, pos + 1);
+            cmd.erase(cmd.find_last_not_of("\r\n") + 1);
+            process_command(cmd);
+        }
     }
 
     void process_command(const std::string& cmd) {
@@ -89,6 +136,7 @@ public:
         //}
          else if (command == "QUIT") {
             send_response("221 Goodbye");
+            close_session();
         } else {
             send_response("500 Unknown command");
         }
@@ -96,22 +144,19 @@ public:
 
 //private:
     void handle_pasv() {
-        std::lock_guard<std::mutex> lock(data_mutex);
         cleanup_data_connection();
 
         // 创建数据监听socket
-        data_listen_sock = socket(AF_INET, SOCK_STREAM, 0);
-        if(data_listen_sock < 0) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if(sock < 0) {
             send_response("500 Internal server error");
             return;
         }
 
         // 设置socket选项
         int opt = 1;
-        setsockopt(data_listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-        //set_nonblock(data_listen_sock);
-        int flags = fcntl(data_listen_sock, F_GETFL, 0);
-    fcntl(data_listen_sock, F_SETFL, flags | O_NONBLOCK);
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        set_nonblock(sock);
 
         // 绑定随机端口
         sockaddr_in data_addr{};
@@ -119,60 +164,59 @@ public:
         data_addr.sin_addr.s_addr = INADDR_ANY;
         data_addr.sin_port = 0;
 
-        if(bind(data_listen_sock, (sockaddr*)&data_addr, sizeof(data_addr)) < 0) {
+        if(bind(sock, (sockaddr*)&data_addr, sizeof(data_addr)) < 0) {
             send_response("500 Port allocation failed");
-            close(data_listen_sock);
-            data_listen_sock = -1;
+            close(sock);
             return;
         }
 
-        if(listen(data_listen_sock, 5) < 0) {
+        if(listen(sock, 5) < 0) {
             send_response("500 Listen failed");
-            close(data_listen_sock);
-            data_listen_sock = -1;
+            close(sock);
             return;
         }
 
-        // 注册到epoll
-        struct epoll_event data_ev;
-        data_ev.events = EPOLLIN | EPOLLET;
-        data_ev.data.fd = data_listen_sock;
-        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, data_listen_sock, &data_ev) == 0) {
-            {
-                std::lock_guard<std::mutex> lock(map_mutex);
-                data_listen_map[data_listen_sock] = weak_from_this();
-            }
-            
-            // 获取端口信息
-            sockaddr_in sin;
-            socklen_t len = sizeof(sin);
-            getsockname(data_listen_sock, (sockaddr*)&sin, &len);
-            uint16_t port = ntohs(sin.sin_port);
-            
-            std::string ip_str = SERVER_IP;
-            std::replace(ip_str.begin(), ip_str.end(), '.', ',');
-            std::ostringstream oss;
-            oss << "227 Entering Passive Mode (" 
-                << ip_str << "," 
-                << (port >> 8) << "," 
-                << (port & 0xff) << ")";
-            send_response(oss.str());
-        } else {
+        // 注册到本会话所在的reactor，事件直接分派到监听对象
+        data_listener = new DataListener(*this, sock);
+        if(!reactor()->add(data_listener, EPOLLIN)) {
+            delete data_listener;
+            data_listener = nullptr;
             send_response("500 Internal server error");
-            close(data_listen_sock);
-            data_listen_sock = -1;
+            return;
+        }
+        data_timer = new TimerSource([this]() { on_data_timeout(); });
+        if(!reactor()->add(data_timer, EPOLLIN)) {
+            delete data_timer;
+            data_timer = nullptr;
+        } else {
+            data_timer->arm(DATA_ACCEPT_TIMEOUT_MS);
         }
+
+        // 获取端口信息
+        sockaddr_in sin;
+        socklen_t len = sizeof(sin);
+        getsockname(sock, (sockaddr*)&sin, &len);
+        uint16_t port = ntohs(sin.sin_port);
+
+        std::string ip_str = SERVER_IP;
+        std::replace(ip_str.begin(), ip_str.end(), '.', ',');
+        std::ostringstream oss;
+        oss << "227 Entering Passive Mode ("
+            << ip_str << ","
+            << (port >> 8) << ","
+            << (port & 0xff) << ")";
+        send_response(oss.str());
     }
 
     void handle_list() {
-        std::lock_guard<std::mutex> lock(data_mutex);
-        if(!setup_data_connection()) return;
+        if(!data_listener && !data_conn) {
+            send_response("425 Use PASV first");
+            return;
+        }
 
-        send_response("150 Here comes the directory listing");
-        
+        std::string list;
         DIR* dir = opendir(current_dir.c_str());
         if(dir) {
-            std::string list;
             dirent* entry;
             while((entry = readdir(dir)) != nullptr) {
                 if(strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
@@ -181,93 +225,156 @@ public:
                 }
             }
             closedir(dir);
-            send(data_sock, list.c_str(), list.size(), 0);
         }
-        
-        cleanup_data_connection();
-        send_response("226 Directory send OK");
+
+        send_response("150 Here comes the directory listing");
+        // 数据连接还没建立时先记下，连上后再发送
+        pending.swap(list);
+        list_pending = true;
+        if(data_conn) start_transfer();
     }
 
-    bool setup_data_connection() {
-        if(data_listen_sock == -1) {
-            send_response("425 Use PASV first");
-            return false;
-        }
+    void start_transfer() {
+        list_pending = false;
+        data_conn->out.swap(pending);
+        pending.clear();
+        data_conn->sent = 0;
+        data_conn->active = true;
+        if(!reactor()->modify(data_conn, EPOLLOUT)) finish_transfer(false);
+    }
 
+    // 数据监听socket可读：接受一个连接，之后不再接受新的连接
+    void on_data_accept() {
         sockaddr_in client_addr{};
         socklen_t addr_len = sizeof(client_addr);
-        data_sock = accept(data_listen_sock, (sockaddr*)&client_addr, &addr_len);
-        if(data_sock < 0) {
-            send_response("425 Data connection failed");
-            return false;
+        int sock = accept(data_listener->fd, (sockaddr*)&client_addr, &addr_len);
+        if(sock < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return;
+            cleanup_data_connection();
+            if(list_pending) {
+                list_pending = false;
+                send_response("425 Data connection failed");
+            }
+            return;
         }
-        return true;
-    }
-
-    void cleanup_data_connection() {
-        if(data_listen_sock != -1) {
-            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data_listen_sock, nullptr);
-            {
-                std::lock_guard<std::mutex> lock(map_mutex);
-                data_listen_map.erase(data_listen_sock);
+        set_nonblock(sock);
+        remove_source(data_listener);
+        remove_source(data_timer);
+        data_conn = new DataConnection(*this, sock);
+        if(!reactor()->add(data_conn, 0)) { // 开始传输前只关心错误
+            delete data_conn;
+            data_conn = nullptr;
+            if(list_pending) {
+                list_pending = false;
+                send_response("425 Data connection failed");
             }
-            close(data_listen_sock);
-            data_listen_sock = -1;
+            return;
         }
-        if(data_sock != -1) {
-            close(data_sock);
-            data_sock = -1;
+        if(list_pending) start_transfer();
+    }
+
+    void on_data_timeout() {
+        cleanup_data_connection();
+        if(list_pending) {
+            list_pending = false;
+            pending.clear();
+            send_response("425 Data connection timeout");
         }
     }
 
+    void finish_transfer(bool ok) {
+        cleanup_data_connection();
+        send_response(ok ? "226 Directory send OK" : "426 Connection closed; transfer aborted");
+    }
+
+    template <typename T>
+    void remove_source(T*& src) {
+        if(!src) return;
+        reactor()->remove(src);
+        src = nullptr;
+    }
+
+    void cleanup_data_connection() {
+        remove_source(data_listener);
+        remove_source(data_timer);
+        remove_source(data_conn);
+    }
+
+    void close_session() {
+        cleanup_data_connection();
+        reactor()->remove(this);
+    }
+
     // 其他处理函数保持不变...
 };
 
-void set_nonblock(int sock) {
-    int flags = fcntl(sock, F_GETFL, 0);
-    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
-}
-
-void handle_signal(int sig) {
-    server_running = false;
+void DataListener::handle(uint32_t /*events*/) {
+    owner.on_data_accept();
 }
 
-void handle_data_connection(int data_listen_fd) {
-    while(true) {
-        sockaddr_in client_addr{};
-        socklen_t addr_len = sizeof(client_addr);
-        int data_sock = accept(data_listen_fd, (sockaddr*)&client_addr, &addr_len);
-        if(data_sock < 0) {
-            if(errno == EAGAIN) break;
-            perror("data accept");
+void DataConnection::handle(uint32_t events) {
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        // 没有进行中的传输时客户端不在等应答，只清理连接
+        if (active || owner.list_pending) {
+            owner.list_pending = false;
+            owner.pending.clear();
+            owner.finish_transfer(false);
+        } else {
+            owner.cleanup_data_connection();
+        }
+        return;
+    }
+    while (sent < out.size()) {
+        ssize_t n = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
             continue;
         }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        owner.finish_transfer(false);
+        return;
+    }
+    owner.finish_transfer(true);
+}
 
-        std::shared_ptr<ClientHandler> handler;
-        {
-            std::lock_guard<std::mutex> lock(map_mutex);
-            auto it = data_listen_map.find(data_listen_fd);
-            if(it != data_listen_map.end()) {
-                handler = it->second.lock();
+// 控制端口的监听socket：接受的连接按轮转交给各reactor
+class ControlListener : public EventSource {
+public:
+    explicit ControlListener(int sock) : EventSource(LISTENER, sock) {}
+
+    void handle(uint32_t /*events*/) override {
+        while(true) {
+            sockaddr_in client_addr{};
+            socklen_t addr_len = sizeof(client_addr);
+            int client_fd = accept(fd, (sockaddr*)&client_addr, &addr_len);
+            if(client_fd < 0) {
+                if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+                perror("accept");
+                if(errno == EMFILE || errno == ENFILE) break;
+                continue;
             }
-        }
 
-        if(handler) {
-            handler->process_command("LIST"); // 示例处理
-        } else {
-            close(data_sock);
+            set_nonblock(client_fd);
+            auto handler = new ClientHandler(client_fd);
+            handler->send_response("220 Welcome");
+            if(!reactors.pick().add(handler, EPOLLIN | EPOLLET | EPOLLRDHUP)) delete handler;
         }
     }
-}
+};
 
+void handle_signal(int /*sig*/) {
+    server_running = false;
+}
 
 int main() {
     signal(SIGINT, handle_signal);
     signal(SIGTERM, handle_signal);
 
-    ThreadPool pool(THREAD_POOL_SIZE);
-    int epoll_fd = epoll_create1(0);
-    struct epoll_event ev, events[MAX_EVENTS];
+    if(!reactors.init(REACTOR_THREADS)) {
+        std::cerr << "epoll_create failed" << std::endl;
+        return 1;
+    }
 
     int server_fd = socket(AF_INET, SOCK_STREAM, 0);
     int opt = 1;
@@ -278,83 +385,21 @@ int main() {
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(CONTROL_PORT);
-    bind(server_fd, (sockaddr*)&server_addr, sizeof(server_addr));
-    listen(server_fd, SOMAXCONN);
+    if(bind(server_fd, (sockaddr*)&server_addr, sizeof(server_addr)) < 0 || listen(server_fd, SOMAXCONN) < 0) {
+        std::cerr << "Bind/listen failed" << std::endl;
+        close(server_fd);
+        return 1;
+    }
 
-    ev.events = EPOLLIN | EPOLLET;
-    ev.data.fd = server_fd;
-    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev);
+    auto listener = new ControlListener(server_fd);
+    if(!reactors.at(0).add(listener, EPOLLIN | EPOLLET)) {
+        std::cerr << "epoll_ctl failed" << std::endl;
+        delete listener;
+        return 1;
+    }
 
     std::cout << "FTP Server started on port " << CONTROL_PORT << std::endl;
 
-    while(server_running) {
-        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 100);
-        for(int i=0; i<n; i++) {
-            int fd = events[i].data.fd;
-            
-            if(fd == server_fd) {
-                while(true) {
-                    sockaddr_in client_addr{};
-                    socklen_t addr_len = sizeof(client_addr);
-                    int client_fd = accept(server_fd, (sockaddr*)&client_addr, &addr_len);
-                    if(client_fd < 0) {
-                        if(errno == EAGAIN) break;
-                        perror("accept");
-                        continue;
-                    }
-                    
-                    set_nonblock(client_fd);
-                    auto handler = std::make_shared<ClientHandler>(client_fd, epoll_fd);
-                    handler->send_response("220 Welcome");
-                    
-                    struct epoll_event client_ev;
-                    client_ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-                    client_ev.data.fd = client_fd;
-                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &client_ev);
-                }
-            }
-            else if(events[i].events & EPOLLRDHUP) {
-                close(fd);
-                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
-            }
-            else {
-                std::shared_ptr<ClientHandler> handler;
-                {
-                    std::lock_guard<std::mutex> lock(map_mutex);
-                    auto it = data_listen_map.find(fd);
-                    if(it != data_listen_map.end()) {
-                        handler = it->second.lock();
-                    }
-                }
-                
-                if(handler) {
-                    handle_data_connection(fd);
-                } else {
-                    pool.enqueue([fd, epoll_fd]() {
-                        char buffer[BUFFER_SIZE];
-                        while(true) {
-                            ssize_t bytes = recv(fd, buffer, sizeof(buffer), 0);
-                            if(bytes <= 0) {
-                                if(bytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
-                                    close(fd);
-                                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
-                                }
-                                break;
-                            }
-                            
-                            std::string cmd(buffer, bytes);
-                            cmd.erase(cmd.find_last_not_of("\r\n") + 1);
-                            
-                            auto handler = std::make_shared<ClientHandler>(fd, epoll_fd);
-                            handler->process_command(cmd);
-                        }
-                    });
-                }
-            }
-        }
-    }
-
-    close(server_fd);
-    close(epoll_fd);
+    reactors.run(server_running);
     return 0;
-}
\ No newline at end of file
+}
@@ -18,186 +18,165 @@
 #include <sys/epoll.h>
 #include <unordered_map>
 #include <memory>
-#include "threadpool.h"
+#include "coro.h"
+
+// 需要C++20：g++ -std=c++20 -pthread server3.cpp
 
 #define CONTROL_PORT 2100
 #define BUFFER_SIZE 1024
-#define MAX_EVENTS 1024
-#define THREAD_POOL_SIZE 4
+#define REACTOR_THREADS 4
+#define DATA_ACCEPT_TIMEOUT_MS 5000 // PASV之后等待数据连接的时间
+#define ACCEPT_RETRY_MS 100         // fd耗尽时暂停接受连接的时间
 #define SERVER_IP "127.0.0.1"
 #define ROOT_DIR "/home/lfd/FTP/server"
 
 std::atomic<bool> server_running(true);
 
+// 每个会话是一个协程，命令处理函数按顺序书写，等待网络时挂起而不阻塞reactor线程。
+// 会话的控制连接、数据连接都登记在同一个reactor上，只在该线程上运行，成员无需加锁
 class ClientHandler {
 private:
-    int ctrl_sock;              // 控制连接socket
-    int data_listen_sock = -1;  // 数据监听socket
-    int data_sock = -1;         // 数据传输socket
+    Socket ctrl;                // 控制连接
+    Socket data_listen;         // 数据监听socket
+    Socket data;                // 数据传输socket
     std::string current_dir;    // 当前工作目录
-    std::mutex data_mutex;      // 数据连接互斥锁
-    int epoll_fd_;              // epoll实例文件描述符
-
-    // 设置非阻塞socket
-    void set_nonblock(int sock) {
-        int flags = fcntl(sock, F_GETFL, 0);
-        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
-    }
-
-    // void send_response(const std::string& response) {
-    //     std::string msg = response + "\r\n";
-    //     send(ctrl_sock, msg.c_str(), msg.size(), 0);
-    // }
 
     bool is_safe_path(const std::string& path) {
         std::string full_path = current_dir + "/" + path;
-        return full_path.find(ROOT_DIR) == 0;
+        return full_path.find(ROOT_DIR) == 0 && path.find("..") == std::string::npos;
     }
 
 public:
-    explicit ClientHandler(int sock, int epoll_fd) 
-        : ctrl_sock(sock), epoll_fd_(epoll_fd) {
+    explicit ClientHandler(Socket sock) : ctrl(std::move(sock)) {
         current_dir = ROOT_DIR;
         mkdir(ROOT_DIR, 0777);
     }
 
-    ~ClientHandler() {
-        close(ctrl_sock);
-        if(data_listen_sock != -1) {
-            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, data_listen_sock, nullptr);
-            close(data_listen_sock);
-        }
-        if(data_sock != -1) close(data_sock);
+    Async<bool> send_response(const std::string& response) {
+        co_return co_await send_all(ctrl, response + "\r\n");
     }
-    void send_response(const std::string& response) {
-        std::string msg = response + "\r\n";
-        send(ctrl_sock, msg.c_str(), msg.size(), 0);
+
+    // 会话主循环，连接断开或QUIT后返回
+    Async<> run() {
+        if (!co_await send_response("220 Welcome to MyFTP Server")) co_return;
+        std::string cmd;
+        while (server_running && co_await recv_line(ctrl, cmd)) {
+            if (!co_await process_command(cmd)) break;
+        }
     }
-    void process_command(const std::string& cmd) {
+
+    // 执行一条命令，QUIT后返回false
+    Async<bool> process_command(const std::string& cmd) {
         std::istringstream iss(cmd);
         std::vector<std::string> tokens;
         std::string token;
         while(iss >> token) tokens.push_back(token);
-        if(tokens.empty()) return;
+        if(tokens.empty()) co_return true;
 
         std::string command = tokens[0];
         std::transform(command.begin(), command.end(), command.begin(), ::toupper);
 
         if (command == "USER") {
-            send_response("331 Please specify the password");
+            co_await send_response("331 Please specify the password");
         } 
         else if (command == "PASS") {
-            send_response("230 Login successful");
+            co_await send_response("230 Login successful");
         }
         else if (command == "PASV") {
-            std::cout<<"222"<<std::endl;
-            handle_pasv();
+            co_await handle_pasv();
         }
         else if (command == "LIST") {
-            handle_list();
+            co_await handle_list();
         }
         else if (command == "RETR" && tokens.size() > 1) {
-            handle_retr(tokens[1]);
+            co_await handle_retr(tokens[1]);
         }
         else if (command == "STOR" && tokens.size() > 1) {
-            handle_stor(tokens[1]);
+            co_await handle_stor(tokens[1]);
         }
         else if (command == "QUIT") {
-            send_response("221 Goodbye");
+            co_await send_response("221 Goodbye");
+            co_return false;
         }
         else {
-            send_response("500 Unknown command");
+            co_await send_response("500 Unknown command");
         }
+        co_return true;
     }
 
 private:
-    void handle_pasv() {
-        std::lock_guard<std::mutex> lock(data_mutex);
-        
+    Async<> handle_pasv() {
         // 清理旧连接
-        if(data_listen_sock != -1) {
-            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, data_listen_sock, nullptr);
-            close(data_listen_sock);
-            data_listen_sock = -1;
-        }
+        data_listen.reset();
+        data.reset();
 
         // 创建并配置数据监听socket
-        data_listen_sock = socket(AF_INET, SOCK_STREAM, 0);
-        if(data_listen_sock < 0) {
-            send_response("500 Internal server error");
-            return;
+        int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(sock < 0) {
+            co_await send_response("500 Internal server error");
+            co_return;
         }
 
-        set_nonblock(data_listen_sock);  // 设置非阻塞模式
-
         sockaddr_in data_addr{};
         data_addr.sin_family = AF_INET;
         data_addr.sin_addr.s_addr = INADDR_ANY;
         data_addr.sin_port = 0;
 
-        if(bind(data_listen_sock, (sockaddr*)&data_addr, sizeof(data_addr)) < 0) {
-            send_response("500 Port allocation failed");
-            close(data_listen_sock);
-            data_listen_sock = -1;
-            return;
+        if(bind(sock, (sockaddr*)&data_addr, sizeof(data_addr)) < 0) {
+            close(sock);
+            co_await send_response("500 Port allocation failed");
+            co_return;
         }
 
-        if(listen(data_listen_sock, 1) < 0) {
-            send_response("500 Listen failed");
-            close(data_listen_sock);
-            data_listen_sock = -1;
-            return;
+        if(listen(sock, 1) < 0) {
+            close(sock);
+            co_await send_response("500 Listen failed");
+            co_return;
         }
 
-        // 注册到epoll
-        struct epoll_event ev;
-        ev.events = EPOLLIN | EPOLLET;
-        ev.data.fd = data_listen_sock;
-        if(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, data_listen_sock, &ev) < 0) {
-            send_response("500 Internal server error");
-            return;
+        // 注册到本会话的reactor
+        data_listen = Socket::adopt(ctrl.reactor(), sock, EventSource::DATA_LISTENER);
+        if(!data_listen) {
+            co_await send_response("500 Internal server error");
+            co_return;
         }
 
         // 获取端口信息
         sockaddr_in sin;
         socklen_t len = sizeof(sin);
-        getsockname(data_listen_sock, (sockaddr*)&sin, &len);
+        getsockname(sock, (sockaddr*)&sin, &len);
         uint16_t port = ntohs(sin.sin_port);
-        std::cout<<port<<"*"<<std::endl;
         std::ostringstream oss;
         oss << "227 Entering Passive Mode (" 
             << replace_ip(SERVER_IP) << "," 
             << (port >> 8) << "," << (port & 0xff) << ")";
-        send_response(oss.str());
+        co_await send_response(oss.str());
     }
 
-    void handle_list() {
-        std::lock_guard<std::mutex> lock(data_mutex);
-        
-        if(data_listen_sock == -1) {
-            send_response("425 Use PASV first");
-            return;
+    // 等待客户端连上PASV端口（挂起协程，不阻塞线程），失败时已应答425
+    Async<bool> open_data_connection() {
+        if(!data_listen) {
+            co_await send_response("425 Use PASV first");
+            co_return false;
         }
-
-        // 等待数据连接（由epoll事件触发）
-        struct epoll_event events[1];
-        int n = epoll_wait(epoll_fd_, events, 1, 5000); // 5秒超时
-        
-        if(n <= 0) {
-            send_response("425 Data connection timeout");
-            return;
+        if(!data) {
+            int sock = co_await accept(data_listen, DATA_ACCEPT_TIMEOUT_MS);
+            bool timed_out = sock < 0 && errno == ETIMEDOUT;
+            data_listen.reset();
+            data = Socket::adopt(ctrl.reactor(), sock, EventSource::DATA);
+            if(!data) {
+                co_await send_response(timed_out ? "425 Data connection timeout"
+                                                 : "425 Data connection failed");
+                co_return false;
+            }
         }
+        co_return true;
+    }
 
-        sockaddr_in client_addr{};
-        socklen_t addr_len = sizeof(client_addr);
-        data_sock = accept(data_listen_sock, (sockaddr*)&client_addr, &addr_len);
-        if(data_sock < 0) {
-            send_response("425 Data connection failed");
-            return;
-        }
+    Async<> handle_list() {
+        if(!co_await open_data_connection()) co_return;
+        co_await send_response("150 Here comes the directory listing");
 
-        send_response("150 Here comes the directory listing");
-        
         // 生成目录列表
         std::string list;
         DIR* dir = opendir(current_dir.c_str());
@@ -213,51 +192,67 @@ private:
         }
 
         // 发送数据
-        send_data(list);
-        send_response("226 Directory send OK");
+        bool ok = co_await send_all(data, list);
+        data.reset();
+        co_await send_response(ok ? "226 Directory send OK" : "426 Connection closed; transfer aborted");
     }
 
-    void send_data(const std::string& data) {
-        size_t total_sent = 0;
-        const char* buf = data.c_str();
-        size_t remaining = data.size();
-        
-        while(remaining > 0) {
-            ssize_t sent = send(data_sock, buf + total_sent, remaining, MSG_NOSIGNAL);
-            if(sent < 0) {
-                if(errno == EAGAIN) continue;
-                break;
-            }
-            total_sent += sent;
-            remaining -= sent;
+    Async<> handle_retr(const std::string& filename) {
+        if(!is_safe_path(filename)) {
+            co_await send_response("550 Invalid filename");
+            co_return;
         }
-        
-        close(data_sock);
-        data_sock = -1;
-    }
 
-    void handle_retr(const std::string& filename) {
-        if(!is_safe_path(filename)) {
-            send_response("550 Invalid filename");
-            return;
+        int fd = open((current_dir + "/" + filename).c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if(fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+            if(fd >= 0) close(fd);
+            co_await send_response("550 File not found");
+            co_return;
         }
+        if(!co_await open_data_connection()) {
+            close(fd);
+            co_return;
+        }
+        co_await send_response("150 Opening data connection for " + filename);
 
-        std::lock_guard<std::mutex> lock(data_mutex);
-        
-        // [数据连接处理类似handle_list...]
-        // ...
+        bool ok = co_await sendfile(data, fd, 0, st.st_size);
+        close(fd);
+        data.reset();
+        co_await send_response(ok ? "226 Transfer complete" : "426 Connection closed; transfer aborted");
     }
 
-    void handle_stor(const std::string& filename) {
+    Async<> handle_stor(const std::string& filename) {
         if(!is_safe_path(filename)) {
-            send_response("550 Invalid filename");
-            return;
+            co_await send_response("550 Invalid filename");
+            co_return;
         }
 
-        std::lock_guard<std::mutex> lock(data_mutex);
-        
-        // [数据连接处理类似handle_list...]
-        // ...
+        int fd = open((current_dir + "/" + filename).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd < 0) {
+            co_await send_response("550 Cannot create file");
+            co_return;
+        }
+        if(!co_await open_data_connection()) {
+            close(fd);
+            co_return;
+        }
+        co_await send_response("150 Ready to receive data");
+
+        // 读到对端关闭为止
+        char buffer[BUFFER_SIZE * 16];
+        bool ok = true;
+        while(true) {
+            ssize_t n = co_await recv_some(data, buffer, sizeof(buffer));
+            if(n == 0) break;
+            if(n < 0 || write(fd, buffer, n) != n) {
+                ok = false;
+                break;
+            }
+        }
+        close(fd);
+        data.reset();
+        co_await send_response(ok ? "226 Transfer complete" : "426 Connection closed; transfer aborted");
     }
 
     // 辅助函数
@@ -267,125 +262,83 @@ private:
         return s;
     }
 };
-ThreadPool* g_thread_pool = nullptr;
-void handle_signal(int sig) {
+
+void handle_signal(int /*sig*/) {
     server_running = false;
 }
-void set_nonblock(int sock) {
-    int flags = fcntl(sock, F_GETFL, 0);
-    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+
+// 一个会话一个协程帧，结束时连同ClientHandler一起释放
+Detached serve_session(Socket sock) {
+    ClientHandler handler(std::move(sock));
+    co_await handler.run();
+}
+
+// 每个reactor各有一个监听socket（SO_REUSEPORT，由内核分配连接），
+// 接受的会话就在本reactor上运行，不需要跨线程移交
+Detached accept_loop(Socket listener) {
+    while(server_running) {
+        int client_fd = co_await accept(listener, 0);
+        if(client_fd < 0) {
+            perror("accept");
+            if(errno == EMFILE || errno == ENFILE) co_await sleep_for(listener.reactor(), ACCEPT_RETRY_MS);
+            continue;
+        }
+        Socket sock = Socket::adopt(listener.reactor(), client_fd, EventSource::CONTROL);
+        if(sock) serve_session(std::move(sock));
+    }
 }
+
 int main() {
     // [保留原有信号处理设置]
     signal(SIGINT, handle_signal);
     signal(SIGTERM, handle_signal);
-    // 创建线程池
-    ThreadPool pool(THREAD_POOL_SIZE);
-    g_thread_pool = &pool;
-
-    // 创建epoll实例
-    int epoll_fd = epoll_create1(0);
-    struct epoll_event ev, events[MAX_EVENTS];
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    // [保留服务器socket创建和绑定代码]
-    int opt = 1;
-    if(setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        std::cerr << "Setsockopt failed" << std::endl;
-        close(server_fd);
-        return 1;
-    }
-
-    // 绑定地址
-    sockaddr_in server_addr{};
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(CONTROL_PORT);
 
-    if(bind(server_fd, (sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        std::cerr << "Bind failed" << std::endl;
-        close(server_fd);
+    ReactorGroup reactors;
+    if(!reactors.init(REACTOR_THREADS)) {
+        std::cerr << "epoll_create failed" << std::endl;
         return 1;
     }
 
-    // 开始监听
-    if(listen(server_fd, SOMAXCONN) < 0) {
-        std::cerr << "Listen failed" << std::endl;
-        close(server_fd);
-        return 1;
-    }
-    set_nonblock(server_fd);  // 设置非阻塞
+    for(size_t i = 0; i < REACTOR_THREADS; i++) {
+        int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int opt = 1;
+        if(setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+           setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+            std::cerr << "Setsockopt failed" << std::endl;
+            close(server_fd);
+            return 1;
+        }
 
-    // 注册服务器socket到epoll
-    ev.events = EPOLLIN | EPOLLET;
-    ev.data.fd = server_fd;
-    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev);
+        // 绑定地址
+        sockaddr_in server_addr{};
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_addr.s_addr = INADDR_ANY;
+        server_addr.sin_port = htons(CONTROL_PORT);
 
-    std::cout << "FTP Server started on port " << CONTROL_PORT << std::endl;
+        if(bind(server_fd, (sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+            std::cerr << "Bind failed" << std::endl;
+            close(server_fd);
+            return 1;
+        }
 
-    while(server_running) {
-        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 100);
-        
-        for (int i = 0; i < n; i++) {
-            if (events[i].data.fd == server_fd) {
-                // 处理新连接
-                while(true) {
-                    sockaddr_in client_addr{};
-                    socklen_t addr_len = sizeof(client_addr);
-                    int client_fd = accept(server_fd, 
-                                        (sockaddr*)&client_addr, &addr_len);
-                    
-                    if (client_fd < 0) {
-                        if (errno == EAGAIN) break;  // 处理非阻塞返回
-                        perror("accept");
-                        continue;
-                    }
-
-                    set_nonblock(client_fd);
-                    
-                    // 注册客户端socket到epoll
-                    struct epoll_event client_ev;
-                    client_ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-                    client_ev.data.fd = client_fd;
-                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &client_ev);
-
-                    // 创建处理器（传入epoll_fd）
-                    auto handler = new ClientHandler(client_fd, epoll_fd);
-                    handler->send_response("220 Welcome to MyFTP Server");
-                }
-            } else {
-                int client_fd = events[i].data.fd;
-                
-                // 处理连接关闭
-                if (events[i].events & EPOLLRDHUP) {
-                    close(client_fd);
-                    continue;
-                }
+        // 开始监听
+        if(listen(server_fd, SOMAXCONN) < 0) {
+            std::cerr << "Listen failed" << std::endl;
+            close(server_fd);
+            return 1;
+        }
 
-                // 提交任务到线程池
-                pool.enqueue([client_fd, epoll_fd]() {
-                    char buffer[BUFFER_SIZE];
-                    ssize_t bytes;
-                    
-                    // ET模式需要循环读取
-                    while ((bytes = recv(client_fd, buffer, BUFFER_SIZE, 0)) > 0) {
-                        std::string cmd(buffer, bytes);
-                        cmd.erase(cmd.find_last_not_of("\r\n") + 1);
-
-                        ClientHandler handler(client_fd, epoll_fd);
-                        handler.process_command(cmd);
-                    }
-
-                    // 处理连接关闭
-                    if (bytes == 0 || (bytes < 0 && errno != EAGAIN)) {
-                        close(client_fd);
-                        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, NULL);
-                    }
-                });
-            }
+        // 协程在这里运行到第一次挂起，之后由reactor线程恢复
+        Socket listener = Socket::adopt(reactors.at(i), server_fd, EventSource::LISTENER);
+        if(!listener) {
+            std::cerr << "epoll_ctl failed" << std::endl;
+            return 1;
         }
+        accept_loop(std::move(listener));
     }
 
-    // [保留清理代码]
-    close(epoll_fd);
+    std::cout << "FTP Server started on port " << CONTROL_PORT << std::endl;
+
+    reactors.run(server_running);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include "../common/digest.h"
+
+// 服务器配置文件，只能在服务器本机编辑，客户端命令不能修改其中的授权项。每行一项，#开头为注释：
+//   admin <用户> <密码的SHA-256十六进制>   管理员，登录后可执行修改全局状态的SITE命令
+//                                        （printf '%s' 密码 | sha256sum）
+//   class <用户> <类别>                   用户所属的限速类别
+//   weight <类别> <1-100>                 该类别用户传输的调度权重，未列出的类别为1
+//   replica_root <绝对路径>               允许SITE REPLICATE使用的副本根目录，副本只能放在其下
+// 未列为管理员的用户照旧任意密码登录，只能调整本会话自己的设置
+class ServerConfig {
+private:
+    std::mutex mtx;
+    std::unordered_map<std::string, std::string> admins; // 用户 -> 密码摘要
+    std::vector<std::pair<std::string, std::string>> classes;
+    std::unordered_map<std::string, uint32_t> weights; // 类别 -> 调度权重
+    std::vector<std::string> replica_roots_;
+
+    static std::string sha256_hex(const std::string& s) {
+        Hasher h(HashAlgo::SHA256);
+        h.update(s.data(), s.size());
+        return h.hex_digest();
+    }
+
+    // 逐字节比较全部内容，耗时与匹配到哪一位无关
+    static bool same(const std::string& a, const std::string& b) {
+        if (a.size() != b.size()) return false;
+        unsigned char diff = 0;
+        for (size_t i = 0; i < a.size(); i++) diff |= a[i] ^ b[i];
+        return diff == 0;
+    }
+
+public:
+    // 文件不存在视为空配置；格式错误时error给出行号，返回false
+    bool load(const std::string& path, std::string& error) {
+        std::ifstream in(path);
+        if (!in) return true;
+        std::lock_guard<std::mutex> lock(mtx);
+        std::string line;
+        for (int lineno = 1; std::getline(in, line); lineno++) {
+            std::istringstream iss(line);
+            std::string key, a, b, extra;
+            if (!(iss >> key) || key[0] == '#') continue;
+            iss >> a >> b;
+            bool ok = !a.empty() && !(iss >> extra);
+            bool pair = !b.empty();
+            if (ok && !pair && key == "replica_root") {
+                ok = a[0] == '/';
+                if (ok) replica_roots_.push_back(a);
+            } else if (ok && pair && key == "admin") {
+                std::transform(b.begin(), b.end(), b.begin(), ::tolower);
+                ok = b.size() == 64 && b.find_first_not_of("0123456789abcdef") == std::string::npos;
+                if (ok) admins[a] = b;
+            } else if (ok && pair && key == "class") {
+                classes.emplace_back(a, b);
+            } else if (ok && pair && key == "weight") {
+                int w = atoi(b.c_str());
+                ok = w >= 1 && w <= 100;
+                if (ok) weights[a] = w;
+            } else {
+                ok = false;
+            }
+            if (!ok) {
+                error = path + ":" + std::to_string(lineno) + ": invalid entry";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool is_admin(const std::string& user) {
+        std::lock_guard<std::mutex> lock(mtx);
+        return admins.count(user) != 0;
+    }
+
+    bool check_admin(const std::string& user, const std::string& password) {
+        std::string digest = sha256_hex(password);
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = admins.find(user);
+        return it != admins.end() && same(it->second, digest);
+    }
+
+    uint32_t class_weight(const std::string& cls) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = weights.find(cls);
+        return it == weights.end() ? 1 : it->second;
+    }
+
+    // 管理员运行时调整，不写回配置文件
+    void set_class_weight(const std::string& cls, uint32_t weight) {
+        std::lock_guard<std::mutex> lock(mtx);
+        weights[cls] = weight;
+    }
+
+    std::vector<std::string> replica_roots() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return replica_roots_;
+    }
+
+    // 配置文件中的用户类别，启动时交给限速器
+    std::vector<std::pair<std::string, std::string>> user_classes() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return classes;
+    }
+};
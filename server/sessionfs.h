@@ -0,0 +1,265 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <unordered_map>
+#include <cerrno>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+#define DIR_CACHE_SIZE 8     // 每个会话缓存的目录fd数
+#define DIR_CACHE_TTL 5      // 目录fd缓存有效期（秒）
+#define CWD_INTERN_SWEEP 1024 // 每新建这么多当前目录节点清理一次失效的表项
+
+// 目录fd的持有者：目录缓存淘汰、过期或整体作废时只放下缓存自己的引用，
+// fd要等所有持有者都释放后才关闭，持有期间不会被关闭或被其他线程复用
+class DirRef {
+public:
+    DirRef() = default;
+    int get() const { return fd; }
+    explicit operator bool() const { return fd >= 0; }
+
+private:
+    friend class SessionFs;
+    DirRef(int f, std::shared_ptr<const void> p) : fd(f), pin(std::move(p)) {}
+    int fd = -1;
+    std::shared_ptr<const void> pin; // 根目录不关闭，为空
+};
+
+// 会话的文件系统视图：根目录fd在进程内共用，当前目录fd由同一目录下的会话共用，
+// 所有文件操作都用openat2(RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS)相对根目录解析，
+// 由内核保证".."和符号链接都无法越出根目录
+class SessionFs {
+private:
+    // 目录节点：一个O_PATH fd，最后一个引用释放时关闭。当前目录由同一目录下的会话共用，
+    // 目录缓存和正在使用它的调用者（DirRef）也各持一份引用
+    struct DirNode {
+        std::string path;   // 相对根目录的规范路径
+        int fd;
+        uint64_t gen;       // 打开时的目录结构计数，之后有目录改名时不再复用
+        ~DirNode() { close(fd); }
+    };
+
+    struct CachedDir {
+        std::shared_ptr<DirNode> node;
+        std::chrono::steady_clock::time_point opened;
+    };
+
+    int root_fd = -1;                // 同一根目录的所有实例共用，不关闭
+    std::shared_ptr<DirNode> cwd;    // 当前目录，nullptr为根目录（大多数会话不占节点）
+    std::vector<CachedDir> dir_cache; // 最近使用的子目录，按使用时间排列（末尾最新）
+    uint64_t cache_generation = 0;
+
+    // 目录结构变化的全局计数，变化后各会话的目录缓存整体作废
+    static std::atomic<uint64_t>& generation() {
+        static std::atomic<uint64_t> gen{0};
+        return gen;
+    }
+
+    // 每个根目录只打开一次，进程内共用
+    static int shared_root(const std::string& root) {
+        static std::mutex mtx;
+        static std::map<std::string, int> roots;
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = roots.find(root);
+        if (it != roots.end()) return it->second;
+        int fd = open(root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) roots[root] = fd;
+        return fd;
+    }
+
+    // 取得rel的当前目录节点：已有会话在同一目录且期间目录结构未变时直接共用
+    static std::shared_ptr<DirNode> intern_cwd(int root, const std::string& rel) {
+        static std::mutex mtx;
+        static std::unordered_map<std::string, std::weak_ptr<DirNode>> table; // "<root_fd>:<path>"
+        static size_t created = 0;
+        std::string key = std::to_string(root) + ":" + rel;
+        std::lock_guard<std::mutex> lock(mtx);
+        std::shared_ptr<DirNode> node = table[key].lock();
+        if (node && node->gen == generation()) return node;
+        uint64_t gen = generation();
+        int fd = sys_openat2(root, rel.c_str(), O_PATH | O_DIRECTORY, 0);
+        if (fd < 0) {
+            if (!node) table.erase(key);
+            return nullptr;
+        }
+        node.reset(new DirNode{rel, fd, gen});
+        table[key] = node;
+        if (++created % CWD_INTERN_SWEEP == 0) {
+            for (auto it = table.begin(); it != table.end(); )
+                it = it->second.expired() ? table.erase(it) : std::next(it);
+        }
+        return node;
+    }
+
+    const std::string& cwd_path() const {
+        static const std::string root_path;
+        return cwd ? cwd->path : root_path;
+    }
+
+    static int sys_openat2(int dirfd, const char* path, int flags, mode_t mode) {
+        struct open_how how{};
+        how.flags = flags | O_CLOEXEC;
+        how.mode = (flags & (O_CREAT | O_TMPFILE)) ? mode : 0;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        int fd = syscall(SYS_openat2, dirfd, path, &how, sizeof(how));
+        if (fd >= 0 || errno != ENOSYS) return fd;
+
+        // 内核不支持openat2时逐级openat并拒绝所有符号链接
+        std::string p(path);
+        int cur = dirfd;
+        size_t pos;
+        while ((pos = p.find('/')) != std::string::npos) {
+            int next = openat(cur, p.substr(0, pos).c_str(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (cur != dirfd) close(cur);
+            if (next < 0) return -1;
+            cur = next;
+            p.erase(0, pos + 1);
+        }
+        fd = openat(cur, p.c_str(), flags | O_NOFOLLOW | O_CLOEXEC, mode);
+        if (cur != dirfd) {
+            int saved = errno;
+            close(cur);
+            errno = saved;
+        }
+        return fd;
+    }
+
+    // 取得目录fd（优先使用缓存），返回的引用在释放前保证fd有效
+    DirRef dir_fd(const std::string& rel) {
+        if (rel.empty()) return DirRef(root_fd, nullptr);
+        if (cwd && rel == cwd->path) return DirRef(cwd->fd, cwd);
+
+        if (cache_generation != generation()) {
+            invalidate();
+            cache_generation = generation();
+        }
+        auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < dir_cache.size(); i++) {
+            if (dir_cache[i].node->path != rel) continue;
+            CachedDir entry = dir_cache[i];
+            dir_cache.erase(dir_cache.begin() + i);
+            if (now - entry.opened < std::chrono::seconds(DIR_CACHE_TTL)) {
+                dir_cache.push_back(entry);
+                return DirRef(entry.node->fd, entry.node);
+            }
+            break; // 过期后重新解析，以反映外部的改名
+        }
+
+        int fd = sys_openat2(root_fd, rel.c_str(), O_PATH | O_DIRECTORY, 0);
+        if (fd < 0) return DirRef();
+        std::shared_ptr<DirNode> node(new DirNode{rel, fd, cache_generation});
+        if (dir_cache.size() >= DIR_CACHE_SIZE) dir_cache.erase(dir_cache.begin());
+        dir_cache.push_back({node, now});
+        return DirRef(fd, node);
+    }
+
+public:
+    SessionFs() = default;
+    SessionFs(const SessionFs&) = delete;
+    SessionFs& operator=(const SessionFs&) = delete;
+
+    ~SessionFs() {
+        invalidate();
+    }
+
+    bool init(const std::string& root) {
+        root_fd = shared_root(root);
+        cwd.reset();
+        return root_fd >= 0;
+    }
+
+    // 把客户端路径规范化为相对根目录的路径：以"/"开头时从根目录算起，
+    // 否则相对当前目录；".."越过根目录时失败
+    bool normalize(const std::string& path, std::string& out) const {
+        std::vector<std::string> parts;
+        std::string full = (!path.empty() && path[0] == '/') ? path : cwd_path() + "/" + path;
+        size_t start = 0;
+        while (start <= full.size()) {
+            size_t end = full.find('/', start);
+            if (end == std::string::npos) end = full.size();
+            std::string comp = full.substr(start, end - start);
+            if (comp == "..") {
+                if (parts.empty()) return false;
+                parts.pop_back();
+            } else if (!comp.empty() && comp != ".") {
+                parts.push_back(comp);
+            }
+            start = end + 1;
+        }
+        out.clear();
+        for (auto& p : parts) out += (out.empty() ? "" : "/") + p;
+        return true;
+    }
+
+    // 解析出父目录和最后一个路径分量，用于mkdirat/renameat等；
+    // 父目录fd由返回的DirRef持有，在它释放前有效，调用者不关闭
+    DirRef parent(const std::string& path, std::string& leaf) {
+        std::string rel;
+        if (!normalize(path, rel) || rel.empty()) {
+            errno = EACCES;
+            return DirRef();
+        }
+        size_t slash = rel.rfind('/');
+        leaf = slash == std::string::npos ? rel : rel.substr(slash + 1);
+        return dir_fd(slash == std::string::npos ? "" : rel.substr(0, slash));
+    }
+
+    // 打开根目录下的文件或目录，返回的fd由调用者关闭
+    int open_file(const std::string& path, int flags, mode_t mode = 0) {
+        std::string leaf;
+        std::string rel;
+        if (!normalize(path, rel)) {
+            errno = EACCES;
+            return -1;
+        }
+        if (rel.empty()) return sys_openat2(root_fd, ".", flags, mode);
+        DirRef dir = parent(path, leaf);
+        if (!dir) return -1;
+        return sys_openat2(dir.get(), leaf.c_str(), flags, mode);
+    }
+
+    // 打开目录用于读取（opendir）
+    DIR* open_dir(const std::string& path) {
+        int fd = open_file(path, O_RDONLY | O_DIRECTORY);
+        if (fd < 0) return nullptr;
+        DIR* dir = fdopendir(fd);
+        if (!dir) close(fd);
+        return dir;
+    }
+
+    bool change_dir(const std::string& path) {
+        std::string rel;
+        if (!normalize(path, rel)) {
+            errno = EACCES;
+            return false;
+        }
+        if (rel.empty()) {
+            cwd.reset();
+            return true;
+        }
+        auto node = intern_cwd(root_fd, rel);
+        if (!node) return false;
+        cwd = std::move(node);
+        return true;
+    }
+
+    // 当前目录（以"/"开头，供PWD回复）
+    std::string pwd() const { return "/" + cwd_path(); }
+
+    // 有目录被改名或删除（inotify通知），让所有会话的目录缓存失效
+    static void directories_changed() { generation()++; }
+
+    // 改名/删除目录后清空目录缓存；仍被DirRef持有的fd在其释放时关闭
+    void invalidate() {
+        dir_cache.clear();
+    }
+};
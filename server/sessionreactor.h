@@ -0,0 +1,250 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <map>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define REACTOR_MAX_EVENTS 256     // 每次epoll_wait取回的事件数
+#define WORKER_MAX 4096            // 工作线程数上限，超出时命令排队
+#define WORKER_IDLE_SECONDS 30     // 空闲这么久的工作线程退出
+#define WORKER_STALL_MS 10         // 队列这么久没有进展（线程都阻塞在命令里）时增加线程
+
+// 可以停放在reactor上的会话：控制连接可读（或附加的fd可读、超时）时由工作线程调用resume()。
+// resume()处理完已到达的命令后要么再次park，要么用retire()交还reactor销毁；park之后不得再访问会话。
+// 唤醒可能是多余的（例如同一批事件里另一个fd的旧事件），resume()要能处理没有新输入的情况
+class ParkedSession {
+public:
+    virtual ~ParkedSession() = default;
+    virtual int park_fd() const = 0;
+    virtual void resume() = 0;
+
+private:
+    friend class SessionReactor;
+    // 以下由SessionReactor::mtx保护
+    bool armed = false; // 已停放、尚未唤醒；同一次停放只唤醒一次
+    int extra_fd = -1;  // 登记在epoll里的附加fd
+    bool timed = false;
+    std::multimap<std::chrono::steady_clock::time_point, ParkedSession*>::iterator timer;
+};
+
+// 空闲会话的reactor：没有命令在处理的会话只在epoll里登记控制连接（data.ptr直接指向会话），
+// 不占线程；命令到达时交给动态工作线程池，处理函数仍可按原来的方式阻塞：
+// 线程数不超过CPU数时按需增加，再多只在队列停滞时增加，突发的短命令不会撑大线程池。
+// 会话可以多登记一个fd并设截止时间（SITE WATCH等待订阅的eventfd）。每次停放只认领一次唤醒
+// （armed标志，在mtx下检查），保证同一会话同时只在一个线程上运行；
+// 会话经retire()移出epoll，等reactor线程处理完当前这批事件后才释放，批中的旧事件不会访问已释放的会话
+class SessionReactor {
+public:
+    struct Stats {
+        uint64_t parked = 0;   // 停放中的会话
+        uint64_t workers = 0;  // 工作线程数
+        uint64_t busy = 0;     // 正在处理命令的线程数
+        uint64_t queued = 0;   // 等待线程的会话数
+        uint64_t resumes = 0;  // 累计唤醒次数
+    };
+
+private:
+    int epoll_fd = -1;
+    int wake_fd = -1; // 打断epoll_wait：有更早的截止时间或待释放的会话
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<ParkedSession*> ready;
+    std::multimap<std::chrono::steady_clock::time_point, ParkedSession*> timers;
+    std::vector<ParkedSession*> retired;
+    size_t workers = 0;
+    size_t idle = 0;
+    size_t core = 0;
+    std::chrono::steady_clock::time_point progress; // 队列最近一次被取走或由空变非空的时间
+    std::atomic<uint64_t> parked{0};
+    uint64_t resumes = 0;
+
+    // 新线程创建时已计入idle，还没开始运行的线程也算作可用，突发时不会过量创建
+    void worker() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true) {
+            if (!cv.wait_for(lock, std::chrono::seconds(WORKER_IDLE_SECONDS),
+                             [&] { return !ready.empty(); })) {
+                idle--;
+                workers--;
+                return;
+            }
+            idle--;
+            ParkedSession* s = ready.front();
+            ready.pop_front();
+            progress = std::chrono::steady_clock::now();
+            resumes++;
+            lock.unlock();
+            s->resume();
+            lock.lock();
+            idle++;
+        }
+    }
+
+    // 调用时已持有mtx
+    void grow() {
+        if (ready.size() <= idle || workers >= WORKER_MAX) return;
+        bool stalled = std::chrono::steady_clock::now() - progress >= std::chrono::milliseconds(WORKER_STALL_MS);
+        if (workers >= core && !stalled) return;
+        size_t add = std::min(ready.size() - idle, WORKER_MAX - workers);
+        if (!stalled) add = std::min(add, core - workers);
+        for (size_t i = 0; i < add; i++) {
+            workers++;
+            idle++;
+            std::thread(&SessionReactor::worker, this).detach();
+        }
+    }
+
+    // 认领一次唤醒并排入就绪队列；会话未停放（已被唤醒、正在运行）时忽略。调用时已持有mtx
+    void claim(ParkedSession* s) {
+        if (!s->armed) return;
+        s->armed = false;
+        if (s->timed) {
+            timers.erase(s->timer);
+            s->timed = false;
+        }
+        parked--;
+        if (ready.empty()) progress = std::chrono::steady_clock::now();
+        ready.push_back(s);
+        if (idle) cv.notify_one();
+    }
+
+    bool arm(int fd, ParkedSession* s) {
+        struct epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.ptr = s;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0) return true;
+        return errno == ENOENT && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+
+    void wake() {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {}
+    }
+
+    void loop() {
+        struct epoll_event events[REACTOR_MAX_EVENTS];
+        std::vector<ParkedSession*> dead;
+        while (true) {
+            int timeout;
+            {
+                // 有排队的会话时定期检查是否停滞；有停放的截止时间时等到最早的一个
+                std::lock_guard<std::mutex> lock(mtx);
+                grow();
+                timeout = ready.empty() ? -1 : WORKER_STALL_MS;
+                if (!timers.empty()) {
+                    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        timers.begin()->first - std::chrono::steady_clock::now()).count() + 1;
+                    left = std::max<long long>(left, 0);
+                    if (timeout < 0 || left < timeout) timeout = static_cast<int>(left);
+                }
+            }
+            int n = epoll_wait(epoll_fd, events, REACTOR_MAX_EVENTS, timeout);
+            if (n < 0 && errno != EINTR) return;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                for (int i = 0; i < n; i++) {
+                    if (events[i].data.ptr) {
+                        claim(static_cast<ParkedSession*>(events[i].data.ptr));
+                    } else {
+                        uint64_t count;
+                        if (read(wake_fd, &count, sizeof(count)) < 0) {}
+                    }
+                }
+                auto now = std::chrono::steady_clock::now();
+                while (!timers.empty() && timers.begin()->first <= now) claim(timers.begin()->second);
+                grow();
+                // 本批事件处理完，此前retire的会话不会再被引用
+                dead.swap(retired);
+            }
+            for (ParkedSession* s : dead) delete s;
+            dead.clear();
+        }
+    }
+
+public:
+    bool start() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) return false;
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        if (wake_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) < 0) {
+            close(epoll_fd);
+            epoll_fd = -1;
+            return false;
+        }
+        core = std::max(4u, std::thread::hardware_concurrency());
+        std::thread(&SessionReactor::loop, this).detach(); // 随进程存在
+        return true;
+    }
+
+    // 停放会话，等控制连接可读（或对端关闭）、extra可读或到达deadline时再唤醒。
+    // 返回false时会话未停放，调用方应在当前线程继续阻塞处理
+    bool park(ParkedSession* s, int extra = -1,
+              std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max()) {
+        if (epoll_fd < 0) return false;
+        int fd = s->park_fd();
+        std::lock_guard<std::mutex> lock(mtx);
+        // 不再需要的附加fd移出epoll，之后它的事件不会再唤醒会话
+        if (s->extra_fd >= 0 && s->extra_fd != extra) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->extra_fd, nullptr);
+            s->extra_fd = -1;
+        }
+        if (!arm(fd, s)) return false;
+        if (extra >= 0) {
+            if (!arm(extra, s)) return false;
+            s->extra_fd = extra;
+        }
+        if (deadline != std::chrono::steady_clock::time_point::max()) {
+            s->timer = timers.emplace(deadline, s);
+            s->timed = true;
+            if (s->timer == timers.begin()) wake(); // 让epoll_wait按新的截止时间重新计算超时
+        }
+        s->armed = true;
+        parked++;
+        return true;
+    }
+
+    // 会话关闭附加fd之前调用（会话未停放时），以免epoll中留下指向已关闭fd号的登记
+    void drop_extra(ParkedSession* s) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (s->extra_fd >= 0 && epoll_fd >= 0) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->extra_fd, nullptr);
+        s->extra_fd = -1;
+    }
+
+    // 销毁会话（在工作线程上、会话未停放时调用）：移出epoll，由reactor线程在当前这批事件处理完后释放
+    void retire(ParkedSession* s) {
+        if (epoll_fd < 0) {
+            delete s;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->park_fd(), nullptr);
+        if (s->extra_fd >= 0) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->extra_fd, nullptr);
+        s->extra_fd = -1;
+        retired.push_back(s);
+        wake();
+    }
+
+    Stats stats() {
+        std::lock_guard<std::mutex> lock(mtx);
+        Stats st;
+        st.parked = parked;
+        st.workers = workers;
+        st.busy = workers - idle;
+        st.queued = ready.size();
+        st.resumes = resumes;
+        return st;
+    }
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <new>
+#include <cstddef>
+#include <cstdlib>
+
+#define SLAB_CHUNK_OBJECTS 256 // 每次向系统申请的对象数
+
+// 定长对象的slab分配器：按块批量申请，释放的对象挂在空闲链表上复用，
+// 大量长期存在的小对象（会话记录）不再各自带malloc的元数据和碎片，分配也不进全局堆锁。
+// 块在进程生命周期内不归还系统（退出时仍可能有分离的线程在使用其中的对象）
+template <typename T>
+class Slab {
+private:
+    static constexpr size_t Align = alignof(T) < alignof(void*) ? alignof(void*) : alignof(T);
+    static constexpr size_t RAW = sizeof(T) < sizeof(void*) ? sizeof(void*) : sizeof(T);
+    static constexpr size_t SLOT = (RAW + Align - 1) / Align * Align;
+
+    std::mutex mtx;
+    void* free_list = nullptr;
+    std::vector<void*> chunks;
+    size_t in_use = 0;
+
+    void grow() {
+        char* chunk = static_cast<char*>(std::aligned_alloc(Align, SLOT * SLAB_CHUNK_OBJECTS));
+        if (!chunk) throw std::bad_alloc();
+        chunks.push_back(chunk);
+        for (size_t i = SLAB_CHUNK_OBJECTS; i-- > 0; ) {
+            void* slot = chunk + i * SLOT;
+            *static_cast<void**>(slot) = free_list;
+            free_list = slot;
+        }
+    }
+
+public:
+    Slab() = default;
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    void* allocate() {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!free_list) grow();
+        void* slot = free_list;
+        free_list = *static_cast<void**>(slot);
+        in_use++;
+        return slot;
+    }
+
+    void release(void* p) {
+        std::lock_guard<std::mutex> lock(mtx);
+        *static_cast<void**>(p) = free_list;
+        free_list = p;
+        in_use--;
+    }
+
+    size_t used() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return in_use;
+    }
+
+    size_t reserved_bytes() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return chunks.size() * SLOT * SLAB_CHUNK_OBJECTS;
+    }
+
+    static constexpr size_t slot_size() { return SLOT; }
+};
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "fswatch.h"
+
+#define TAR_BLOCK 512
+#define TAR_MAX_DEPTH 64 // 目录遍历的最大深度，超出的子目录跳过（同时限制打开的目录fd数）
+
+// 边遍历目录边输出tar（ustar格式，长路径用GNU 'L'/'K'扩展，超过8GB的大小用base-256编码）
+// 只持有当前路径上每层一个目录fd，内存占用与目录树规模无关
+// emit输出头部等元数据；emit_file输出文件内容（可用sendfile），返回实际输出的字节数，
+// 文件在遍历期间被截断时不足部分补零，保证归档结构完整
+class TarStreamWriter {
+public:
+    using Emit = std::function<bool(const char*, size_t)>;
+    using EmitFile = std::function<int64_t(int fd, uint64_t size)>;
+
+    struct Stats {
+        uint64_t files = 0;
+        uint64_t dirs = 0;
+        uint64_t bytes = 0;   // 输出的归档字节数（压缩前）
+        uint64_t skipped = 0; // 无法读取或不支持的条目
+    };
+
+private:
+    Emit emit;
+    EmitFile emit_file;
+    Stats stats_;
+
+    static void octal(char* field, size_t width, uint64_t value) {
+        // width包括结尾的NUL；放不下时用GNU base-256编码
+        if (width <= 12 && value >= (1ULL << (3 * (width - 1)))) {
+            memset(field, 0, width);
+            field[0] = static_cast<char>(0x80);
+            for (size_t i = width - 1; i > 0 && value; i--, value >>= 8)
+                field[i] = static_cast<char>(value & 0xff);
+            return;
+        }
+        char buf[24];
+        snprintf(buf, sizeof(buf), "%0*llo", static_cast<int>(width - 1),
+                 static_cast<unsigned long long>(value));
+        memcpy(field, buf, width);
+    }
+
+    bool out(const char* data, size_t len) {
+        stats_.bytes += len;
+        return emit(data, len);
+    }
+
+    bool pad(uint64_t len) {
+        static const char zeros[TAR_BLOCK] = {0};
+        size_t rem = len % TAR_BLOCK;
+        return rem == 0 || out(zeros, TAR_BLOCK - rem);
+    }
+
+    bool header(const std::string& name, const struct stat& st, char type, uint64_t size,
+                const std::string& link = "") {
+        // 名字放不下时先输出GNU长名字条目
+        if (name.size() > 100 && !long_entry('L', name)) return false;
+        if (link.size() > 100 && !long_entry('K', link)) return false;
+
+        char h[TAR_BLOCK] = {0};
+        memcpy(h, name.data(), std::min<size_t>(name.size(), 100));
+        octal(h + 100, 8, st.st_mode & 07777);
+        octal(h + 108, 8, st.st_uid);
+        octal(h + 116, 8, st.st_gid);
+        octal(h + 124, 12, size);
+        octal(h + 136, 12, st.st_mtime > 0 ? st.st_mtime : 0);
+        h[156] = type;
+        memcpy(h + 157, link.data(), std::min<size_t>(link.size(), 100));
+        memcpy(h + 257, "ustar", 6);
+        memcpy(h + 263, "00", 2);
+        return checksum_and_emit(h);
+    }
+
+    bool long_entry(char type, const std::string& value) {
+        char h[TAR_BLOCK] = {0};
+        strcpy(h, "././@LongLink");
+        octal(h + 100, 8, 0644);
+        octal(h + 108, 8, 0);
+        octal(h + 116, 8, 0);
+        octal(h + 124, 12, value.size() + 1);
+        octal(h + 136, 12, 0);
+        h[156] = type;
+        memcpy(h + 257, "ustar", 6);
+        memcpy(h + 263, "00", 2);
+        return checksum_and_emit(h) && out(value.c_str(), value.size() + 1) && pad(value.size() + 1);
+    }
+
+    bool checksum_and_emit(char* h) {
+        memset(h + 148, ' ', 8);
+        unsigned sum = 0;
+        for (int i = 0; i < TAR_BLOCK; i++) sum += static_cast<unsigned char>(h[i]);
+        snprintf(h + 148, 8, "%06o", sum);
+        h[155] = ' ';
+        return out(h, TAR_BLOCK);
+    }
+
+    bool add_file(int dirfd, const char* leaf, const std::string& name) {
+        int fd = openat(dirfd, leaf, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+            if (fd >= 0) close(fd);
+            stats_.skipped++;
+            return true;
+        }
+        uint64_t size = st.st_size;
+        bool ok = header(name, st, '0', size);
+        if (ok) {
+            int64_t n = size ? emit_file(fd, size) : 0;
+            if (n < 0) ok = false;
+            else {
+                stats_.bytes += n;
+                // 文件在遍历期间变短：补零到头部声明的大小
+                static const char zeros[TAR_BLOCK] = {0};
+                for (uint64_t left = size - n; ok && left > 0; ) {
+                    size_t k = std::min<uint64_t>(left, sizeof(zeros));
+                    ok = out(zeros, k);
+                    left -= k;
+                }
+            }
+        }
+        close(fd);
+        if (ok) stats_.files++;
+        return ok && pad(size);
+    }
+
+    bool add_dir(int fd, const std::string& name, int depth) {
+        struct stat st;
+        if (fstat(fd, &st) < 0 || !header(name + "/", st, '5', 0)) {
+            close(fd);
+            return false;
+        }
+        stats_.dirs++;
+        DIR* dir = fdopendir(fd);
+        if (!dir) {
+            close(fd);
+            return false;
+        }
+        bool ok = true;
+        dirent* entry;
+        while (ok && (entry = readdir(dir)) != nullptr) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            if (FsWatcher::is_temp_name(entry->d_name)) continue; // 上传中的临时文件不归档
+            std::string child = name + "/" + entry->d_name;
+            struct stat cst;
+            if (fstatat(dirfd(dir), entry->d_name, &cst, AT_SYMLINK_NOFOLLOW) < 0) {
+                stats_.skipped++;
+                continue;
+            }
+            if (S_ISDIR(cst.st_mode)) {
+                int sub = depth + 1 < TAR_MAX_DEPTH
+                    ? openat(dirfd(dir), entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+                    : -1;
+                if (sub < 0) stats_.skipped++;
+                else ok = add_dir(sub, child, depth + 1);
+            } else if (S_ISREG(cst.st_mode)) {
+                ok = add_file(dirfd(dir), entry->d_name, child);
+            } else if (S_ISLNK(cst.st_mode)) {
+                // 符号链接按链接本身归档，不跟随
+                char target[4096];
+                ssize_t n = readlinkat(dirfd(dir), entry->d_name, target, sizeof(target) - 1);
+                if (n < 0) stats_.skipped++;
+                else ok = header(child, cst, '2', 0, std::string(target, n));
+            } else {
+                stats_.skipped++; // 设备、管道等不归档
+            }
+        }
+        closedir(dir);
+        return ok;
+    }
+
+public:
+    TarStreamWriter(Emit e, EmitFile f) : emit(std::move(e)), emit_file(std::move(f)) {}
+
+    // 归档目录fd（由本函数关闭），条目名以name为前缀
+    bool write_tree(int dir_fd, const std::string& name) {
+        if (!add_dir(dir_fd, name, 0)) return false;
+        static const char zeros[TAR_BLOCK * 2] = {0};
+        return out(zeros, sizeof(zeros)); // 归档结束标记：两个全零块
+    }
+
+    const Stats& stats() const { return stats_; }
+};
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <vector>
+#include <ctime>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "sessionfs.h"
+
+#define UPLOAD_CHECKPOINT (16ULL * 1024 * 1024) // 每上传这么多字节记一次检查点
+#define UPLOAD_JOURNAL_MAX (1024 * 1024)        // 日志文件超过此大小时压缩
+#define UPLOAD_RESUME_TTL (7 * 24 * 3600)       // 未完成的上传保留多久（秒）
+
+// 上传日志：上传先写到同目录的临时文件 .<name>.<id>.part，完成后rename发布。
+// 日志文件每行一条记录：
+//   "B <id> <path>"          开始上传
+//   "C <id> <offset> <crc>"  检查点：临时文件前offset字节已fdatasync，crc32为这部分的校验和
+//   "E <id>"                 已发布或已放弃
+// 服务器重启后没有E的上传按最后一个检查点校验临时文件，客户端可用REST从该偏移续传。
+// 检查点在数据落盘后才写入，日志本身不逐条同步：进程崩溃不丢记录，掉电最多退回前一个检查点
+class UploadJournal {
+public:
+    struct Upload {
+        uint64_t id = 0;
+        std::string rel;        // 目标文件（相对根目录）
+        std::string part;       // 临时文件（相对根目录）
+        uint64_t offset = 0;    // 已验证可续传的偏移
+        uint32_t crc = 0;       // 前offset字节的crc32
+        bool active = false;    // 有会话正在上传
+    };
+
+private:
+    std::mutex mtx;
+    std::string path;
+    int fd = -1;
+    uint64_t next_id = 1;
+    std::map<uint64_t, Upload> live; // 未完成的上传
+
+    static std::string part_path(const std::string& rel, uint64_t id) {
+        size_t slash = rel.rfind('/');
+        std::string dir = slash == std::string::npos ? "" : rel.substr(0, slash + 1);
+        std::string leaf = slash == std::string::npos ? rel : rel.substr(slash + 1);
+        return dir + "." + leaf + "." + std::to_string(id) + ".part";
+    }
+
+    void append(const std::string& line) {
+        if (fd < 0) return;
+        std::string rec = line + "\n";
+        if (write(fd, rec.data(), rec.size()) < 0) {} // 日志写失败只影响续传
+    }
+
+    static std::string begin_record(const Upload& u) {
+        return "B " + std::to_string(u.id) + " " + u.rel;
+    }
+
+    static std::string checkpoint_record(const Upload& u) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "C %llu %llu %08x", static_cast<unsigned long long>(u.id),
+                 static_cast<unsigned long long>(u.offset), u.crc);
+        return buf;
+    }
+
+    // 只保留未完成的上传，写新文件后rename替换（调用时已持有mtx）
+    void compact() {
+        std::string tmp = path + ".tmp";
+        int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (out < 0) return;
+        std::string data;
+        for (auto& kv : live) {
+            data += begin_record(kv.second) + "\n";
+            if (kv.second.offset) data += checkpoint_record(kv.second) + "\n";
+        }
+        bool ok = write(out, data.data(), data.size()) == static_cast<ssize_t>(data.size()) &&
+                  fsync(out) == 0;
+        close(out);
+        if (!ok || rename(tmp.c_str(), path.c_str()) < 0) {
+            unlink(tmp.c_str());
+            return;
+        }
+        if (fd >= 0) close(fd);
+        fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    }
+
+    void maybe_compact() {
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > UPLOAD_JOURNAL_MAX) compact();
+    }
+
+    // 计算fd前len字节的crc32，文件不足len字节时返回false
+    static bool crc_prefix(int file, uint64_t len, uint32_t& crc) {
+        std::vector<char> buf(1024 * 1024);
+        uLong c = crc32(0L, Z_NULL, 0);
+        for (uint64_t off = 0; off < len; ) {
+            ssize_t n = pread(file, buf.data(), std::min<uint64_t>(buf.size(), len - off), off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            c = crc32(c, reinterpret_cast<Bytef*>(buf.data()), n);
+            off += n;
+        }
+        crc = c;
+        return true;
+    }
+
+public:
+    // 载入日志，重放得到未完成的上传
+    explicit UploadJournal(const std::string& journal) : path(journal) {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream iss(line);
+            char tag;
+            unsigned long long id;
+            if (!(iss >> tag >> id)) continue;
+            if (id >= next_id) next_id = id + 1;
+            if (tag == 'B') {
+                Upload u;
+                u.id = id;
+                iss >> std::ws;
+                std::getline(iss, u.rel);
+                if (u.rel.empty()) continue;
+                u.part = part_path(u.rel, id);
+                live[id] = u;
+            } else if (tag == 'C') {
+                unsigned long long offset;
+                std::string hex;
+                auto it = live.find(id);
+                if (it == live.end() || !(iss >> offset >> hex)) continue;
+                it->second.offset = offset;
+                it->second.crc = static_cast<uint32_t>(strtoul(hex.c_str(), nullptr, 16));
+            } else if (tag == 'E') {
+                live.erase(id);
+            }
+        }
+        fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    }
+
+    ~UploadJournal() {
+        if (fd >= 0) close(fd);
+    }
+
+    // 启动时调用：按检查点校验每个未完成上传的临时文件，截掉检查点之后未验证的数据；
+    // 临时文件丢失、校验不符或过期的上传直接丢弃
+    void recover(SessionFs& fs) {
+        std::lock_guard<std::mutex> lock(mtx);
+        time_t now = time(nullptr);
+        for (auto it = live.begin(); it != live.end(); ) {
+            Upload& u = it->second;
+            int file = fs.open_file(u.part, O_RDWR | O_NOFOLLOW);
+            struct stat st;
+            uint32_t crc = 0;
+            bool valid = file >= 0 && fstat(file, &st) == 0 && S_ISREG(st.st_mode) &&
+                         now - st.st_mtime < UPLOAD_RESUME_TTL &&
+                         crc_prefix(file, u.offset, crc) && crc == u.crc &&
+                         ftruncate(file, u.offset) == 0;
+            if (file >= 0) close(file);
+            if (valid) {
+                ++it;
+                continue;
+            }
+            if (file >= 0) {
+                std::string leaf;
+                DirRef dir = fs.parent(u.part, leaf);
+                if (dir) unlinkat(dir.get(), leaf.c_str(), 0);
+            }
+            it = live.erase(it);
+        }
+        compact();
+    }
+
+    // 开始上传rel。rest为0时新建（同一路径此前未完成的上传作废，旧临时文件由调用方删除，见stale）；
+    // rest > 0时续传：须有该路径未完成的上传，且rest不超过已验证的偏移
+    bool begin(const std::string& rel, uint64_t rest, Upload& out, std::vector<std::string>& stale,
+               std::string& error) {
+        std::lock_guard<std::mutex> lock(mtx);
+        Upload* prev = nullptr;
+        for (auto& kv : live)
+            if (kv.second.rel == rel && (!prev || kv.first > prev->id)) prev = &kv.second;
+        if (prev && prev->active) {
+            error = "450 Upload of this file already in progress";
+            return false;
+        }
+        if (rest > 0) {
+            if (!prev || rest > prev->offset) {
+                error = "554 No resumable upload at offset " + std::to_string(rest);
+                return false;
+            }
+            prev->active = true;
+            out = *prev;
+            return true;
+        }
+        for (auto it = live.begin(); it != live.end(); ) {
+            if (it->second.rel == rel) {
+                stale.push_back(it->second.part);
+                append("E " + std::to_string(it->first));
+                it = live.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        Upload u;
+        u.id = next_id++;
+        u.rel = rel;
+        u.part = part_path(rel, u.id);
+        u.active = true;
+        live[u.id] = u;
+        append(begin_record(u));
+        out = u;
+        return true;
+    }
+
+    // 临时文件前offset字节已落盘
+    void checkpoint(uint64_t id, uint64_t offset, uint32_t crc) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = live.find(id);
+        if (it == live.end()) return;
+        it->second.offset = offset;
+        it->second.crc = crc;
+        append(checkpoint_record(it->second));
+    }
+
+    // 已发布或放弃：删除记录
+    void finish(uint64_t id) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!live.erase(id)) return;
+        append("E " + std::to_string(id));
+        maybe_compact();
+    }
+
+    // 上传中断（连接断开、写入失败）：保留记录，之后可从最后一个检查点续传
+    void release(uint64_t id) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = live.find(id);
+        if (it != live.end()) it->second.active = false;
+    }
+
+    // 查询rel可续传的偏移
+    bool resumable(const std::string& rel, uint64_t& offset) {
+        std::lock_guard<std::mutex> lock(mtx);
+        const Upload* best = nullptr;
+        for (auto& kv : live)
+            if (kv.second.rel == rel && !kv.second.active && (!best || kv.first > best->id)) best = &kv.second;
+        if (!best) return false;
+        offset = best->offset;
+        return true;
+    }
+
+    // 计算临时文件前len字节的crc32（续传点不在检查点上时重建滚动校验和）
+    static bool prefix_crc(int file, uint64_t len, uint32_t& crc) { return crc_prefix(file, len, crc); }
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include "fswatch.h"
+
+#define WATCH_EVENTS (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO) // SITE WATCH报告的事件
+#define WATCH_MAX_PENDING 4096 // 每个订阅最多累积的文件数，超出后只报告OVERFLOW
+#define WATCH_COALESCE_MS 50   // 第一个事件到达后再等这么久，把同一批写入的事件一起返回
+
+// SITE WATCH的订阅表：所有订阅共用FsWatcher的inotify实例，按目录索引，
+// 事件到达时只查一次表；同一文件在两次取走之间的多个事件合并成一条（掩码按位或）。
+// 订阅在会话内一直保留，两次SITE WATCH之间发生的变化不会丢失。
+// 每个订阅有一个eventfd，有变化时可读，停放在reactor上的会话据此唤醒，不必占着线程等待
+class WatchHub {
+public:
+    struct Subscription {
+        std::string dir;                        // 相对根目录
+        std::map<std::string, uint32_t> changes; // 文件名 -> 合并后的事件掩码
+        bool overflow = false;                   // 有事件被丢弃，客户端应重新LIST
+        bool gone = false;                       // 目录已删除或被移走
+        std::condition_variable cv;
+        int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        Subscription() = default;
+        Subscription(const Subscription&) = delete;
+        Subscription& operator=(const Subscription&) = delete;
+        ~Subscription() {
+            if (event_fd >= 0) close(event_fd);
+        }
+
+        // 唤醒等待者；调用时持有WatchHub::mtx
+        void notify() {
+            cv.notify_all();
+            uint64_t one = 1;
+            if (event_fd >= 0 && write(event_fd, &one, sizeof(one)) < 0) {}
+        }
+    };
+
+private:
+    std::mutex mtx;
+    std::unordered_map<std::string, std::vector<Subscription*>> by_dir;
+    bool listening = false;
+
+    bool take_locked(Subscription& sub, std::map<std::string, uint32_t>& changes, bool& overflow, bool& gone) {
+        uint64_t count;
+        if (read(sub.event_fd, &count, sizeof(count)) < 0) {}
+        changes.swap(sub.changes);
+        sub.changes.clear();
+        overflow = sub.overflow;
+        gone = sub.gone;
+        sub.overflow = false;
+        return !changes.empty() || overflow || gone;
+    }
+
+    void on_event(const std::string& rel, uint32_t mask) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (mask & IN_Q_OVERFLOW) {
+            for (auto& kv : by_dir)
+                for (Subscription* s : kv.second) {
+                    s->overflow = true;
+                    s->notify();
+                }
+            return;
+        }
+        // 被监视目录自身的事件
+        if (mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+            auto it = by_dir.find(rel);
+            if (it == by_dir.end()) return;
+            for (Subscription* s : it->second) {
+                s->gone = true;
+                s->notify();
+            }
+            return;
+        }
+        if (!(mask & WATCH_EVENTS) || FsWatcher::is_temp_name(rel)) return;
+        size_t slash = rel.rfind('/');
+        std::string dir = slash == std::string::npos ? "" : rel.substr(0, slash);
+        auto it = by_dir.find(dir);
+        if (it == by_dir.end()) return;
+        std::string name = rel.substr(slash == std::string::npos ? 0 : slash + 1);
+        for (Subscription* s : it->second) {
+            auto c = s->changes.find(name);
+            if (c != s->changes.end()) c->second |= mask & WATCH_EVENTS;
+            else if (s->changes.size() < WATCH_MAX_PENDING) s->changes.emplace(name, mask & WATCH_EVENTS);
+            else s->overflow = true;
+            s->notify();
+        }
+    }
+
+public:
+    // 订阅目录dir（相对根目录）；inotify不可用时返回nullptr
+    std::shared_ptr<Subscription> subscribe(const std::string& dir) {
+        FsWatcher& watcher = FsWatcher::instance();
+        if (!watcher.watch_dir(dir)) return nullptr;
+        auto sub = std::make_shared<Subscription>();
+        if (sub->event_fd < 0) return nullptr;
+        sub->dir = dir;
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!listening) {
+            watcher.add_listener([this](const std::string& rel, uint32_t mask) { on_event(rel, mask); });
+            listening = true;
+        }
+        by_dir[dir].push_back(sub.get());
+        return sub;
+    }
+
+    void unsubscribe(const std::shared_ptr<Subscription>& sub) {
+        if (!sub) return;
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = by_dir.find(sub->dir);
+        if (it == by_dir.end()) return;
+        auto& list = it->second;
+        list.erase(std::remove(list.begin(), list.end(), sub.get()), list.end());
+        if (list.empty()) by_dir.erase(it);
+    }
+
+    // 不等待，查看sub上是否有变化；urgent表示溢出或目录消失，应立即回复。同时清空eventfd的计数
+    bool pending(Subscription& sub, bool& urgent) {
+        std::lock_guard<std::mutex> lock(mtx);
+        uint64_t count;
+        if (read(sub.event_fd, &count, sizeof(count)) < 0) {}
+        urgent = sub.overflow || sub.gone;
+        return !sub.changes.empty() || urgent;
+    }
+
+    // 取走累积的变化，返回是否有内容（变化、溢出或目录消失）
+    bool take(Subscription& sub, std::map<std::string, uint32_t>& changes, bool& overflow, bool& gone) {
+        std::lock_guard<std::mutex> lock(mtx);
+        return take_locked(sub, changes, overflow, gone);
+    }
+
+    // 阻塞等待sub上有变化（不经reactor的会话使用），最多等到deadline；stop返回true时提前结束
+    // （会话有新命令或连接断开）。取走累积的变化，返回是否有内容
+    template <typename Stop>
+    bool wait(Subscription& sub, std::chrono::steady_clock::time_point deadline, Stop stop,
+              std::map<std::string, uint32_t>& changes, bool& overflow, bool& gone) {
+        std::unique_lock<std::mutex> lock(mtx);
+        auto ready = [&] { return !sub.changes.empty() || sub.overflow || sub.gone; };
+        // 分段等待，以便及时发现连接断开
+        while (!ready() && std::chrono::steady_clock::now() < deadline) {
+            auto slice = std::min(deadline, std::chrono::steady_clock::now() + std::chrono::seconds(1));
+            if (sub.cv.wait_until(lock, slice, ready)) break;
+            lock.unlock();
+            bool stopped = stop();
+            lock.lock();
+            if (stopped) break;
+        }
+        if (ready() && !sub.overflow && !sub.gone)
+            sub.cv.wait_for(lock, std::chrono::milliseconds(WATCH_COALESCE_MS),
+                            [&] { return sub.overflow || sub.gone; });
+        return take_locked(sub, changes, overflow, gone);
+    }
+
+    // 事件掩码的文字表示，例如"CREATE,CLOSE_WRITE"
+    static std::string mask_names(uint32_t mask) {
+        static const std::pair<uint32_t, const char*> names[] = {
+            {IN_CREATE, "CREATE"}, {IN_CLOSE_WRITE, "CLOSE_WRITE"},
+            {IN_MOVED_FROM, "RENAME_FROM"}, {IN_MOVED_TO, "RENAME_TO"}};
+        std::string out;
+        for (auto& n : names) {
+            if (!(mask & n.first)) continue;
+            if (!out.empty()) out += ",";
+            out += n.second;
+        }
+        return out;
+    }
+};
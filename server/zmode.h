@@ -0,0 +1,413 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <strings.h>
+#include <unistd.h>
+#include <zlib.h>
+#if __has_include(<zstd.h>)
+#include <zstd.h>
+#define HAVE_ZSTD 1
+#endif
+
+#define ZMODE_CHUNK_SIZE (256 * 1024) // 并行压缩的分块大小
+#define ZMODE_WINDOW 32768            // deflate字典窗口
+#define ZMODE_QUEUE_MAX 64            // 压缩线程池排队的块数上限，超过时提交方等待
+
+// MODE Z压缩引擎：deflate为标准格式（zlib流），zstd为协商扩展
+enum class ZEngine { Deflate, Zstd };
+
+inline bool zstd_available() {
+#ifdef HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+// 判断文件是否已经是压缩格式：先看扩展名，再对开头64KB做熵采样
+inline bool looks_compressed(const std::string& path, int fd) {
+    static const char* exts[] = {
+        ".gz", ".tgz", ".bz2", ".xz", ".zst", ".lz4", ".zip", ".7z", ".rar",
+        ".jpg", ".jpeg", ".png", ".gif", ".webp", ".mp3", ".mp4", ".mkv",
+        ".avi", ".mov", ".ogg", ".flac", ".pdf", ".docx", ".xlsx", ".jar"
+    };
+    size_t dot = path.rfind('.');
+    if (dot != std::string::npos) {
+        for (const char* ext : exts)
+            if (strcasecmp(path.c_str() + dot, ext) == 0) return true;
+    }
+
+    unsigned char sample[64 * 1024];
+    ssize_t n = pread(fd, sample, sizeof(sample), 0);
+    if (n < 4096) return false; // 样本太小，直接压缩
+    size_t counts[256] = {0};
+    for (ssize_t i = 0; i < n; i++) counts[sample[i]]++;
+    double entropy = 0;
+    for (size_t c : counts) {
+        if (!c) continue;
+        double p = static_cast<double>(c) / n;
+        entropy -= p * std::log2(p);
+    }
+    return entropy > 7.5; // 接近8 bit/字节说明基本不可压缩
+}
+
+// 所有会话共用的压缩线程池：线程数固定，排队任务有上限，
+// 不再每块新建一个线程，并发的MODE Z下载多时线程数也不会失控
+class CompressPool {
+private:
+    std::mutex mtx;
+    std::condition_variable has_work;
+    std::condition_variable has_room;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+
+    void worker() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true) {
+            has_work.wait(lock, [&] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) return;
+            auto task = std::move(tasks.front());
+            tasks.pop_front();
+            has_room.notify_one();
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+
+public:
+    CompressPool() = default;
+    CompressPool(const CompressPool&) = delete;
+    CompressPool& operator=(const CompressPool&) = delete;
+
+    ~CompressPool() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        has_work.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    void start(size_t n) {
+        for (size_t i = 0; i < std::max<size_t>(n, 1); i++)
+            threads.emplace_back(&CompressPool::worker, this);
+    }
+
+    size_t size() const { return threads.size(); }
+
+    // 提交一个任务，队列满时等待；未启动时在调用线程上直接执行
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F fn) {
+        auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::move(fn));
+        auto result = task->get_future();
+        if (threads.empty()) {
+            (*task)();
+            return result;
+        }
+        std::unique_lock<std::mutex> lock(mtx);
+        has_room.wait(lock, [&] { return tasks.size() < ZMODE_QUEUE_MAX; });
+        tasks.emplace_back([task] { (*task)(); });
+        has_work.notify_one();
+        return result;
+    }
+};
+
+// 并行分块压缩：按块读入后交给共享线程池压缩，再按原顺序输出
+// deflate下每块是一段raw deflate（以Z_SYNC_FLUSH对齐到字节边界），
+// 以前一块末尾32KB作为预设字典，拼接后加上zlib头和合并的adler32即为标准zlib流；
+// zstd下每块是独立的frame，多个frame直接拼接
+class ParallelCompressor {
+private:
+    using Buffer = std::shared_ptr<std::vector<char>>;
+
+    CompressPool& pool;
+    ZEngine engine;
+    int level;
+    size_t window; // 本次压缩最多同时在途的块数
+
+    struct Chunk {
+        std::vector<char> out;
+        uLong adler = 1;
+        size_t len = 0;
+        bool ok = true;
+    };
+
+    static Chunk deflate_chunk(Buffer in, Buffer prev, int level, bool last) {
+        Chunk c;
+        c.len = in->size();
+        c.adler = adler32(1L, reinterpret_cast<const Bytef*>(in->data()), in->size());
+
+        z_stream zs{};
+        if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            c.ok = false;
+            return c;
+        }
+        if (prev && level > 0) {
+            size_t dict = std::min<size_t>(prev->size(), ZMODE_WINDOW);
+            deflateSetDictionary(&zs, reinterpret_cast<const Bytef*>(prev->data() + prev->size() - dict), dict);
+        }
+        c.out.resize(deflateBound(&zs, in->size()) + 16);
+        zs.next_in = reinterpret_cast<Bytef*>(in->data());
+        zs.avail_in = in->size();
+        zs.next_out = reinterpret_cast<Bytef*>(c.out.data());
+        zs.avail_out = c.out.size();
+        int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+        c.ok = last ? ret == Z_STREAM_END : ret == Z_OK;
+        c.out.resize(c.out.size() - zs.avail_out);
+        deflateEnd(&zs);
+        return c;
+    }
+
+#ifdef HAVE_ZSTD
+    static Chunk zstd_chunk(Buffer in, int level) {
+        Chunk c;
+        c.len = in->size();
+        c.out.resize(ZSTD_compressBound(in->size()));
+        size_t n = ZSTD_compress(c.out.data(), c.out.size(), in->data(), in->size(), level);
+        c.ok = !ZSTD_isError(n);
+        c.out.resize(c.ok ? n : 0);
+        return c;
+    }
+#endif
+
+public:
+    ParallelCompressor(CompressPool& p, ZEngine e, int lvl, size_t n)
+        : pool(p), engine(e), level(lvl), window(std::max<size_t>(n, 1)) {}
+
+    // 压缩fd中size字节，压缩结果依次交给sink；sink返回false时中止
+    bool run(int fd, uint64_t size, const std::function<bool(const char*, size_t)>& sink) {
+        if (engine == ZEngine::Deflate) {
+            static const char header[2] = {0x78, static_cast<char>(0x9c)};
+            if (!sink(header, 2)) return false;
+        }
+
+        std::deque<std::future<Chunk>> pending;
+        uLong adler = 1;
+        uint64_t offset = 0;
+        Buffer prev;
+        bool ok = true;
+        const int lvl = level; // 任务按值捕获，不引用this
+
+        // 取出最早的一块并发送
+        auto drain_one = [&]() {
+            Chunk c = pending.front().get();
+            pending.pop_front();
+            if (!c.ok) return false;
+            adler = adler32_combine(adler, c.adler, c.len);
+            return c.out.empty() || sink(c.out.data(), c.out.size());
+        };
+
+        do {
+            size_t len = std::min<uint64_t>(ZMODE_CHUNK_SIZE, size - offset);
+            Buffer in = std::make_shared<std::vector<char>>(len);
+            for (size_t got = 0; ok && got < len; ) {
+                ssize_t n = pread(fd, in->data() + got, len - got, offset + got);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) ok = false; // 读错误或文件在读取中被截断
+                else got += n;
+            }
+            if (!ok) break;
+            offset += len;
+            bool last = offset >= size;
+
+            if (engine == ZEngine::Deflate) {
+                pending.push_back(pool.submit([in, prev, lvl, last] { return deflate_chunk(in, prev, lvl, last); }));
+            }
+#ifdef HAVE_ZSTD
+            else {
+                pending.push_back(pool.submit([in, lvl] { return zstd_chunk(in, lvl); }));
+            }
+#endif
+            prev = in;
+
+            if (pending.size() >= window && !(ok = drain_one())) break;
+        } while (offset < size);
+
+        while (ok && !pending.empty()) ok = drain_one();
+        // 任何退出路径都要等已提交的任务结束，它们引用的缓冲区和结果都在本函数内
+        while (!pending.empty()) {
+            pending.front().wait();
+            pending.pop_front();
+        }
+        if (!ok) return false;
+
+        if (engine == ZEngine::Deflate) {
+            char trailer[4] = {
+                static_cast<char>(adler >> 24), static_cast<char>(adler >> 16),
+                static_cast<char>(adler >> 8), static_cast<char>(adler)
+            };
+            return sink(trailer, 4);
+        }
+        return true;
+    }
+};
+
+// 流式压缩：用于SITE RETRDIR，输入长度事先未知，输出缓冲固定大小
+// deflate引擎输出gzip格式，可直接用tar xz解开
+class StreamCompressor {
+private:
+    ZEngine engine;
+    z_stream zs{};
+    bool ready = false;
+#ifdef HAVE_ZSTD
+    ZSTD_CStream* zcs = nullptr;
+#endif
+    std::vector<char> out = std::vector<char>(64 * 1024);
+
+    bool deflate_step(int flush, const std::function<bool(const char*, size_t)>& sink) {
+        int ret;
+        do {
+            zs.next_out = reinterpret_cast<Bytef*>(out.data());
+            zs.avail_out = out.size();
+            ret = deflate(&zs, flush);
+            if (ret == Z_STREAM_ERROR) return false;
+            size_t n = out.size() - zs.avail_out;
+            if (n && !sink(out.data(), n)) return false;
+        } while (zs.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+        return true;
+    }
+
+public:
+    StreamCompressor(ZEngine e, int level) : engine(e) {
+        if (engine == ZEngine::Deflate) {
+            ready = deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        }
+#ifdef HAVE_ZSTD
+        else {
+            zcs = ZSTD_createCStream();
+            ready = zcs && !ZSTD_isError(ZSTD_initCStream(zcs, level));
+        }
+#endif
+    }
+
+    ~StreamCompressor() {
+        if (engine == ZEngine::Deflate) {
+            if (ready) deflateEnd(&zs);
+        }
+#ifdef HAVE_ZSTD
+        else ZSTD_freeCStream(zcs);
+#endif
+    }
+
+    StreamCompressor(const StreamCompressor&) = delete;
+    StreamCompressor& operator=(const StreamCompressor&) = delete;
+
+    // 输入一段数据，压缩结果交给sink；sink返回false时中止
+    bool feed(const char* data, size_t len, const std::function<bool(const char*, size_t)>& sink) {
+        if (!ready) return false;
+        if (engine == ZEngine::Deflate) {
+            zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            zs.avail_in = len;
+            return deflate_step(Z_NO_FLUSH, sink);
+        }
+#ifdef HAVE_ZSTD
+        ZSTD_inBuffer in = {data, len, 0};
+        while (in.pos < in.size) {
+            ZSTD_outBuffer o = {out.data(), out.size(), 0};
+            if (ZSTD_isError(ZSTD_compressStream(zcs, &o, &in))) return false;
+            if (o.pos && !sink(out.data(), o.pos)) return false;
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // 输出剩余数据并结束压缩流
+    bool finish(const std::function<bool(const char*, size_t)>& sink) {
+        if (!ready) return false;
+        if (engine == ZEngine::Deflate) {
+            zs.next_in = nullptr;
+            zs.avail_in = 0;
+            return deflate_step(Z_FINISH, sink);
+        }
+#ifdef HAVE_ZSTD
+        size_t left;
+        do {
+            ZSTD_outBuffer o = {out.data(), out.size(), 0};
+            left = ZSTD_endStream(zcs, &o);
+            if (ZSTD_isError(left)) return false;
+            if (o.pos && !sink(out.data(), o.pos)) return false;
+        } while (left > 0);
+        return true;
+#else
+        return false;
+#endif
+    }
+};
+
+// 流式解压：用于MODE Z下的STOR
+class StreamDecompressor {
+private:
+    ZEngine engine;
+    z_stream zs{};
+    bool finished = false;
+#ifdef HAVE_ZSTD
+    ZSTD_DStream* zds = nullptr;
+#endif
+    std::vector<char> out = std::vector<char>(64 * 1024);
+
+public:
+    explicit StreamDecompressor(ZEngine e) : engine(e) {
+        if (engine == ZEngine::Deflate) inflateInit(&zs);
+#ifdef HAVE_ZSTD
+        else zds = ZSTD_createDStream();
+#endif
+    }
+
+    ~StreamDecompressor() {
+        if (engine == ZEngine::Deflate) inflateEnd(&zs);
+#ifdef HAVE_ZSTD
+        else ZSTD_freeDStream(zds);
+#endif
+    }
+
+    // 输入一段压缩数据，解出的数据交给sink；数据损坏返回false
+    bool feed(const char* data, size_t len, const std::function<bool(const char*, size_t)>& sink) {
+        if (engine == ZEngine::Deflate) {
+            zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            zs.avail_in = len;
+            while (zs.avail_in > 0 && !finished) {
+                zs.next_out = reinterpret_cast<Bytef*>(out.data());
+                zs.avail_out = out.size();
+                int ret = inflate(&zs, Z_NO_FLUSH);
+                if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) return false;
+                size_t n = out.size() - zs.avail_out;
+                if (n && !sink(out.data(), n)) return false;
+                if (ret == Z_STREAM_END) finished = true;
+                else if (ret == Z_BUF_ERROR && n == 0) break;
+            }
+            return true;
+        }
+#ifdef HAVE_ZSTD
+        ZSTD_inBuffer in = {data, len, 0};
+        while (in.pos < in.size) {
+            ZSTD_outBuffer o = {out.data(), out.size(), 0};
+            size_t ret = ZSTD_decompressStream(zds, &o, &in);
+            if (ZSTD_isError(ret)) return false;
+            if (o.pos && !sink(out.data(), o.pos)) return false;
+            finished = ret == 0;
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // 流是否完整结束（deflate需读到结尾的adler32）
+    bool complete() const { return finished; }
+};